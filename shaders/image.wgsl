@@ -13,6 +13,7 @@ struct ImageUniforms {
     pos: vec2<f32>,
     rot: f32,
     opacity: f32,
+    channels: u32,
 };
 
 @group(1) @binding(0) var image_tex: texture_2d<f32>;
@@ -27,6 +28,17 @@ fn rotate_2d(a : f32, vec : vec2<f32>) -> vec2<f32> {
     return mat2x2<f32>(cos(a), sin(a), -sin(a), cos(a)) * vec;
 } 
 
+// grey images are R8 (grey) or RG8 (grey, alpha) textures, see image_texture_format
+fn swizzle(texel: vec4<f32>, channels: u32) -> vec4<f32> {
+    if (channels == 1u) {
+        return vec4<f32>(texel.rrr, 1.0);
+    }
+    if (channels == 2u) {
+        return vec4<f32>(texel.rrr, texel.g);
+    }
+    return texel;
+}
+
 @fragment fn fs_main(@builtin(position) coord : vec4<f32>) -> @location(0) vec4<f32> {
     var uv = coord.xy - (image_uniforms.size / 2.0) - image_uniforms.pos;
     uv = rotate_2d(-image_uniforms.rot, uv);
@@ -34,7 +46,7 @@ fn rotate_2d(a : f32, vec : vec2<f32>) -> vec2<f32> {
     uv += 0.5;
     var color = textureSample(input_tex, input_sampler, fullscreen_uv(coord.xy));
 
-    var image = textureSample(image_tex, image_sampler, uv);
+    var image = swizzle(textureSample(image_tex, image_sampler, uv), image_uniforms.channels);
     if (all(uv >= vec2<f32>(0.0)) && all(uv <= vec2<f32>(1.0))) {
         image.a *= image_uniforms.opacity;
         color = image * image.a + color * (1.0 - image.a);
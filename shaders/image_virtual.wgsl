@@ -0,0 +1,89 @@
+struct DefaultUniforms {
+    viewport_size: vec2<u32>,
+    time: f32,
+};
+
+@group(0) @binding(0) var input_tex: texture_2d<f32>;
+@group(0) @binding(1) var input_sampler: sampler;
+@group(0) @binding(2) var<uniform> default_uniforms: DefaultUniforms;
+
+
+struct ImageUniforms {
+    size: vec2<f32>,
+    pos: vec2<f32>,
+    rot: f32,
+    opacity: f32,
+    channels: u32,  // always 4, virtual textures are RGBA
+};
+
+// see VirtualTexture in src/context/virtual_texture.hpp
+struct VirtualUniforms {
+    image_size: vec2<f32>,
+    level_count: u32,
+    slots_per_row: u32,
+    levels: array<vec4<u32>, 8>,  // width, height, first page table row, unused
+};
+
+const TILE_SIZE: u32 = 256u;
+const TILE_BORDER: f32 = 1.0;
+const SLOT_SIZE: f32 = 258.0;
+
+@group(1) @binding(0) var image_tex: texture_2d<f32>;  // overview
+@group(1) @binding(1) var image_sampler: sampler;
+@group(1) @binding(2) var<uniform> image_uniforms: ImageUniforms;
+@group(1) @binding(3) var tile_atlas: texture_2d<f32>;
+@group(1) @binding(4) var page_table: texture_2d<u32>;
+@group(1) @binding(5) var<uniform> virtual_uniforms: VirtualUniforms;
+
+fn fullscreen_uv(coord : vec2<f32>) -> vec2<f32> {
+    return coord / vec2<f32>(default_uniforms.viewport_size);
+}
+
+fn rotate_2d(a : f32, vec : vec2<f32>) -> vec2<f32> {
+    return mat2x2<f32>(cos(a), sin(a), -sin(a), cos(a)) * vec;
+}
+
+// same rounding as VirtualTexture::level_for, level_count selects the overview
+fn sampled_level() -> u32 {
+    let size = abs(image_uniforms.size);
+    if (size.x == 0.0 || size.y == 0.0) {
+        return virtual_uniforms.level_count;
+    }
+    let texels_per_pixel = max(virtual_uniforms.image_size.x / size.x, virtual_uniforms.image_size.y / size.y);
+    let level = u32(floor(log2(max(texels_per_pixel, 1.0)) + 0.5));
+    return min(level, virtual_uniforms.level_count);
+}
+
+@fragment fn fs_main(@builtin(position) coord : vec4<f32>) -> @location(0) vec4<f32> {
+    var uv = coord.xy - (image_uniforms.size / 2.0) - image_uniforms.pos;
+    uv = rotate_2d(-image_uniforms.rot, uv);
+    uv /= image_uniforms.size;
+    uv += 0.5;
+    var color = textureSample(input_tex, input_sampler, fullscreen_uv(coord.xy));
+
+    var image = textureSample(image_tex, image_sampler, uv);
+    let clamped_uv = clamp(uv, vec2<f32>(0.0), vec2<f32>(1.0));
+    let atlas_size = vec2<f32>(textureDimensions(tile_atlas));
+    // the finest resident level at or above the sampled one, the overview when none is
+    for (var level = sampled_level(); level < virtual_uniforms.level_count; level++) {
+        let level_info = virtual_uniforms.levels[level];
+        let texel = clamped_uv * vec2<f32>(level_info.xy);
+        let tiles = (level_info.xy + vec2<u32>(TILE_SIZE - 1u)) / TILE_SIZE;
+        let tile = min(vec2<u32>(texel) / TILE_SIZE, tiles - vec2<u32>(1u));
+        let entry = textureLoad(page_table, vec2<u32>(tile.x, level_info.z + tile.y), 0).r;
+        if (entry > 0u) {
+            let slot = entry - 1u;
+            let slots_per_row = virtual_uniforms.slots_per_row;
+            let slot_origin = vec2<f32>(f32(slot % slots_per_row), f32(slot / slots_per_row));
+            let atlas_texel = slot_origin * SLOT_SIZE + TILE_BORDER + texel - vec2<f32>(tile * TILE_SIZE);
+            image = textureSampleLevel(tile_atlas, image_sampler, atlas_texel / atlas_size, 0.0);
+            break;
+        }
+    }
+
+    if (all(uv >= vec2<f32>(0.0)) && all(uv <= vec2<f32>(1.0))) {
+        image.a *= image_uniforms.opacity;
+        color = image * image.a + color * (1.0 - image.a);
+    }
+    return color;
+}
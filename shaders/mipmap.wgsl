@@ -0,0 +1,10 @@
+// Downsamples the previous mip level into the bound target: with a linear sampler, sampling at the center of each
+// target texel averages the 2x2 source texels under it.
+
+@group(0) @binding(0) var source_tex: texture_2d<f32>;
+@group(0) @binding(1) var source_sampler: sampler;
+
+@fragment fn fs_main(@builtin(position) coord : vec4<f32>) -> @location(0) vec4<f32> {
+    let target_size = max(textureDimensions(source_tex) / 2u, vec2<u32>(1u));
+    return textureSample(source_tex, source_sampler, coord.xy / vec2<f32>(target_size));
+}
@@ -0,0 +1,25 @@
+// Shared header of fused pointwise passes (see src/shader/fusion.cpp).
+// Code between `// fusion: begin` and `// fusion: end` in an effect shader may only rely on what is declared here.
+const PI: f32 = 3.14159265;
+
+struct DefaultUniforms {
+    viewport_size: vec2<u32>,
+    time: f32,
+};
+
+@group(0) @binding(0) var input_tex: texture_2d<f32>;
+@group(0) @binding(1) var input_sampler: sampler;
+@group(0) @binding(2) var<uniform> default_uniforms: DefaultUniforms;
+
+fn fullscreen_uv(coord: vec2<f32>) -> vec2<f32> {
+    return coord / vec2<f32>(default_uniforms.viewport_size);
+}
+
+fn pcg3d(vec: vec3<u32>) -> vec3<u32> {
+    // from: http://www.jcgt.org/published/0009/03/02/
+    var v = vec * vec3<u32>(1664525u) + vec3<u32>(1013904223u);
+    v.x += v.y*v.z; v.y += v.z*v.x; v.z += v.x*v.y;
+    v.x ^= v.x >> 16u; v.y ^= v.y >> 16u; v.z ^= v.z >> 16u;
+    v.x += v.y*v.z; v.y += v.z*v.x; v.z += v.x*v.y;
+    return v;
+}
@@ -0,0 +1,44 @@
+// Draws a whole texture into the viewport, which is set to a cell of the thumbnail atlas. Sampling goes through the
+// mip chain of the source, so the downscale does not alias.
+
+struct VertexOutput {
+    @builtin(position) position: vec4<f32>,
+    @location(0) uv: vec2<f32>,
+};
+
+@vertex
+fn vs_main(@builtin(vertex_index) vertex_index: u32) -> VertexOutput {
+    var positions = array<vec2<f32>, 3>(
+        vec2<f32>(-1.0, -1.0),
+        vec2<f32>(3.0, -1.0),
+        vec2<f32>(-1.0, 3.0),
+    );
+    let pos = positions[vertex_index];
+    var out: VertexOutput;
+    out.position = vec4<f32>(pos, 0.0, 1.0);
+    out.uv = vec2<f32>(pos.x * 0.5 + 0.5, 0.5 - pos.y * 0.5);
+    return out;
+}
+
+struct ThumbnailUniforms {
+    channels: u32,
+};
+
+@group(0) @binding(0) var source_tex: texture_2d<f32>;
+@group(0) @binding(1) var source_sampler: sampler;
+@group(0) @binding(2) var<uniform> thumbnail_uniforms: ThumbnailUniforms;
+
+// same as image.wgsl
+fn swizzle(texel: vec4<f32>, channels: u32) -> vec4<f32> {
+    if (channels == 1u) {
+        return vec4<f32>(texel.rrr, 1.0);
+    }
+    if (channels == 2u) {
+        return vec4<f32>(texel.rrr, texel.g);
+    }
+    return texel;
+}
+
+@fragment fn fs_main(in: VertexOutput) -> @location(0) vec4<f32> {
+    return swizzle(textureSample(source_tex, source_sampler, in.uv), thumbnail_uniforms.channels);
+}
@@ -6,9 +6,14 @@
 #include <sys/types.h>
 #include <webgpu/webgpu.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <filesystem>
+#include <format>
+#include <iterator>
+#include <string>
+#include <vector>
 #include <webgpu/webgpu-raii.hpp>
 
 #include "src/context/resource.hpp"
@@ -18,6 +23,69 @@
 App::App(Context& ctx) : ctx(ctx), shader_manager(ctx) {}
 
 
+std::string format_bytes(size_t bytes) {
+    constexpr const char* units[] = {"B", "KB", "MB", "GB"};
+    double value = static_cast<double>(bytes);
+    size_t unit = 0;
+    while (value >= 1024.0 && unit + 1 < std::size(units)) {
+        value /= 1024.0;
+        unit++;
+    }
+    return std::format("{:.1f} {}", value, units[unit]);
+}
+
+
+// Retention policy of decoded pixels and the bytes each resource holds, largest first.
+void memory_display(ResourceManager& ressource_manager) {
+    PixelRetention retention = ressource_manager.get_pixel_retention();
+    ImGui::SetNextItemWidth(160);
+    if (ImGui::BeginCombo("CPU pixels", pixel_retention_name(retention))) {
+        for (PixelRetention option : {PixelRetention::Free, PixelRetention::Compressed, PixelRetention::Raw}) {
+            if (ImGui::Selectable(pixel_retention_name(option), option == retention)) {
+                ressource_manager.set_pixel_retention(option);
+            }
+        }
+        ImGui::EndCombo();
+    }
+    ImGui::SameLine();
+    int upload_budget_mb = static_cast<int>(ressource_manager.get_upload_budget() >> 20);
+    ImGui::SetNextItemWidth(120);
+    if (ImGui::SliderInt("upload MB/frame", &upload_budget_mb, 1, 256)) {
+        ressource_manager.set_upload_budget(static_cast<size_t>(upload_budget_mb) << 20);
+    }
+
+    if (!ImGui::TreeNode("memory")) return;
+    std::vector<MemoryUsage> usage = ressource_manager.memory_usage();
+    size_t shared_gpu_bytes = ressource_manager.shared_gpu_bytes();
+    size_t cpu_total = 0;
+    size_t gpu_total = shared_gpu_bytes;
+    if (ImGui::BeginTable("memory_usage", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp)) {
+        ImGui::TableSetupColumn("resource");
+        ImGui::TableSetupColumn("CPU");
+        ImGui::TableSetupColumn("GPU");
+        ImGui::TableHeadersRow();
+        auto row = [](const std::string& name, size_t cpu_bytes, size_t gpu_bytes) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(name.c_str());
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(format_bytes(cpu_bytes).c_str());
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(format_bytes(gpu_bytes).c_str());
+        };
+        for (const MemoryUsage& resource : usage) {
+            row(resource.name, resource.cpu_bytes, resource.gpu_bytes);
+            cpu_total += resource.cpu_bytes;
+            gpu_total += resource.gpu_bytes;
+        }
+        row("(shared atlases)", 0, shared_gpu_bytes);
+        row("total", cpu_total, gpu_total);
+        ImGui::EndTable();
+    }
+    ImGui::TreePop();
+}
+
+
 void ressource_manager_display(ResourceManager& ressource_manager) {
     static FileLoader file_loader;
 
@@ -33,25 +101,56 @@ void ressource_manager_display(ResourceManager& ressource_manager) {
 #else
             [&](const std::string& file) {
                 std::filesystem::path path = file;
-                ressource_manager.add_image(path.stem(), path);
+                ressource_manager.add_image_async(path.stem(), path);  // decoded in the background
             }
 #endif
         );
     }
+#ifndef __EMSCRIPTEN__
+    ImGui::SameLine();
+    if (ImGui::Button("Import video")) {
+        file_loader.open_dialog<ResourceKind::Video>([&](const std::string& file) {
+            std::filesystem::path path = file;
+            if (!ressource_manager.add_video(path.stem(), path)) Log::error("Could not open video {}.", file);
+        });
+    }
+#endif
     ImGui::EndDisabled();
-
-    float vignette_size = 200;
-    float max_cursor_x = ImGui::GetCursorPosX() + ImGui::GetContentRegionAvail().x - vignette_size;
-    for (auto& [resource_id, index] : ressource_manager.images_index_map) {
-        auto& resource = ressource_manager.images[index];
-        ImGui::BeginChild(
-            std::format("{}{}", resource.name, resource_id).c_str(),
-            ImVec2(vignette_size, vignette_size)
-        );
-        resource.display();
-        ImGui::EndChild();
+#ifndef __EMSCRIPTEN__
+    if (size_t loading = ressource_manager.loading_count(); loading > 0) {
         ImGui::SameLine();
-        if (ImGui::GetCursorPosX() > max_cursor_x) ImGui::NewLine();
+        ImGui::TextDisabled("decoding %zu images...", loading);
+    }
+#endif
+    memory_display(ressource_manager);
+
+    std::vector<size_t> ids;
+    ressource_manager.for_each_texture([&](size_t id, const std::string&) { ids.push_back(id); });
+
+    const float vignette_size = 200;
+    const ImVec2 spacing = ImGui::GetStyle().ItemSpacing;
+    size_t columns =
+        static_cast<size_t>(std::max(1.0f, (ImGui::GetContentRegionAvail().x + spacing.x) / (vignette_size + spacing.x)));
+    size_t rows = (ids.size() + columns - 1) / columns;
+
+    // only the rows in view are submitted
+    ImGuiListClipper clipper;
+    clipper.Begin(rows, vignette_size + spacing.y);
+    while (clipper.Step()) {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+            for (size_t column = 0; column < columns && row * columns + column < ids.size(); column++) {
+                size_t id = ids[row * columns + column];
+                if (column > 0) ImGui::SameLine();
+                ImGui::BeginChild(std::format("vignette{}", id).c_str(), ImVec2(vignette_size, vignette_size));
+                ressource_manager.display_thumbnail(id);
+                if (ImGui::BeginPopupContextWindow()) {
+                    // stages drawing it keep it alive until they are deleted
+                    if (ImGui::MenuItem("remove")) ressource_manager.remove(id);
+                    ImGui::EndPopup();
+                }
+                ImGui::EndChild();
+            }
+        }
     }
 }
 
@@ -0,0 +1,253 @@
+#include "headless.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "context.hpp"
+#include "src/bounded_queue.hpp"
+#include "src/context/readback.hpp"
+#include "src/log.hpp"
+#include "src/pnm.hpp"
+#include "src/shader/manager.hpp"
+
+
+// Images flow through a bounded pipeline so every stage overlaps with the others:
+//   decode (thread pool) -> upload + render + copy (render thread) -> readback (staging ring) -> encode (thread pool)
+// The mean occupancy of the queue in front of each stage shows where the bottleneck is: a full queue feeds a slow stage.
+
+
+namespace {
+
+struct DecodedImage {
+    std::filesystem::path path;
+    Resource<ResourceKind::Image>::Data data;
+};
+
+struct RenderedImage {
+    std::filesystem::path path;
+    std::vector<uint8_t> pixels;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct Occupancy {
+    double sum = 0.0;
+    size_t samples = 0;
+
+    void sample(size_t size, size_t capacity) {
+        sum += static_cast<double>(size) / capacity;
+        samples++;
+    }
+
+    double mean() const {
+        return samples ? 100.0 * sum / samples : 0.0;
+    }
+};
+
+
+void usage(const char* program) {
+    Log::log(
+        "usage: {} batch --chain FILE --input DIR --output DIR [--fallback] [--decoders N] [--encoders N] [--depth N]\n"
+        "  --chain     chain saved with `--save-chain`, the input image is drawn before its stages\n"
+        "  --decoders  decoding threads (default: hardware concurrency / 2)\n"
+        "  --encoders  encoding threads (default: 2)\n"
+        "  --depth     capacity of each queue and of the readback ring (default: 4)",
+        program
+    );
+}
+
+
+std::vector<std::filesystem::path> list_images(const std::filesystem::path& directory) {
+    static constexpr std::string_view EXTENSIONS[] = {
+        ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".gif", ".psd", ".hdr", ".pic", ".ppm", ".pgm", ".pam", ".qoi",
+        ".rgba"
+    };
+
+    std::vector<std::filesystem::path> images;
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory)) {
+        if (!entry.is_regular_file()) continue;
+        std::string extension = entry.path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if (std::find(std::begin(EXTENSIONS), std::end(EXTENSIONS), extension) != std::end(EXTENSIONS)) {
+            images.push_back(entry.path());
+        }
+    }
+    std::sort(images.begin(), images.end());
+    return images;
+}
+
+}  // namespace
+
+
+int run_batch(int argc, char** argv) {
+    GPUOptions gpu_options;
+    std::filesystem::path chain_path, input, output;
+    size_t decoder_count = std::max(1u, std::thread::hardware_concurrency() / 2);
+    size_t encoder_count = 2;
+    size_t depth = 4;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--fallback") {
+            gpu_options.force_fallback_adapter = true;
+        } else if (arg == "--chain" && has_value) {
+            chain_path = argv[++i];
+        } else if (arg == "--input" && has_value) {
+            input = argv[++i];
+        } else if (arg == "--output" && has_value) {
+            output = argv[++i];
+        } else if (arg == "--decoders" && has_value) {
+            decoder_count = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--encoders" && has_value) {
+            encoder_count = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--depth" && has_value) {
+            depth = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (chain_path.empty() || input.empty() || output.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!std::filesystem::is_directory(input)) {
+        Log::error("{} is not a directory.", input.string());
+        return 1;
+    }
+    std::filesystem::create_directories(output);
+
+    std::vector<std::filesystem::path> images = list_images(input);
+    if (images.empty()) {
+        Log::warn("No image found in {}.", input.string());
+        return 0;
+    }
+
+    Context ctx(gpu_options);
+    if (!ctx.gpu.is_initialized()) return 1;
+    const wgpu::Device& device = ctx.gpu.get_device();
+
+    // The first image doubles as the resource every input goes through, it sets the initial size too
+    size_t image_id = ctx.resource_manager.add_image("input", images[0]);
+    Resource<ResourceKind::Image>& image_resource = ctx.resource_manager.get_image(image_id);
+    if (!image_resource.is_loaded()) return 1;
+    ctx.render_target.dim = {
+        static_cast<unsigned int>(image_resource.data.width), static_cast<unsigned int>(image_resource.data.height)
+    };
+
+    ShaderManager shader_manager(ctx);
+    shader_manager.add_shader<Shader<ShaderKind::Image>>("input", image_id, ctx);
+    std::ifstream chain_file(chain_path);
+    if (!chain_file || !shader_manager.load_chain(chain_file)) {
+        Log::error("Could not load chain {}.", chain_path.string());
+        return 1;
+    }
+
+    BoundedQueue<DecodedImage> decoded(depth);
+    BoundedQueue<RenderedImage> rendered(depth);
+    ReadbackRing readback(ctx.gpu, depth);
+    Occupancy decoded_occupancy, readback_occupancy, rendered_occupancy;
+    std::atomic<size_t> failures = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Decode stage, the first image is already loaded in the resource
+    std::atomic<size_t> next_image = 1;
+    std::atomic<size_t> running_decoders = decoder_count;
+    std::vector<std::jthread> decoders;
+    for (size_t i = 0; i < decoder_count; i++) {
+        decoders.emplace_back([&]() {
+            for (size_t index = next_image++; index < images.size(); index = next_image++) {
+                Resource<ResourceKind::Image>::Data data = Resource<ResourceKind::Image>::load(images[index]);
+                if (!data.ptr) {
+                    Log::error("Could not decode {}.", images[index].string());
+                    failures++;
+                    continue;
+                }
+                decoded.push(DecodedImage{images[index], std::move(data)});
+            }
+            if (--running_decoders == 0) decoded.close();
+        });
+    }
+
+    // Encode stage
+    std::vector<std::jthread> encoders;
+    for (size_t i = 0; i < encoder_count; i++) {
+        encoders.emplace_back([&]() {
+            while (std::optional<RenderedImage> image = rendered.pop()) {
+                std::filesystem::path destination = output / image->path.filename().replace_extension(".ppm");
+                if (!write_pnm(destination, image->pixels.data(), image->width, image->height)) failures++;
+            }
+        });
+    }
+
+    // Render stage, on this thread as it owns the device
+    auto render = [&](const std::filesystem::path& path) {
+        unsigned int width = image_resource.data.width;
+        unsigned int height = image_resource.data.height;
+        if (ctx.render_target.dim != std::array{width, height}) shader_manager.resize(width, height);
+        while (shader_manager.is_compiling()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        shader_manager.render_chain_streamed();
+
+        wgpu::raii::CommandEncoder cmd_encoder = device.createCommandEncoder();
+        auto on_read = [&, path](const ReadbackRing::Frame& frame) {
+            RenderedImage image{path, std::vector<uint8_t>(frame.width * frame.height * 4), frame.width, frame.height};
+            for (size_t y = 0; y < frame.height; y++) {
+                std::memcpy(
+                    image.pixels.data() + y * frame.width * 4, frame.pixels + y * frame.bytes_per_row, frame.width * 4
+                );
+            }
+            rendered.push(std::move(image));
+        };
+        while (!readback.enqueue(*cmd_encoder, shader_manager.get_result_texture(), width, height, on_read)) {
+            device.poll(false, nullptr);  // ring full, let mappings complete
+            std::this_thread::yield();
+        }
+        wgpu::raii::CommandBuffer cmd_buffer = cmd_encoder->finish();
+        wgpu::raii::Queue queue = device.getQueue();
+        queue->submit(1, &(*cmd_buffer));
+        readback.flush();
+        device.poll(false, nullptr);
+
+        decoded_occupancy.sample(decoded.size(), decoded.get_capacity());
+        readback_occupancy.sample(readback.in_flight(), readback.capacity());
+        rendered_occupancy.sample(rendered.size(), rendered.get_capacity());
+    };
+
+    render(images[0]);
+    while (std::optional<DecodedImage> image = decoded.pop()) {
+        image_resource.update(std::move(image->data), ctx.gpu);
+        render(image->path);
+    }
+    while (readback.in_flight() > 0) device.poll(true, nullptr);
+    rendered.close();
+    encoders.clear();  // joins
+
+    float seconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+    size_t processed = images.size() - failures;
+    Log::info(
+        "Processed {} images in {:.2f} s ({:.1f} images/s), {} failed.",
+        processed,
+        seconds,
+        processed / seconds,
+        failures.load()
+    );
+    Log::info(
+        "Mean queue occupancy: decoded {:.0f}%, readback {:.0f}%, to encode {:.0f}%.",
+        decoded_occupancy.mean(),
+        readback_occupancy.mean(),
+        rendered_occupancy.mean()
+    );
+
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,453 @@
+#define WEBGPU_CPP_IMPLEMENTATION
+#include <webgpu/webgpu-raii.hpp>
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "context.hpp"
+#include "shaders_code.hpp"
+#include "src/hash.hpp"
+#include "src/log.hpp"
+#include "src/pnm.hpp"
+#include "src/qoi.hpp"
+#include "src/shader/parameter.hpp"
+#include "src/shader/shader.hpp"
+#include "src/shader/shaders/chromatic_aberration.hpp"
+#include "src/shader/shaders/dithering.hpp"
+#include "src/shader/shaders/image.hpp"
+#include "src/shader/shaders/noise.hpp"
+
+
+// Microbenchmarks of the CPU work repeated every frame: stage dispatch, parameter widgets, the Box2D overlay clipping,
+// shader source lookups, and image decoding on import. Each benchmark is calibrated so a sample lasts at least
+// `--sample-ms`, then sampled until `--samples` or `--max-ms` is reached. Reported per iteration: median, p99 and min
+// of the sample means, and heap allocations counted by the global `operator new` below. Only benchmarks sampled one
+// iteration at a time get a true per-iteration p99, batching smooths out the others' spikes. Benchmarks needing a
+// device are skipped when no adapter is found.
+
+
+namespace {
+std::atomic<size_t> allocation_count = 0;
+
+void* counted_alloc(size_t size, size_t alignment) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    size = std::max<size_t>(size, 1);
+    void* p = alignment <= alignof(std::max_align_t)
+                  ? std::malloc(size)
+                  : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);  // size rounded up
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+}  // namespace
+
+void* operator new(size_t size) {
+    return counted_alloc(size, alignof(std::max_align_t));
+}
+void* operator new[](size_t size) {
+    return counted_alloc(size, alignof(std::max_align_t));
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+    return counted_alloc(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return counted_alloc(size, static_cast<size_t>(alignment));
+}
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+void operator delete[](void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+
+namespace {
+
+struct Benchmark {
+    std::string name;
+    std::function<void(size_t iterations)> run;  // timed
+    std::function<void()> before_sample = nullptr;  // untimed set up and tear down around each sample
+    std::function<void()> after_sample = nullptr;
+};
+
+struct Summary {
+    std::string name;
+    size_t iterations;  // per sample
+    size_t samples;
+    double median_ns;
+    double p99_ns;  // of the sample means
+    double min_ns;
+    double allocations;  // per iteration
+};
+
+struct Options {
+    size_t samples = 100;
+    double sample_ms = 1.0;
+    double max_ms = 2000.0;
+};
+
+
+// keeps the computation of `value` from being optimized out
+template <typename T>
+void keep(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+
+Summary measure(const Benchmark& benchmark, const Options& options) {
+    using Clock = std::chrono::steady_clock;
+    auto sample = [&](size_t iterations) {
+        if (benchmark.before_sample) benchmark.before_sample();
+        auto start = Clock::now();
+        benchmark.run(iterations);
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        if (benchmark.after_sample) benchmark.after_sample();
+        return ns;
+    };
+
+    size_t iterations = 1;
+    while (sample(iterations) < options.sample_ms * 1e6 && iterations < (size_t(1) << 30)) iterations *= 2;
+
+    std::vector<double> per_iteration;
+    size_t allocations = 0;
+    auto start = Clock::now();
+    while (per_iteration.size() < options.samples) {
+        size_t allocations_before = allocation_count.load(std::memory_order_relaxed);
+        per_iteration.push_back(sample(iterations) / static_cast<double>(iterations));
+        allocations += allocation_count.load(std::memory_order_relaxed) - allocations_before;
+        bool out_of_time = std::chrono::duration<double, std::milli>(Clock::now() - start).count() > options.max_ms;
+        if (out_of_time && per_iteration.size() >= 5) break;
+    }
+
+    std::sort(per_iteration.begin(), per_iteration.end());
+    size_t n = per_iteration.size();
+    return {
+        .name = benchmark.name,
+        .iterations = iterations,
+        .samples = n,
+        .median_ns = n % 2 ? per_iteration[n / 2] : (per_iteration[n / 2 - 1] + per_iteration[n / 2]) / 2.0,
+        .p99_ns = per_iteration[std::min(n - 1, (99 * n + 99) / 100 - 1)],
+        .min_ns = per_iteration[0],
+        .allocations = static_cast<double>(allocations) / static_cast<double>(n * iterations),
+    };
+}
+
+
+std::string format_ns(double ns) {
+    if (ns >= 1e6) return std::format("{:.3f} ms", ns * 1e-6);
+    if (ns >= 1e3) return std::format("{:.3f} us", ns * 1e-3);
+    return std::format("{:.1f} ns", ns);
+}
+
+
+// Stage dispatch as `ShaderManager::render_chain` stamps passes: one `apply` per stage hashing its uniforms.
+void add_dispatch_benchmarks(std::vector<Benchmark>& benchmarks, std::vector<std::unique_ptr<ShaderUnion>>& shaders) {
+    for (size_t count : {8, 64, 512}) {
+        benchmarks.push_back({
+            .name = std::format("tagged_union_apply/{}", count),
+            .run =
+                [&shaders, count](size_t iterations) {
+                    for (size_t i = 0; i < iterations; i++) {
+                        uint64_t stamp = 0;
+                        for (size_t s = 0; s < count; s++) {
+                            stamp = shaders[s]->apply([&](auto& shader) {
+                                uint64_t h = fnv1a_value(shader.bindings_version, fnv1a_value(shader.uniforms, stamp));
+                                return shader.is_dynamic() ? fnv1a_value(0.0f, h) : h;
+                            });
+                        }
+                        keep(stamp);
+                    }
+                },
+        });
+    }
+}
+
+
+void add_source_cache_benchmark(std::vector<Benchmark>& benchmarks, const ShaderSourceCache& cache) {
+    static const std::array<const char*, 5> sources = {
+        fullscreen_vertex, noise, dithering, chromatic_aberration, image
+    };
+    for (const char* source : sources) cache.get(source);  // compiled once, lookups only below
+
+    benchmarks.push_back({
+        .name = "shader_source_cache_get",
+        .run =
+            [&cache](size_t iterations) {
+                for (size_t i = 0; i < iterations; i++) keep(&cache.get(sources[i % sources.size()]));
+            },
+    });
+}
+
+
+// Drawn at the same place in a single window per sample, so no widget is clipped away.
+template <typename Group>
+Benchmark widget_benchmark(const std::string& name, std::shared_ptr<Group> group) {
+    return {
+        .name = name,
+        .run =
+            [group](size_t iterations) {
+                for (size_t i = 0; i < iterations; i++) {
+                    ImGui::SetCursorPos({8.0f, 32.0f});
+                    ImGui::PushID(static_cast<int>(i));
+                    keep(group->display());
+                    ImGui::PopID();
+                }
+            },
+        .before_sample =
+            []() {
+                ImGui::NewFrame();
+                ImGui::SetNextWindowSize({600.0f, 400.0f});
+                ImGui::Begin("benchmark");
+            },
+        .after_sample =
+            []() {
+                ImGui::End();
+                ImGui::EndFrame();
+            },
+    };
+}
+
+void add_widget_benchmarks(std::vector<Benchmark>& benchmarks, float* values) {
+    using FField = Float<2, WidgetKind::DragField>;
+    using Fields = WidgetGroup<FField, FField, FField>;
+    using Names = std::optional<std::array<std::string, 2>>;
+    auto fields = [&](const Names& names) {
+        return std::make_shared<Fields>(
+            FField("red", {0.1f, 0.1f}, {0, 0}, {0, 0}, std::span<float, 2>(values, 2), names),
+            FField("green", {0.1f, 0.1f}, {0, 0}, {0, 0}, std::span<float, 2>(values + 2, 2), names),
+            FField("blue", {0.1f, 0.1f}, {0, 0}, {0, 0}, std::span<float, 2>(values + 4, 2), names)
+        );
+    };
+    // named fields format their label every frame, unnamed ones format their index
+    benchmarks.push_back(widget_benchmark("widget_group_display/named_fields", fields(Names({"x", "y"}))));
+    benchmarks.push_back(widget_benchmark("widget_group_display/unnamed_fields", fields(std::nullopt)));
+}
+
+
+// The rotated Image stage rectangle clipped to the preview area, like `Box2D::draw_rotated_rect`.
+void add_clip_benchmark(std::vector<Benchmark>& benchmarks) {
+    benchmarks.push_back({
+        .name = "box2d_clip_polygon_edge/4_edges",
+        .run =
+            [](size_t iterations) {
+                const ImVec2 min = {0.0f, 0.0f};
+                const ImVec2 max = {320.0f, 180.0f};
+                const ImVec2 edges[4][2] = {
+                    {{min.x, min.y}, {max.x, min.y}},
+                    {{max.x, min.y}, {max.x, max.y}},
+                    {{max.x, max.y}, {min.x, max.y}},
+                    {{min.x, max.y}, {min.x, min.y}},
+                };
+                for (size_t i = 0; i < iterations; i++) {
+                    float angle = 0.001f * static_cast<float>(i % 1000);
+                    float c = std::cos(angle) * 120.0f;
+                    float s = std::sin(angle) * 120.0f;
+                    std::vector<ImVec2> poly = {
+                        {300.0f - c + s, 90.0f - s - c},
+                        {300.0f + c + s, 90.0f + s - c},
+                        {300.0f + c - s, 90.0f + s + c},
+                        {300.0f - c - s, 90.0f - s + c},
+                    };
+                    for (const auto& edge : edges) poly = Box2D::clip_polygon_edge(poly, edge[0], edge[1]);
+                    keep(poly.data());
+                }
+            },
+    });
+}
+
+
+// Decoding of generated images written once in the temporary directory. PAM and raw files are mapped and used in
+// place, PPM is expanded to RGBA and QOI decoded.
+void add_load_benchmarks(std::vector<Benchmark>& benchmarks) {
+    for (auto [width, height] : std::array<std::array<uint32_t, 2>, 3>{{{256, 256}, {1920, 1080}, {3840, 2160}}}) {
+        std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+        for (size_t i = 0; i < pixels.size(); i++) pixels[i] = static_cast<uint8_t>((i * 7) ^ (i >> 9));
+
+        std::filesystem::path stem =
+            std::filesystem::temp_directory_path() / std::format("moshading-bench-{}x{}", width, height);
+        std::vector<std::filesystem::path> paths;
+        for (const char* extension : {".pam", ".ppm"}) {
+            std::filesystem::path path = stem.string() + extension;
+            if (write_pnm(path, pixels.data(), width, height)) paths.push_back(path);
+        }
+        std::vector<uint8_t> qoi = qoi_encode(pixels.data(), width, height);
+        std::filesystem::path qoi_path = stem.string() + ".qoi";
+        std::ofstream(qoi_path, std::ios::binary).write(reinterpret_cast<const char*>(qoi.data()), qoi.size());
+        paths.push_back(qoi_path);
+
+        for (const std::filesystem::path& path : paths) {
+            benchmarks.push_back({
+                .name = std::format("resource_image_load/{}/{}x{}", path.extension().string().substr(1), width, height),
+                .run =
+                    [path](size_t iterations) {
+                        for (size_t i = 0; i < iterations; i++) {
+                            keep(Resource<ResourceKind::Image>::load(path).ptr);
+                        }
+                    },
+            });
+        }
+    }
+}
+
+
+void usage(const char* program) {
+    Log::log(
+        "usage: {} [--filter TEXT] [--samples N] [--sample-ms MS] [--max-ms MS] [--json FILE] [--fallback]\n"
+        "  --filter     only run benchmarks whose name contains TEXT\n"
+        "  --samples    samples per benchmark (default: 100)\n"
+        "  --sample-ms  shortest sample, iterations are doubled until reached (default: 1)\n"
+        "  --max-ms     time after which a benchmark stops sampling, with at least 5 samples (default: 2000)\n"
+        "  --json       file the summaries are written to\n"
+        "  --fallback   force the software fallback adapter",
+        program
+    );
+}
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+    Options options;
+    GPUOptions gpu_options;
+    std::string_view filter;
+    std::filesystem::path json_path;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--filter" && has_value) {
+            filter = argv[++i];
+        } else if (arg == "--samples" && has_value) {
+            options.samples = static_cast<size_t>(std::max(std::atoi(argv[++i]), 1));
+        } else if (arg == "--sample-ms" && has_value) {
+            options.sample_ms = std::atof(argv[++i]);
+        } else if (arg == "--max-ms" && has_value) {
+            options.max_ms = std::atof(argv[++i]);
+        } else if (arg == "--json" && has_value) {
+            json_path = argv[++i];
+        } else if (arg == "--fallback") {
+            gpu_options.force_fallback_adapter = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    ImGui::CreateContext();
+    ImGuiIO& io = ImGui::GetIO();
+    io.IniFilename = nullptr;
+    io.DisplaySize = {1280.0f, 720.0f};
+    io.DeltaTime = 1.0f / 60.0f;
+    unsigned char* font_pixels;
+    int font_width, font_height;
+    io.Fonts->GetTexDataAsRGBA32(&font_pixels, &font_width, &font_height);  // no renderer, only built
+
+    std::vector<Benchmark> benchmarks;
+    float widget_values[6] = {};
+    add_widget_benchmarks(benchmarks, widget_values);
+    add_clip_benchmark(benchmarks);
+    add_load_benchmarks(benchmarks);
+
+    Context ctx(gpu_options);
+    std::vector<std::unique_ptr<ShaderUnion>> shaders;
+    if (ctx.gpu.is_initialized()) {
+        for (size_t i = 0; i < 512; i++) {
+            auto shader = std::make_unique<ShaderUnion>();
+            switch (i % 3) {
+                case 0:
+                    shader->set<Shader<ShaderKind::Noise>>("noise", ctx);
+                    break;
+                case 1:
+                    shader->set<Shader<ShaderKind::Dithering>>("dithering", ctx);
+                    break;
+                default:
+                    shader->set<Shader<ShaderKind::ChromaticAbberation>>("chromatic aberration", ctx);
+            }
+            shaders.push_back(std::move(shader));
+        }
+        add_dispatch_benchmarks(benchmarks, shaders);
+        add_source_cache_benchmark(benchmarks, ctx.shader_source_cache);
+    } else {
+        Log::warn("No usable adapter, the dispatch and shader source benchmarks are skipped.");
+    }
+
+    std::vector<Summary> summaries;
+    Log::log("p99 of sample means: spikes of single iterations only show where a sample is one iteration (it/sample).");
+    Log::log(
+        "{:<44} {:>10} {:>12} {:>12} {:>12} {:>10}", "benchmark", "it/sample", "median", "p99 mean", "min", "allocs/it"
+    );
+    for (const Benchmark& benchmark : benchmarks) {
+        if (!filter.empty() && benchmark.name.find(filter) == std::string::npos) continue;
+        Summary s = measure(benchmark, options);
+        Log::log(
+            "{:<44} {:>10} {:>12} {:>12} {:>12} {:>10.2f}",
+            s.name,
+            s.iterations,
+            format_ns(s.median_ns),
+            format_ns(s.p99_ns),
+            format_ns(s.min_ns),
+            s.allocations
+        );
+        summaries.push_back(std::move(s));
+    }
+
+    if (!json_path.empty()) {
+        std::ofstream json(json_path);
+        json << "[";
+        for (size_t i = 0; i < summaries.size(); i++) {
+            const Summary& s = summaries[i];
+            json << (i ? ",\n" : "\n")
+                 << std::format(
+                        "  {{\"name\": \"{}\", \"iterations\": {}, \"samples\": {}, \"median_ns\": {:.2f}, "
+                        "\"p99_sample_mean_ns\": {:.2f}, \"min_ns\": {:.2f}, \"allocations\": {:.3f}}}",
+                        s.name,
+                        s.iterations,
+                        s.samples,
+                        s.median_ns,
+                        s.p99_ns,
+                        s.min_ns,
+                        s.allocations
+                    );
+        }
+        json << "\n]\n";
+        if (!json) {
+            Log::error("Failed writing {}.", json_path.string());
+            return 1;
+        }
+    }
+
+    shaders.clear();
+    ImGui::DestroyContext();
+    return 0;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+
+// Blocking multi-producer multi-consumer queue. Producers wait while it is full, which propagates back pressure
+// between pipeline stages.
+template <typename T>
+struct BoundedQueue {
+    BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue(BoundedQueue&&) = delete;
+
+    // Waits for room, returns false if the queue got closed meanwhile.
+    bool push(T value) {
+        std::unique_lock lock(mutex);
+        not_full.wait(lock, [&] { return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(std::move(value));
+        not_empty.notify_one();
+        return true;
+    }
+
+    // Waits for an item, returns nothing once the queue is closed and drained.
+    std::optional<T> pop() {
+        std::unique_lock lock(mutex);
+        not_empty.wait(lock, [&] { return closed || !items.empty(); });
+        if (items.empty()) return std::nullopt;
+        T value = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return value;
+    }
+
+    // Nothing if the queue is empty, never waits.
+    std::optional<T> try_pop() {
+        std::lock_guard lock(mutex);
+        if (items.empty()) return std::nullopt;
+        T value = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return value;
+    }
+
+    // Wakes every waiter, remaining items can still be popped.
+    void close() {
+        std::lock_guard lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    size_t size() const {
+        std::lock_guard lock(mutex);
+        return items.size();
+    }
+
+    size_t get_capacity() const {
+        return capacity;
+    }
+
+  private:
+    const size_t capacity;
+    mutable std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    bool closed = false;
+};
@@ -0,0 +1,549 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "context.hpp"
+#include "headless.hpp"
+#include "src/context/image_decoder.hpp"
+#include "src/context/readback.hpp"
+#include "src/log.hpp"
+#include "src/pnm.hpp"
+#include "src/shader/cpu_renderer.hpp"
+#include "src/shader/manager.hpp"
+
+
+// Correctness and throughput harness. Every canonical case draws a generated pattern through an Image stage and
+// applies its effect stages over it, at fixed time 0:
+//   - goldens: each case rendered at `--golden-size` is compared to `<dir>/<case>.pam`, a texel differing by more than
+//     the tolerance on any channel fails the case and its output is written next to the golden as `.actual.pam`.
+//     `--update` writes the goldens instead.
+//   - timings: at every `--sizes` the effect passes of each case (the Image pass for the `image` case) are drawn
+//     `--frames` times, the mean ms per draw are stored as `{"ms": {"<case>@<W>x<H>": ms}}`. Against a `--baseline`
+//     written by a previous run, a case slower by more than `--max-slowdown` fails.
+//   - cross-check: with `--cross-check`, each golden case drawn on the GPU is also drawn by the CPU renderer, the two
+//     may differ by `--cross-tolerance` and a few flipped texels (filtered samples and halftone trigonometry differ by
+//     a step, which can flip a binarized texel).
+// The GPU runs on the software fallback adapter by default so goldens do not depend on the machine, without any
+// adapter the check exits with `SKIPPED`. With `--cpu` the CPU renderer is measured instead, its timings cover the
+// whole chain since it caches no pass.
+
+
+namespace {
+
+constexpr int SKIPPED = 77;  // exit code of a skipped meson test
+constexpr double CROSS_CHECK_FLIPPED_SHARE = 0.001;  // of the texels, accepted over the tolerance
+
+struct Case {
+    std::string name;
+    std::vector<CpuStage> effects;  // drawn over the pattern
+};
+
+struct CaseResult {
+    std::vector<uint8_t> pixels;  // tightly packed RGBA8, empty when not read back
+    double ms = 0.0;              // mean over the timed frames
+};
+
+using Timings = std::map<std::string, double>;  // "<case>@<W>x<H>" -> ms
+
+struct Difference {
+    int largest = 0;            // in 8 bit steps, over every channel
+    size_t over_tolerance = 0;  // texels
+};
+
+
+void usage(const char* program) {
+    Log::log(
+        "usage: {} check [--golden DIR [--update] [--golden-size WIDTHxHEIGHT] [--tolerance N]]\n"
+        "         [--sizes WIDTHxHEIGHT,...] [--frames N] [--timings FILE] [--baseline FILE [--max-slowdown PERCENT]]\n"
+        "         [--hardware | --cpu [--threads N]] [--cross-check [--cross-tolerance N]] [--case NAME]...\n"
+        "  --golden        directory of the golden images, one `<case>.pam` per case\n"
+        "  --update        write the goldens instead of comparing to them\n"
+        "  --golden-size   size the goldens are rendered at (default: 640x360)\n"
+        "  --tolerance     largest accepted difference of a channel, in 8 bit steps (default: 2)\n"
+        "  --sizes         sizes timed (default: 1280x720,1920x1080,3840x2160)\n"
+        "  --frames        timed draws per case and size, 0 skips timings (default: 30)\n"
+        "  --timings       JSON file the timings are written to\n"
+        "  --baseline      timings of a previous run to compare to\n"
+        "  --max-slowdown  accepted slowdown over the baseline (default: 15)\n"
+        "  --hardware      use the default adapter instead of the software fallback one\n"
+        "  --cpu           use the CPU renderer\n"
+        "  --threads       threads of the CPU renderer (default: every core)\n"
+        "  --cross-check   compare the GPU goldens to the CPU renderer too\n"
+        "  --cross-tolerance  largest accepted difference to the CPU renderer, in 8 bit steps (default: 2)\n"
+        "  --case          only run the named cases",
+        program
+    );
+}
+
+
+template <ShaderKind K>
+CpuStage stage(const std::function<void(typename Shader<K>::Uniforms&)>& set) {
+    typename Shader<K>::Uniforms uniforms;
+    default_cpu_stage(K)->template get_uniforms<K>(uniforms);
+    set(uniforms);
+    return CpuStage::make<K>(uniforms);
+}
+
+// Static parameters only, dynamic modes would depend on the frame timing.
+std::vector<Case> canonical_cases() {
+    using CA = Shader<ShaderKind::ChromaticAbberation>;
+    using Dithering = Shader<ShaderKind::Dithering>;
+    using Noise = Shader<ShaderKind::Noise>;
+
+    auto noise_color = stage<ShaderKind::Noise>([](Noise::Uniforms& u) {
+        u.control = 1;
+        u.seed = 7;
+    });
+    auto dithering_bayer = stage<ShaderKind::Dithering>([](Dithering::Uniforms& u) {
+        u.mode = Dithering::Mode::Bayer;
+        u.bayer_steps = 3;
+    });
+    auto noise_grey = stage<ShaderKind::Noise>([](Noise::Uniforms& u) {
+        u.control = 0;
+        u.seed = 3;
+    });
+    auto dithering_threshold_grey = stage<ShaderKind::Dithering>([](Dithering::Uniforms& u) { u.control = 0; });
+
+    return {
+        {"image", {}},
+        {"chromatic_aberration_uniform",
+         {stage<ShaderKind::ChromaticAbberation>([](CA::Uniforms& u) {
+             u.uni_red_shift_x = 4.0f;
+             u.uni_red_shift_y = -2.0f;
+             u.uni_blue_shift_x = -3.0f;
+             u.uni_blue_shift_y = 5.0f;
+         })}},
+        {"chromatic_aberration_scaling",
+         {stage<ShaderKind::ChromaticAbberation>([](CA::Uniforms& u) {
+             u.mode = CA::Mode::LinearScaling;
+             u.scale_center_x = 320.0f;
+             u.scale_center_y = 180.0f;
+             u.scale_red_intensity = 0.02f;
+             u.scale_blue_intensity = -0.02f;
+         })}},
+        {"noise_grey", {noise_grey}},
+        {"noise_color", {noise_color}},
+        {"dithering_threshold", {stage<ShaderKind::Dithering>([](Dithering::Uniforms& u) { u.control = 1; })}},
+        {"dithering_random", {stage<ShaderKind::Dithering>([](Dithering::Uniforms& u) {
+             u.mode = Dithering::Mode::Random;
+         })}},
+        {"dithering_halftone", {stage<ShaderKind::Dithering>([](Dithering::Uniforms& u) {
+             u.mode = Dithering::Mode::Halftone;
+             u.halftone_scale = 6.0f;
+             u.halftone_angle = 0.4f;
+         })}},
+        {"dithering_bayer", {dithering_bayer}},
+        {"fused_noise_dithering", {noise_color, dithering_bayer}},
+        // grey dithering averages the channels, unclamped noise would shift the mean it thresholds
+        {"fused_noise_dithering_grey", {noise_grey, noise_color, dithering_threshold_grey}},
+    };
+}
+
+
+// Gradients under a checkerboard, with translucent squares to exercise blending. Written once per size in the
+// temporary directory, Image stages load files.
+std::optional<std::filesystem::path> write_pattern(std::array<unsigned int, 2> size) {
+    std::vector<uint8_t> pixels(static_cast<size_t>(size[0]) * size[1] * 4);
+    for (uint32_t y = 0; y < size[1]; y++) {
+        for (uint32_t x = 0; x < size[0]; x++) {
+            uint8_t* p = pixels.data() + (static_cast<size_t>(y) * size[0] + x) * 4;
+            p[0] = static_cast<uint8_t>(x * 255 / std::max(size[0] - 1, 1u));
+            p[1] = static_cast<uint8_t>(y * 255 / std::max(size[1] - 1, 1u));
+            p[2] = (x / 32 + y / 32) % 2 ? 224 : 48;
+            p[3] = (x / 64 + y / 64) % 4 == 0 ? 128 : 255;
+        }
+    }
+    std::filesystem::path path =
+        std::filesystem::temp_directory_path() / std::format("moshading-check-{}x{}.pam", size[0], size[1]);
+    if (!write_pnm(path, pixels.data(), size[0], size[1])) return std::nullopt;
+    return path;
+}
+
+
+std::optional<CaseResult> run_on_gpu(
+    Context& ctx, const Case& c, std::array<unsigned int, 2> size, const std::filesystem::path& pattern, size_t frames,
+    bool read_pixels
+) {
+    ctx.render_target.dim = size;
+    ShaderManager shader_manager(ctx);
+    shader_manager.set_fixed_time(0.0f);
+
+    if (!add_stage(ctx, shader_manager, "--image", pattern.string())) return std::nullopt;
+    std::stringstream chain;
+    save_cpu_chain(chain, c.effects);
+    if (!shader_manager.load_chain(chain)) return std::nullopt;
+
+    while (shader_manager.is_compiling()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    CaseResult result;
+    shader_manager.render_chain_streamed();
+    if (read_pixels) {
+        result.pixels = read_texture_blocking(ctx.gpu, shader_manager.get_result_texture(), size[0], size[1]);
+        if (result.pixels.empty()) return std::nullopt;
+    }
+    if (frames == 0) return result;
+
+    // the pattern stays cached, only the effects are drawn again
+    size_t timed_stage = c.effects.empty() ? 0 : 1;
+    auto draw = [&]() {
+        shader_manager.redraw_from(timed_stage);
+        shader_manager.render_chain();
+    };
+    draw();  // warm up
+    ctx.gpu.get_device().poll(true, nullptr);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < frames; i++) draw();
+    ctx.gpu.get_device().poll(true, nullptr);
+    result.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() /
+                static_cast<double>(frames);
+    return result;
+}
+
+
+std::optional<CaseResult> run_on_cpu(
+    CpuRenderer& renderer, const Case& c, std::array<unsigned int, 2> size, const std::filesystem::path& pattern,
+    size_t frames, bool read_pixels
+) {
+    ImageData image = load_image(pattern);
+    if (!image.ptr) return std::nullopt;
+    std::vector<CpuStage> stages = {image_cpu_stage(std::move(image))};
+    stages.insert(stages.end(), c.effects.begin(), c.effects.end());
+
+    CaseResult result;
+    if (read_pixels) {
+        result.pixels = renderer.render(stages, size);
+        if (result.pixels.empty()) return std::nullopt;
+    }
+    if (frames == 0) return result;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < frames; i++) renderer.render(stages, size);
+    result.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() /
+                static_cast<double>(frames);
+    return result;
+}
+
+
+// Tightly packed RGBA8 images of the same size.
+Difference compare(const std::vector<uint8_t>& pixels, const uint8_t* reference, int tolerance) {
+    Difference difference;
+    for (size_t i = 0; i < pixels.size(); i += 4) {
+        int texel_difference = 0;
+        for (size_t channel = 0; channel < 4; channel++) {
+            texel_difference = std::max(texel_difference, std::abs(pixels[i + channel] - reference[i + channel]));
+        }
+        difference.largest = std::max(difference.largest, texel_difference);
+        if (texel_difference > tolerance) difference.over_tolerance++;
+    }
+    return difference;
+}
+
+// false when the case fails
+bool check_golden(
+    const Case& c, const std::vector<uint8_t>& pixels, std::array<unsigned int, 2> size,
+    const std::filesystem::path& golden_dir, bool update, int tolerance
+) {
+    std::filesystem::path golden_path = golden_dir / (c.name + ".pam");
+    if (update) {
+        if (!write_pnm(golden_path, pixels.data(), size[0], size[1])) return false;
+        Log::info("{}: golden written.", c.name);
+        return true;
+    }
+
+    ImageData golden = to_rgba(load_image(golden_path));
+    if (!golden.ptr) {
+        Log::error("{}: no golden image {}, run with --update to create it.", c.name, golden_path.string());
+        return false;
+    }
+    if (golden.width != static_cast<int>(size[0]) || golden.height != static_cast<int>(size[1])) {
+        Log::error("{}: golden is {}x{}, rendered {}x{}.", c.name, golden.width, golden.height, size[0], size[1]);
+        return false;
+    }
+
+    Difference difference = compare(pixels, golden.ptr, tolerance);
+    if (difference.over_tolerance == 0) {
+        Log::info("{}: matches its golden (largest difference {}).", c.name, difference.largest);
+        return true;
+    }
+    std::filesystem::path actual_path = golden_dir / (c.name + ".actual.pam");
+    write_pnm(actual_path, pixels.data(), size[0], size[1]);
+    Log::error(
+        "{}: {} texels differ from the golden by more than {} (largest difference {}), output written to {}.",
+        c.name,
+        difference.over_tolerance,
+        tolerance,
+        difference.largest,
+        actual_path.string()
+    );
+    return false;
+}
+
+// false when the GPU and CPU renderers disagree on the case
+bool cross_check(
+    const Case& c, const std::vector<uint8_t>& gpu_pixels, const std::vector<uint8_t>& cpu_pixels, int tolerance
+) {
+    Difference difference = compare(gpu_pixels, cpu_pixels.data(), tolerance);
+    size_t accepted = static_cast<size_t>(static_cast<double>(gpu_pixels.size() / 4) * CROSS_CHECK_FLIPPED_SHARE);
+    if (difference.over_tolerance <= accepted) {
+        Log::info(
+            "{}: matches the CPU renderer ({} texels over {}, largest difference {}).",
+            c.name,
+            difference.over_tolerance,
+            tolerance,
+            difference.largest
+        );
+        return true;
+    }
+    Log::error(
+        "{}: {} texels differ from the CPU renderer by more than {}, at most {} may (largest difference {}).",
+        c.name,
+        difference.over_tolerance,
+        tolerance,
+        accepted,
+        difference.largest
+    );
+    return false;
+}
+
+
+bool write_timings(const std::filesystem::path& path, const Timings& timings, bool cpu, size_t frames) {
+    std::ofstream file(path);
+    if (!file) {
+        Log::error("Could not open {} for writing.", path.string());
+        return false;
+    }
+    file << "{\n  \"renderer\": \"" << (cpu ? "cpu" : "gpu") << "\",\n  \"frames\": " << frames << ",\n  \"ms\": {";
+    const char* separator = "\n";
+    for (const auto& [key, ms] : timings) {
+        file << separator << "    \"" << key << "\": " << std::format("{:.4f}", ms);
+        separator = ",\n";
+    }
+    file << "\n  }\n}\n";
+    return static_cast<bool>(file);
+}
+
+// Reads back the `ms` object of `write_timings`, not a general JSON parser.
+std::optional<Timings> read_timings(const std::filesystem::path& path) {
+    std::ifstream file(path);
+    if (!file) return std::nullopt;
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string text = buffer.str();
+
+    size_t position = text.find("\"ms\"");
+    if (position == std::string::npos) return std::nullopt;
+    position = text.find('{', position);
+    size_t end = text.find('}', position);
+    if (position == std::string::npos || end == std::string::npos) return std::nullopt;
+
+    Timings timings;
+    while ((position = text.find('"', position)) < end) {
+        size_t key_end = text.find('"', position + 1);
+        size_t colon = text.find(':', key_end);
+        if (key_end >= end || colon >= end) return std::nullopt;
+        std::string key = text.substr(position + 1, key_end - position - 1);
+        char* number_end = nullptr;
+        double ms = std::strtod(text.c_str() + colon + 1, &number_end);
+        if (number_end == text.c_str() + colon + 1) return std::nullopt;
+        timings[key] = ms;
+        position = static_cast<size_t>(number_end - text.c_str());
+    }
+    return timings;
+}
+
+// false when some case got slower than allowed
+bool compare_timings(const Timings& timings, const Timings& baseline, double max_slowdown) {
+    bool passed = true;
+    for (const auto& [key, ms] : timings) {
+        auto base = baseline.find(key);
+        if (base == baseline.end() || base->second <= 0.0) continue;
+        double change = (ms / base->second - 1.0) * 100.0;
+        if (change > max_slowdown) {
+            Log::error("{}: {:.3f} ms, {:+.1f}% over the baseline {:.3f} ms.", key, ms, change, base->second);
+            passed = false;
+        } else {
+            Log::info("{}: {:.3f} ms, {:+.1f}% from the baseline {:.3f} ms.", key, ms, change, base->second);
+        }
+    }
+    return passed;
+}
+
+
+std::optional<std::vector<std::array<unsigned int, 2>>> parse_sizes(std::string_view value) {
+    std::vector<std::array<unsigned int, 2>> sizes;
+    while (!value.empty()) {
+        size_t comma = std::min(value.find(','), value.size());
+        std::optional<std::array<unsigned int, 2>> size = parse_size(value.substr(0, comma));
+        if (!size || size.value()[0] == 0 || size.value()[1] == 0) return std::nullopt;
+        sizes.push_back(size.value());
+        value.remove_prefix(std::min(comma + 1, value.size()));
+    }
+    return sizes;
+}
+
+}  // namespace
+
+
+int run_check(int argc, char** argv) {
+    GPUOptions gpu_options;
+    gpu_options.force_fallback_adapter = true;
+    bool cpu = false;
+    size_t threads = std::thread::hardware_concurrency();
+    bool cross = false;
+    int cross_tolerance = 2;
+    std::filesystem::path golden_dir;
+    bool update = false;
+    std::array<unsigned int, 2> golden_size = {640, 360};
+    int tolerance = 2;
+    std::vector<std::array<unsigned int, 2>> sizes = {{1280, 720}, {1920, 1080}, {3840, 2160}};
+    size_t frames = 30;
+    std::filesystem::path timings_path;
+    std::filesystem::path baseline_path;
+    double max_slowdown = 15.0;
+    std::vector<std::string_view> selected_cases;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool valid = true;
+        if (arg == "--golden" && has_value) {
+            golden_dir = argv[++i];
+        } else if (arg == "--update") {
+            update = true;
+        } else if (arg == "--golden-size" && has_value) {
+            std::optional<std::array<unsigned int, 2>> parsed = parse_size(argv[++i]);
+            valid = parsed && parsed.value()[0] > 0 && parsed.value()[1] > 0;
+            if (valid) golden_size = parsed.value();
+        } else if (arg == "--tolerance" && has_value) {
+            tolerance = std::atoi(argv[++i]);
+        } else if (arg == "--sizes" && has_value) {
+            std::optional<std::vector<std::array<unsigned int, 2>>> parsed = parse_sizes(argv[++i]);
+            valid = parsed.has_value();
+            if (valid) sizes = parsed.value();
+        } else if (arg == "--frames" && has_value) {
+            frames = static_cast<size_t>(std::max(std::atoi(argv[++i]), 0));
+        } else if (arg == "--timings" && has_value) {
+            timings_path = argv[++i];
+        } else if (arg == "--baseline" && has_value) {
+            baseline_path = argv[++i];
+        } else if (arg == "--max-slowdown" && has_value) {
+            max_slowdown = std::atof(argv[++i]);
+        } else if (arg == "--hardware") {
+            gpu_options.force_fallback_adapter = false;
+        } else if (arg == "--cpu") {
+            cpu = true;
+        } else if (arg == "--threads" && has_value) {
+            threads = static_cast<size_t>(std::max(std::atoi(argv[++i]), 1));
+        } else if (arg == "--cross-check") {
+            cross = true;
+        } else if (arg == "--cross-tolerance" && has_value) {
+            cross_tolerance = std::atoi(argv[++i]);
+        } else if (arg == "--case" && has_value) {
+            selected_cases.push_back(argv[++i]);
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cpu && cross) {
+        Log::error("--cross-check compares the GPU to the CPU renderer, it cannot be used with --cpu.");
+        return 1;
+    }
+
+    std::vector<Case> cases = canonical_cases();
+    if (!selected_cases.empty()) {
+        std::erase_if(cases, [&](const Case& c) {
+            return std::find(selected_cases.begin(), selected_cases.end(), c.name) == selected_cases.end();
+        });
+    }
+
+    std::optional<Context> ctx;
+    std::optional<CpuRenderer> renderer;
+    if (cpu || cross) renderer.emplace(threads);
+    if (!cpu) {
+        ctx.emplace(gpu_options);
+        if (!ctx->gpu.is_initialized()) {
+            Log::warn("No usable adapter, check skipped. --cpu runs it on the CPU renderer.");
+            return SKIPPED;
+        }
+    }
+    auto run = [&](const Case& c, std::array<unsigned int, 2> size, size_t case_frames, bool read_pixels, bool on_cpu) {
+        std::optional<std::filesystem::path> pattern = write_pattern(size);
+        if (!pattern) return std::optional<CaseResult>();
+        return on_cpu ? run_on_cpu(renderer.value(), c, size, pattern.value(), case_frames, read_pixels)
+                      : run_on_gpu(ctx.value(), c, size, pattern.value(), case_frames, read_pixels);
+    };
+
+    bool passed = true;
+
+    if (!golden_dir.empty()) {
+        if (update) std::filesystem::create_directories(golden_dir);
+        for (const Case& c : cases) {
+            std::optional<CaseResult> result = run(c, golden_size, 0, true, cpu);
+            if (!result) {
+                Log::error("{}: could not be rendered.", c.name);
+                passed = false;
+                continue;
+            }
+            passed = check_golden(c, result->pixels, golden_size, golden_dir, update, tolerance) && passed;
+            if (!cross) continue;
+            std::optional<CaseResult> reference = run(c, golden_size, 0, true, true);
+            if (!reference) {
+                Log::error("{}: could not be rendered on the CPU.", c.name);
+                passed = false;
+                continue;
+            }
+            passed = cross_check(c, result->pixels, reference->pixels, cross_tolerance) && passed;
+        }
+    }
+
+    Timings timings;
+    if (frames > 0) {
+        for (std::array<unsigned int, 2> size : sizes) {
+            for (const Case& c : cases) {
+                std::optional<CaseResult> result = run(c, size, frames, false, cpu);
+                if (!result) {
+                    Log::error("{}: could not be rendered at {}x{}.", c.name, size[0], size[1]);
+                    passed = false;
+                    continue;
+                }
+                std::string key = std::format("{}@{}x{}", c.name, size[0], size[1]);
+                Log::info("{}: {:.3f} ms", key, result->ms);
+                timings[key] = result->ms;
+            }
+        }
+    }
+
+    if (!timings_path.empty() && !write_timings(timings_path, timings, cpu, frames)) passed = false;
+
+    if (!baseline_path.empty()) {
+        std::optional<Timings> baseline = read_timings(baseline_path);
+        if (!baseline) {
+            Log::error("Could not read the baseline timings {}.", baseline_path.string());
+            passed = false;
+        } else {
+            passed = compare_timings(timings, baseline.value(), max_slowdown) && passed;
+        }
+    }
+
+    if (ctx) ctx->gpu.get_device().poll(true, nullptr);  // make sure every command terminates before quitting
+    Log::log(passed ? "check passed" : "check FAILED");
+    return passed ? 0 : 1;
+}
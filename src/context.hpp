@@ -3,6 +3,7 @@
 #include <webgpu/webgpu-raii.hpp>
 
 #include "context/gpu.hpp"
+#include "context/pipeline_cache.hpp"
 #include "context/render_target.hpp"
 #include "context/resource.hpp"
 #include "context/shader_source.hpp"
@@ -11,7 +12,10 @@ struct Context {
     GPU gpu;
     RenderTarget render_target;
     ShaderSourceCache shader_source_cache;
+    PipelineCache pipeline_cache;
     ResourceManager resource_manager;
 
-    Context() : gpu(), render_target(), shader_source_cache(gpu), resource_manager(gpu) {}
+    Context(const GPUOptions& gpu_options = {})
+        : gpu(gpu_options), render_target(), shader_source_cache(gpu), pipeline_cache(gpu),
+          resource_manager(gpu, shader_source_cache, pipeline_cache) {}
 };
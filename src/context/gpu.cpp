@@ -1,4 +1,5 @@
 #include <stdexcept>
+#include <vector>
 #ifdef __EMSCRIPTEN__
     #include <emscripten.h>
     #include <emscripten/html5.h>
@@ -8,7 +9,7 @@
 #include "gpu.hpp"
 #include "src/log.hpp"
 
-bool GPU::init() {
+bool GPU::init(const GPUOptions& options) {
     if (initialized) {
         Log::warn("GPU context already initialized");
         return false;
@@ -17,15 +18,26 @@ bool GPU::init() {
     this->instance = wgpu::createInstance();
 
 #ifdef __EMSCRIPTEN__
+    (void)options;
     this->device = wgpu::raii::Device(emscripten_webgpu_get_device());
 #else
-    this->adapter = this->instance->requestAdapter(wgpu::RequestAdapterOptions{});
+    wgpu::RequestAdapterOptions adapter_options;
+    adapter_options.forceFallbackAdapter = options.force_fallback_adapter;
+    this->adapter = this->instance->requestAdapter(adapter_options);
     if (!adapter) {
         Log::error("Adapter request failed.");
         return false;
     }
 
-    this->device = adapter->requestDevice(wgpu::DeviceDescriptor{});
+    // optional features, users must check `hasFeature` on the device before relying on them
+    std::vector<WGPUFeatureName> features;
+    if (adapter->hasFeature(wgpu::FeatureName::TimestampQuery)) features.push_back(WGPUFeatureName_TimestampQuery);
+
+    wgpu::DeviceDescriptor device_desc;
+    device_desc.requiredFeatureCount = features.size();
+    device_desc.requiredFeatures = features.data();
+
+    this->device = adapter->requestDevice(device_desc);
 #endif
 
 #ifndef __EMSCRIPTEN__
@@ -1,10 +1,18 @@
 #pragma once
 
+#include <cstdint>
 #include <webgpu/webgpu-raii.hpp>
 
+struct GPUOptions {
+    bool force_fallback_adapter = false;  // software adapter, for machines without a GPU (native only)
+};
+
 struct GPU {
-    GPU() {
-        init();
+    // devices are requested with the default limits, larger images go through virtual textures (virtual_texture.hpp)
+    static constexpr uint32_t MAX_TEXTURE_DIMENSION_2D = 8192;
+
+    GPU(const GPUOptions& options = {}) {
+        init(options);
     }
 
     bool is_initialized() const;
@@ -24,5 +32,5 @@ struct GPU {
 #endif
     wgpu::raii::Device device;
 
-    bool init();
+    bool init(const GPUOptions& options);
 };
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <webgpu/webgpu-raii.hpp>
+
+#include "gpu.hpp"
+
+
+// Timestamp query based timer, scope `i` is framed by queries `2 * i` and `2 * i + 1`.
+// Results are read back asynchronously and lag a few frames behind, a scope keeps the duration of the last frame that
+// resolved it. On devices without timestamp support every call is a no-op and durations stay at 0.
+struct GpuTimer {
+    GpuTimer(const GPU& gpu, uint32_t scope_count) : gpu(gpu) {
+        supported = gpu.get_device().hasFeature(wgpu::FeatureName::TimestampQuery);
+        reserve(scope_count);
+    }
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer(GpuTimer&&) = delete;  // `this` is handed to map callbacks
+
+    bool is_supported() const {
+        return supported;
+    }
+
+    // Makes room for `scope_count` scopes, to call before recording the frame's timestamp writes. The queries and
+    // buffers are only replaced while no readback refers to them, until then the scopes past the current ones are not
+    // timed (see `has_scope`).
+    void reserve(uint32_t scope_count) {
+        if (scope_count > durations.size()) durations.resize(scope_count, 0.0);
+        if (!supported || scope_count <= capacity || readback_pending || resolved_count > 0) return;
+
+        wgpu::QuerySetDescriptor query_set_desc;
+        query_set_desc.type = wgpu::QueryType::Timestamp;
+        query_set_desc.count = 2 * scope_count;
+        query_set = gpu.get_device().createQuerySet(query_set_desc);
+
+        wgpu::BufferDescriptor buffer_desc;
+        buffer_desc.usage = wgpu::BufferUsage::QueryResolve | wgpu::BufferUsage::CopySrc;
+        buffer_desc.size = 2 * scope_count * sizeof(uint64_t);
+        buffer_desc.mappedAtCreation = false;
+        resolve_buffer = gpu.get_device().createBuffer(buffer_desc);
+
+        buffer_desc.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+        readback_buffer = gpu.get_device().createBuffer(buffer_desc);
+        capacity = scope_count;
+    }
+
+    bool has_scope(uint32_t scope) const {
+        return supported && scope < capacity;
+    }
+
+    // Zeroes every duration once scopes time other work, results of frames resolved before are dropped.
+    void clear() {
+        std::fill(durations.begin(), durations.end(), 0.0);
+        generation++;
+    }
+
+    // Timestamp writes to plug into a pass descriptor, `begin`/`end` select which side of the scope the pass frames.
+    wgpu::RenderPassTimestampWrites timestamp_writes(uint32_t scope, bool begin, bool end) const {
+        wgpu::RenderPassTimestampWrites writes;
+        writes.querySet = *query_set;
+        writes.beginningOfPassWriteIndex = begin ? 2 * scope : WGPU_QUERY_SET_INDEX_UNDEFINED;
+        writes.endOfPassWriteIndex = end ? 2 * scope + 1 : WGPU_QUERY_SET_INDEX_UNDEFINED;
+        return writes;
+    }
+
+    // Records the resolution of scopes [first, first + count), the ones written by this frame. Skipped while the
+    // previous results are still being mapped.
+    void resolve(const wgpu::CommandEncoder& encoder, uint32_t first = 0, uint32_t count = UINT32_MAX) {
+        if (!supported || readback_pending || first >= capacity) return;
+        count = std::min(count, capacity - first);
+        // packed at the start of the buffers, resolve destinations must be 256 bytes aligned
+        encoder.resolveQuerySet(*query_set, 2 * first, 2 * count, *resolve_buffer, 0);
+        encoder.copyBufferToBuffer(*resolve_buffer, 0, *readback_buffer, 0, 2 * count * sizeof(uint64_t));
+        resolved_first = first;
+        resolved_count = count;
+    }
+
+    // To call once the command buffer holding the last `resolve` has been submitted.
+    void read_back() {
+        if (resolved_count == 0) return;
+        mapped_first = resolved_first;
+        mapped_count = resolved_count;
+        mapped_generation = generation;
+        resolved_count = 0;
+        readback_pending = true;
+        uint64_t mapped_size = 2 * mapped_count * sizeof(uint64_t);
+#ifdef __EMSCRIPTEN__
+        map_callback = readback_buffer->mapAsync(
+            wgpu::MapMode::Read,
+            0,
+            mapped_size,
+            [this](wgpu::BufferMapAsyncStatus status) { on_mapped(status == wgpu::BufferMapAsyncStatus::Success); }
+        );
+#else
+        wgpu::BufferMapCallbackInfo callback_info;
+        callback_info.mode = wgpu::CallbackMode::AllowSpontaneous;
+        callback_info.callback = [](WGPUMapAsyncStatus status, WGPUStringView, void* timer, void*) {
+            static_cast<GpuTimer*>(timer)->on_mapped(status == WGPUMapAsyncStatus_Success);
+        };
+        callback_info.userdata1 = this;
+        readback_buffer->mapAsync(wgpu::MapMode::Read, 0, mapped_size, callback_info);
+#endif
+    }
+
+    double get_ms(uint32_t scope) const {
+        return scope < durations.size() ? durations[scope] : 0.0;
+    }
+
+  private:
+    const GPU& gpu;
+    uint32_t capacity = 0;  // scopes of the current queries
+    bool supported = false;
+    uint32_t resolved_first = 0;
+    uint32_t resolved_count = 0;  // 0 when nothing waits for `read_back`
+    uint32_t mapped_first = 0;
+    uint32_t mapped_count = 0;
+    uint64_t generation = 0;  // bumped by `clear`
+    uint64_t mapped_generation = 0;
+    bool readback_pending = false;
+    std::vector<double> durations;
+
+    wgpu::raii::QuerySet query_set;
+    wgpu::raii::Buffer resolve_buffer;
+#ifdef __EMSCRIPTEN__
+    std::unique_ptr<wgpu::BufferMapCallback> map_callback;
+#endif
+    wgpu::raii::Buffer readback_buffer;  // declared last: released first, while a late abort callback can still run
+
+    void on_mapped(bool success) {
+        readback_pending = false;
+        if (!success) return;
+
+        uint64_t mapped_size = 2 * mapped_count * sizeof(uint64_t);
+        const uint64_t* timestamps =
+            static_cast<const uint64_t*>(readback_buffer->getConstMappedRange(0, mapped_size));
+        for (uint32_t i = 0; mapped_generation == generation && i < mapped_count; i++) {
+            uint64_t begin = timestamps[2 * i];
+            uint64_t end = timestamps[2 * i + 1];
+            // scopes of the range left unwritten this frame keep their last duration
+            if (end > begin) durations[mapped_first + i] = static_cast<double>(end - begin) * 1e-6;  // ns to ms
+        }
+        readback_buffer->unmap();
+    }
+};
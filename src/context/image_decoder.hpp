@@ -0,0 +1,344 @@
+#pragma once
+
+#include <stb/stb_image.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#ifndef __EMSCRIPTEN__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "src/qoi.hpp"
+
+
+// Decoded image, tightly packed 8 bit samples: grey (1 channel), grey and alpha (2) or RGBA (4). Colour images
+// without alpha are RGBA too, there is no 3 channel texture format. `ptr` may point into a read-only file mapping, it
+// must not be written.
+struct ImageData {
+    uint8_t* ptr = nullptr;
+    int width = 0;
+    int height = 0;
+    std::shared_ptr<void> storage;  // owns `ptr`: stb buffer, pixel vector or file mapping
+    int channels = 4;
+
+    size_t byte_size() const {
+        return static_cast<size_t>(width) * height * channels;
+    }
+};
+
+
+// `pixel_count` texels of `channels` samples written as RGBA8, grey is replicated, missing alpha is opaque.
+inline void expand_to_rgba(const uint8_t* samples, size_t pixel_count, int channels, uint8_t* rgba) {
+    for (size_t i = 0; i < pixel_count; i++) {
+        const uint8_t* s = samples + i * channels;
+        uint8_t* p = rgba + i * 4;
+        switch (channels) {
+            case 1:
+                p[0] = p[1] = p[2] = s[0];
+                p[3] = 255;
+                break;
+            case 2:
+                p[0] = p[1] = p[2] = s[0];
+                p[3] = s[1];
+                break;
+            case 3:
+                p[0] = s[0];
+                p[1] = s[1];
+                p[2] = s[2];
+                p[3] = 255;
+                break;
+            default:
+                std::memcpy(p, s, 4);
+        }
+    }
+}
+
+// The reverse for grey images: keeps the red (and alpha) samples of RGBA8 texels.
+inline void pack_from_rgba(const uint8_t* rgba, size_t pixel_count, int channels, uint8_t* samples) {
+    for (size_t i = 0; i < pixel_count; i++) {
+        for (int c = 0; c < channels; c++) samples[i * channels + c] = rgba[i * 4 + (c == 1 && channels == 2 ? 3 : c)];
+    }
+}
+
+// `image` itself when already RGBA.
+inline ImageData to_rgba(ImageData&& image) {
+    if (!image.ptr || image.channels == 4) return std::move(image);
+    auto pixels = std::make_shared<std::vector<uint8_t>>(static_cast<size_t>(image.width) * image.height * 4);
+    expand_to_rgba(image.ptr, static_cast<size_t>(image.width) * image.height, image.channels, pixels->data());
+    return {pixels->data(), image.width, image.height, pixels, 4};
+}
+
+
+// Bytes of an encoded image, from a file mapping or a caller owned buffer.
+struct EncodedImage {
+    std::span<const uint8_t> bytes;
+    std::filesystem::path path;  // empty for in-memory images, some formats read their size from the name
+    // keeps `bytes` alive, decoders may then return pixels pointing into them instead of copying. Null when the bytes
+    // are only valid during the call.
+    std::shared_ptr<void> mapping;
+};
+
+
+// A format of the registry (see `image_decoders`). `info` reads the size from the header alone, both return nothing
+// when the bytes are not of this format or are invalid.
+struct ImageDecoder {
+    const char* name;
+    std::optional<std::array<int, 2>> (*info)(const EncodedImage& image);
+    ImageData (*decode)(const EncodedImage& image);
+};
+
+
+namespace image_decoder_detail {
+
+inline ImageData own_pixels(std::vector<uint8_t>&& pixels, int width, int height, int channels = 4) {
+    auto storage = std::make_shared<std::vector<uint8_t>>(std::move(pixels));
+    return {storage->data(), width, height, storage, channels};
+}
+
+// Pixels of the encoded bytes at `offset`, borrowed from the mapping when there is one, copied otherwise.
+inline ImageData map_or_copy(const EncodedImage& image, size_t offset, int width, int height, int channels = 4) {
+    size_t size = static_cast<size_t>(width) * height * channels;
+    if (image.mapping) {
+        return {const_cast<uint8_t*>(image.bytes.data() + offset), width, height, image.mapping, channels};
+    }
+    std::span<const uint8_t> pixels = image.bytes.subspan(offset, size);
+    return own_pixels(std::vector<uint8_t>(pixels.begin(), pixels.end()), width, height, channels);
+}
+
+
+// Netpbm headers: `P6` (PPM, RGB) and `P7` (PAM, 1 to 4 channels), 8 bit samples only.
+struct PnmHeader {
+    int width = 0;
+    int height = 0;
+    int depth = 0;
+    int maxval = 0;
+    size_t data_offset = 0;
+};
+
+struct PnmReader {
+    std::string_view text;
+    size_t position = 0;
+
+    void skip_space_and_comments() {
+        while (position < text.size()) {
+            if (text[position] == '#') {
+                while (position < text.size() && text[position] != '\n') position++;
+            } else if (std::isspace(static_cast<unsigned char>(text[position]))) {
+                position++;
+            } else {
+                return;
+            }
+        }
+    }
+
+    std::string_view token() {
+        skip_space_and_comments();
+        size_t start = position;
+        while (position < text.size() && !std::isspace(static_cast<unsigned char>(text[position]))) position++;
+        return text.substr(start, position - start);
+    }
+
+    int number() {
+        std::string_view t = token();
+        int value = 0;
+        auto [end, error] = std::from_chars(t.data(), t.data() + t.size(), value);
+        return error == std::errc() && end == t.data() + t.size() ? value : -1;
+    }
+};
+
+inline std::optional<PnmHeader> read_pnm_header(std::span<const uint8_t> bytes) {
+    // headers are short, the view stops before the samples could be mistaken for tokens
+    size_t header_size = std::min<size_t>(bytes.size(), 512);
+    PnmReader reader{std::string_view(reinterpret_cast<const char*>(bytes.data()), header_size)};
+    std::string_view magic = reader.token();
+    PnmHeader header;
+    if (magic == "P6") {
+        header.width = reader.number();
+        header.height = reader.number();
+        header.maxval = reader.number();
+        header.depth = 3;
+        reader.position++;  // single whitespace before the samples
+    } else if (magic == "P7") {
+        while (true) {
+            std::string_view key = reader.token();
+            if (key == "ENDHDR") break;
+            if (key.empty()) return std::nullopt;
+            if (key == "WIDTH") header.width = reader.number();
+            else if (key == "HEIGHT") header.height = reader.number();
+            else if (key == "DEPTH") header.depth = reader.number();
+            else if (key == "MAXVAL") header.maxval = reader.number();
+            else reader.token();  // TUPLTYPE, the depth is enough
+        }
+        while (reader.position < reader.text.size() && reader.text[reader.position] != '\n') reader.position++;
+        reader.position++;
+    } else {
+        return std::nullopt;
+    }
+
+    header.data_offset = reader.position;
+    size_t data_size = static_cast<size_t>(std::max(header.width, 0)) * std::max(header.height, 0) * header.depth;
+    if (header.width <= 0 || header.height <= 0 || header.depth < 1 || header.depth > 4 || header.maxval != 255 ||
+        header.data_offset + data_size > bytes.size()) {
+        return std::nullopt;
+    }
+    return header;
+}
+
+inline std::optional<std::array<int, 2>> pnm_info(const EncodedImage& image) {
+    std::optional<PnmHeader> header = read_pnm_header(image.bytes);
+    if (!header) return std::nullopt;
+    return std::array{header->width, header->height};
+}
+
+// Grey, grey + alpha and RGBA samples are used in place, only RGB is expanded.
+inline ImageData pnm_decode(const EncodedImage& image) {
+    std::optional<PnmHeader> header = read_pnm_header(image.bytes);
+    if (!header) return {};
+    if (header->depth != 3) {
+        return map_or_copy(image, header->data_offset, header->width, header->height, header->depth);
+    }
+
+    size_t pixel_count = static_cast<size_t>(header->width) * header->height;
+    std::vector<uint8_t> pixels(pixel_count * 4);
+    expand_to_rgba(image.bytes.data() + header->data_offset, pixel_count, 3, pixels.data());
+    return own_pixels(std::move(pixels), header->width, header->height);
+}
+
+
+inline std::optional<std::array<int, 2>> qoi_info(const EncodedImage& image) {
+    if (image.bytes.size() < 14 || std::memcmp(image.bytes.data(), "qoif", 4) != 0) return std::nullopt;
+    auto read_u32 = [&](size_t offset) { return static_cast<int>(qoi_detail::read_u32(image.bytes.data() + offset)); };
+    return std::array{read_u32(4), read_u32(8)};
+}
+
+inline ImageData qoi_decode_image(const EncodedImage& image) {
+    std::optional<QoiImage> decoded = qoi_decode(image.bytes.data(), image.bytes.size());
+    if (!decoded) return {};
+    return own_pixels(std::move(decoded->pixels), decoded->width, decoded->height);
+}
+
+
+// Headerless RGBA8, the size is the last `_` separated part of the file name: `frame_1920x1080.rgba`. Raw streams
+// written by the `video` tool hold several frames, the first one is imported.
+inline std::optional<std::array<int, 2>> raw_info(const EncodedImage& image) {
+    if (image.path.extension() != ".rgba") return std::nullopt;
+    std::string stem = image.path.stem().string();
+    size_t separator = stem.rfind('_');
+    std::string_view size = std::string_view(stem).substr(separator == std::string::npos ? 0 : separator + 1);
+    size_t x = size.find('x');
+    if (x == std::string_view::npos) return std::nullopt;
+    int width = 0, height = 0;
+    std::errc width_error = std::from_chars(size.data(), size.data() + x, width).ec;
+    std::errc height_error = std::from_chars(size.data() + x + 1, size.data() + size.size(), height).ec;
+    if (width_error != std::errc() || height_error != std::errc() || width <= 0 || height <= 0) return std::nullopt;
+    if (image.bytes.size() < static_cast<size_t>(width) * height * 4) return std::nullopt;
+    return std::array{width, height};
+}
+
+inline ImageData raw_decode(const EncodedImage& image) {
+    std::optional<std::array<int, 2>> size = raw_info(image);
+    if (!size) return {};
+    return map_or_copy(image, 0, size.value()[0], size.value()[1]);
+}
+
+
+inline std::optional<std::array<int, 2>> stb_info(const EncodedImage& image) {
+    int width, height;
+    if (!stbi_info_from_memory(image.bytes.data(), image.bytes.size(), &width, &height, nullptr)) return std::nullopt;
+    return std::array{width, height};
+}
+
+// Grey images keep their 1 or 2 channels, colour ones are RGBA.
+inline ImageData stb_decode(const EncodedImage& image) {
+    ImageData data;
+    int channels;
+    if (!stbi_info_from_memory(image.bytes.data(), image.bytes.size(), &data.width, &data.height, &channels)) return {};
+    data.channels = channels <= 2 ? channels : 4;
+    data.ptr = stbi_load_from_memory(
+        image.bytes.data(), image.bytes.size(), &data.width, &data.height, nullptr, data.channels
+    );
+    if (data.ptr) data.storage = std::shared_ptr<uint8_t>(data.ptr, stbi_image_free);
+    return data;
+}
+
+}  // namespace image_decoder_detail
+
+
+// Formats tried in order by `decode_image`, the first whose `info` accepts the bytes decodes them. stb (PNG, JPEG,
+// BMP, TGA...) comes last and catches everything else, `register_image_decoder` adds formats before it.
+inline std::vector<ImageDecoder>& image_decoders() {
+    using namespace image_decoder_detail;
+    static std::vector<ImageDecoder> decoders = {
+        {"qoi", qoi_info, qoi_decode_image},
+        {"pnm", pnm_info, pnm_decode},
+        {"raw rgba", raw_info, raw_decode},
+        {"stb", stb_info, stb_decode},
+    };
+    return decoders;
+}
+
+inline void register_image_decoder(const ImageDecoder& decoder) {
+    std::vector<ImageDecoder>& decoders = image_decoders();
+    decoders.insert(decoders.end() - 1, decoder);
+}
+
+inline const ImageDecoder* find_image_decoder(const EncodedImage& image) {
+    for (const ImageDecoder& decoder : image_decoders()) {
+        if (decoder.info(image)) return &decoder;
+    }
+    return nullptr;
+}
+
+// Null pixels when no decoder accepts the bytes.
+inline ImageData decode_image(const EncodedImage& image) {
+    const ImageDecoder* decoder = find_image_decoder(image);
+    return decoder ? decoder->decode(image) : ImageData{};
+}
+
+
+#ifndef __EMSCRIPTEN__
+// Maps the whole file read-only, pages are read on first access. Nothing when it cannot be opened.
+inline std::optional<EncodedImage> map_image_file(const std::filesystem::path& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return std::nullopt;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        close(fd);
+        return std::nullopt;
+    }
+    size_t size = static_cast<size_t>(file_stat.st_size);
+    void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // the mapping keeps the file
+    if (address == MAP_FAILED) return std::nullopt;
+    madvise(address, size, MADV_SEQUENTIAL);
+
+    std::shared_ptr<void> mapping(address, [size](void* a) { munmap(a, size); });
+    return EncodedImage{{static_cast<const uint8_t*>(address), size}, path, std::move(mapping)};
+}
+
+inline ImageData load_image(const std::filesystem::path& path) {
+    std::optional<EncodedImage> image = map_image_file(path);
+    return image ? decode_image(image.value()) : ImageData{};
+}
+
+inline std::optional<std::array<int, 2>> image_info(const std::filesystem::path& path) {
+    std::optional<EncodedImage> image = map_image_file(path);
+    if (!image) return std::nullopt;
+    const ImageDecoder* decoder = find_image_decoder(image.value());
+    return decoder ? decoder->info(image.value()) : std::nullopt;
+}
+#endif
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+#include <webgpu/webgpu-raii.hpp>
+
+#include "gpu.hpp"
+#include "pipeline_cache.hpp"
+#include "shader_source.hpp"
+#include "shaders_code.hpp"
+#include "texture.hpp"
+
+
+inline uint32_t mip_level_count(uint32_t width, uint32_t height) {
+    return std::bit_width(std::max({width, height, 1u}));
+}
+
+
+// Fills the mip chain of image textures (R8, RG8 or RGBA8, see `image_texture_format`) from their base level, one
+// fullscreen downsampling pass per level (see mipmap.wgsl). A pipeline per format compiles asynchronously like the
+// stages ones, `generate` refuses to run before.
+struct MipmapGenerator {
+    MipmapGenerator(const GPU& gpu, const ShaderSourceCache& shader_source_cache, const PipelineCache& pipeline_cache)
+        : gpu(gpu) {
+        wgpu::BindGroupLayoutEntry bgl_entries[2];
+        // source level entry
+        bgl_entries[0].binding = 0;
+        bgl_entries[0].visibility = wgpu::ShaderStage::Fragment;
+        bgl_entries[0].texture.sampleType = wgpu::TextureSampleType::Float;
+        bgl_entries[0].texture.viewDimension = wgpu::TextureViewDimension::_2D;
+        bgl_entries[0].texture.multisampled = false;
+        // sampler entry
+        bgl_entries[1].binding = 1;
+        bgl_entries[1].visibility = wgpu::ShaderStage::Fragment;
+        bgl_entries[1].sampler.type = wgpu::SamplerBindingType::Filtering;
+        bind_group_layout = pipeline_cache.get_bind_group_layout(bgl_entries);
+
+        wgpu::BindGroupLayout layouts[1] = {*bind_group_layout};
+        for (uint32_t channels : {1u, 2u, 4u}) {
+            pipelines.push_back(&pipeline_cache.get_render_pipeline(
+                shader_source_cache.get(fullscreen_vertex),
+                shader_source_cache.get(mipmap),
+                layouts,
+                image_texture_format(channels)
+            ));
+        }
+
+        wgpu::SamplerDescriptor sampler_desc;
+        sampler_desc.addressModeU = wgpu::AddressMode::ClampToEdge;
+        sampler_desc.addressModeV = wgpu::AddressMode::ClampToEdge;
+        sampler_desc.addressModeW = wgpu::AddressMode::ClampToEdge;
+        sampler_desc.minFilter = wgpu::FilterMode::Linear;
+        sampler_desc.magFilter = wgpu::FilterMode::Linear;
+        sampler_desc.mipmapFilter = wgpu::MipmapFilterMode::Nearest;
+        sampler_desc.maxAnisotropy = 1;
+        sampler = gpu.get_device().createSampler(sampler_desc);
+    }
+
+    MipmapGenerator(const MipmapGenerator&) = delete;
+    MipmapGenerator(MipmapGenerator&&) = delete;
+
+    bool is_ready() const {
+        return std::all_of(pipelines.begin(), pipelines.end(), [](const AsyncPipeline* p) { return p->get(); });
+    }
+
+    bool is_compiling() const {
+        return std::any_of(pipelines.begin(), pipelines.end(), [](const AsyncPipeline* p) {
+            return p->is_compiling();
+        });
+    }
+
+    // Texture needs `RenderAttachment` usage, returns false when the pipeline is not compiled yet.
+    bool generate(const wgpu::Texture& texture) const {
+        wgpu::RenderPipeline render_pipeline = pipeline_for(texture.getFormat())->get();
+        if (!render_pipeline) return false;
+
+        wgpu::raii::CommandEncoder cmd_encoder = gpu.get_device().createCommandEncoder();
+        wgpu::raii::TextureView source = level_view(texture, 0);
+        for (uint32_t level = 1; level < texture.getMipLevelCount(); level++) {
+            wgpu::raii::TextureView destination = level_view(texture, level);
+
+            wgpu::BindGroupEntry bg_entries[2];
+            // source level entry
+            bg_entries[0].binding = 0;
+            bg_entries[0].textureView = *source;
+            // sampler entry
+            bg_entries[1].binding = 1;
+            bg_entries[1].sampler = *sampler;
+
+            wgpu::BindGroupDescriptor bg_desc;
+            bg_desc.layout = *bind_group_layout;
+            bg_desc.entryCount = 2;
+            bg_desc.entries = bg_entries;
+            wgpu::raii::BindGroup bind_group = gpu.get_device().createBindGroup(bg_desc);
+
+            wgpu::RenderPassColorAttachment color_attachment;
+            color_attachment.view = *destination;
+            color_attachment.loadOp = wgpu::LoadOp::Clear;
+            color_attachment.storeOp = wgpu::StoreOp::Store;
+            color_attachment.clearValue = {0.0f, 0.0f, 0.0f, 0.0f};
+            color_attachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+
+            wgpu::RenderPassDescriptor render_pass_desc;
+            render_pass_desc.colorAttachmentCount = 1;
+            render_pass_desc.colorAttachments = &color_attachment;
+            render_pass_desc.depthStencilAttachment = nullptr;
+
+            wgpu::raii::RenderPassEncoder pass_encoder = cmd_encoder->beginRenderPass(render_pass_desc);
+            pass_encoder->setPipeline(render_pipeline);
+            pass_encoder->setBindGroup(0, *bind_group, 0, nullptr);
+            pass_encoder->draw(3, 1, 0, 0);
+            pass_encoder->end();
+
+            source = destination;
+        }
+
+        wgpu::raii::CommandBuffer cmd_buffer = cmd_encoder->finish();
+        wgpu::raii::Queue queue = gpu.get_device().getQueue();
+        queue->submit(1, &(*cmd_buffer));
+        return true;
+    }
+
+  private:
+    const GPU& gpu;
+    wgpu::raii::BindGroupLayout bind_group_layout;
+    std::vector<const AsyncPipeline*> pipelines;  // R8, RG8, RGBA8
+    wgpu::raii::Sampler sampler;
+
+    const AsyncPipeline* pipeline_for(wgpu::TextureFormat format) const {
+        switch (format) {
+            case wgpu::TextureFormat::R8Unorm:
+                return pipelines[0];
+            case wgpu::TextureFormat::RG8Unorm:
+                return pipelines[1];
+            default:
+                return pipelines[2];
+        }
+    }
+
+    static wgpu::raii::TextureView level_view(const wgpu::Texture& texture, uint32_t level) {
+        wgpu::TextureViewDescriptor view_desc = {};
+        view_desc.format = texture.getFormat();
+        view_desc.dimension = wgpu::TextureViewDimension::_2D;
+        view_desc.baseMipLevel = level;
+        view_desc.mipLevelCount = 1;
+        view_desc.baseArrayLayer = 0;
+        view_desc.arrayLayerCount = 1;
+        view_desc.aspect = wgpu::TextureAspect::All;
+        return texture.createView(view_desc);
+    }
+};
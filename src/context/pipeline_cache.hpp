@@ -0,0 +1,253 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <span>
+#include <tuple>
+#include <vector>
+#include <webgpu/webgpu-raii.hpp>
+#ifndef __EMSCRIPTEN__
+#include <future>
+#endif
+
+#include "gpu.hpp"
+#include "shader_source.hpp"
+#include "src/log.hpp"
+
+
+// Descriptor of a fullscreen triangle pipeline, the states it points to live with it.
+struct FullscreenPipelineDescriptor {
+    wgpu::VertexState vertex_state;
+    wgpu::ColorTargetState color_target;
+    wgpu::FragmentState frag_state;
+    wgpu::RenderPipelineDescriptor pipeline_desc;
+
+    FullscreenPipelineDescriptor(
+        const ShaderSource& vertex_source,
+        const ShaderSource& frag_source,
+        const wgpu::PipelineLayout& pipeline_layout,
+        wgpu::TextureFormat format
+    ) {
+        vertex_state.module = *vertex_source.compiled_module;
+#ifdef __EMSCRIPTEN__
+        vertex_state.entryPoint = "vs_main";
+#else
+        vertex_state.entryPoint.data = "vs_main";
+        vertex_state.entryPoint.length = WGPU_STRLEN;
+#endif
+        vertex_state.bufferCount = 0;
+        vertex_state.buffers = nullptr;
+        vertex_state.constantCount = 0;
+        vertex_state.constants = nullptr;
+
+        color_target.format = format;
+        color_target.writeMask = wgpu::ColorWriteMask::All;
+        color_target.blend = nullptr;
+
+        frag_state.module = *frag_source.compiled_module;
+#ifdef __EMSCRIPTEN__
+        frag_state.entryPoint = "fs_main";
+#else
+        frag_state.entryPoint.data = "fs_main";
+        frag_state.entryPoint.length = WGPU_STRLEN;
+#endif
+        frag_state.constantCount = 0;
+        frag_state.constants = nullptr;
+        frag_state.targetCount = 1;
+        frag_state.targets = &color_target;
+
+        pipeline_desc.layout = pipeline_layout;
+        pipeline_desc.vertex = vertex_state;
+        pipeline_desc.fragment = &frag_state;
+        pipeline_desc.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
+        pipeline_desc.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
+        pipeline_desc.primitive.frontFace = wgpu::FrontFace::CCW;
+        pipeline_desc.primitive.cullMode = wgpu::CullMode::None;
+        pipeline_desc.depthStencil = nullptr;
+        pipeline_desc.multisample.count = 1;
+        pipeline_desc.multisample.mask = ~0u;
+        pipeline_desc.multisample.alphaToCoverageEnabled = false;
+    }
+
+    FullscreenPipelineDescriptor(const FullscreenPipelineDescriptor&) = delete;
+    FullscreenPipelineDescriptor(FullscreenPipelineDescriptor&&) = delete;
+};
+
+
+// Fullscreen render pipeline compiled without blocking the frame: `createRenderPipelineAsync` on the web, a worker
+// thread on native (wgpu-native does not implement the async entry point, its device is thread safe).
+// `get` returns a null pipeline until compilation is done.
+struct AsyncPipeline {
+    AsyncPipeline(
+        const GPU& gpu,
+        const ShaderSource& vertex_source,
+        const ShaderSource& frag_source,
+        const wgpu::raii::PipelineLayout& pipeline_layout,
+        wgpu::TextureFormat format
+    )
+        : pipeline_layout(pipeline_layout) {
+#ifdef __EMSCRIPTEN__
+        FullscreenPipelineDescriptor desc(vertex_source, frag_source, *pipeline_layout, format);
+        callback = gpu.get_device().createRenderPipelineAsync(
+            desc.pipeline_desc,
+            [this](wgpu::CreatePipelineAsyncStatus status, wgpu::RenderPipeline pipeline, const char* message) {
+                if (status == wgpu::CreatePipelineAsyncStatus::Success) {
+                    this->pipeline = std::move(pipeline);
+                } else {
+                    failed = true;
+                    Log::error("Pipeline compilation failed: {}", message ? message : "");
+                }
+            }
+        );
+#else
+        compiling = std::async(
+            std::launch::async,
+            [device = gpu.get_device(), &vertex_source, &frag_source, layout = *pipeline_layout, format]() {
+                FullscreenPipelineDescriptor desc(vertex_source, frag_source, layout, format);
+                return device.createRenderPipeline(desc.pipeline_desc);
+            }
+        );
+#endif
+    }
+
+    AsyncPipeline(const AsyncPipeline&) = delete;
+    AsyncPipeline(AsyncPipeline&&) = delete;  // `this` is handed to the compilation callback
+
+    ~AsyncPipeline() {
+#ifndef __EMSCRIPTEN__
+        if (compiling.valid()) pipeline = compiling.get();  // waits for the worker, then releases its result
+#endif
+    }
+
+    wgpu::RenderPipeline get() const {
+#ifndef __EMSCRIPTEN__
+        if (compiling.valid() && compiling.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            pipeline = compiling.get();
+            if (!*pipeline) {
+                failed = true;  // stops callers waiting on `is_compiling`
+                Log::error("Pipeline compilation failed.");
+            }
+        }
+#endif
+        return *pipeline;
+    }
+
+    bool is_compiling() const {
+        return !get() && !failed;
+    }
+
+  private:
+    wgpu::raii::PipelineLayout pipeline_layout;  // kept alive while compiling
+    mutable wgpu::raii::RenderPipeline pipeline;
+    mutable bool failed = false;
+#ifdef __EMSCRIPTEN__
+    std::unique_ptr<wgpu::CreateRenderPipelineAsyncCallback> callback;
+#else
+    mutable std::future<wgpu::RenderPipeline> compiling;
+#endif
+};
+
+
+// Shares bind group layouts, pipeline layouts and fullscreen render pipelines between shader instances. Pipelines are
+// compiled asynchronously, see `AsyncPipeline`.
+// Layouts are deduplicated by signature, so their handles can in turn key pipelines: adding a stage of an already used
+// kind, or recreating the chain on resize, does not compile anything.
+// Sources are keyed by address, only pass sources that outlive the cache (the ones of `ShaderSourceCache`).
+struct PipelineCache {
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+    };
+
+    const GPU& gpu;
+    mutable Stats stats;
+
+    PipelineCache(const GPU& gpu) : gpu(gpu) {}
+
+    PipelineCache(const PipelineCache&) = delete;
+    PipelineCache(PipelineCache&&) = delete;
+
+    const wgpu::raii::BindGroupLayout& get_bind_group_layout(std::span<const wgpu::BindGroupLayoutEntry> entries) const {
+        std::vector<uint64_t> signature;
+        signature.reserve(entries.size() * 11);
+        for (const wgpu::BindGroupLayoutEntry& e : entries) {
+            signature.insert(
+                signature.end(),
+                {e.binding,
+                 static_cast<uint64_t>(e.visibility),
+                 static_cast<uint64_t>(e.buffer.type),
+                 static_cast<uint64_t>(e.buffer.hasDynamicOffset),
+                 e.buffer.minBindingSize,
+                 static_cast<uint64_t>(e.sampler.type),
+                 static_cast<uint64_t>(e.texture.sampleType),
+                 static_cast<uint64_t>(e.texture.viewDimension),
+                 static_cast<uint64_t>(e.texture.multisampled),
+                 static_cast<uint64_t>(e.storageTexture.access),
+                 static_cast<uint64_t>(e.storageTexture.format)}
+            );
+        }
+
+        auto it = bind_group_layouts.find(signature);
+        if (it != bind_group_layouts.end()) {
+            stats.hits++;
+            return it->second;
+        }
+        stats.misses++;
+
+        wgpu::BindGroupLayoutDescriptor bgl_desc;
+        bgl_desc.entryCount = entries.size();
+        bgl_desc.entries = entries.data();
+        return bind_group_layouts[signature] = gpu.get_device().createBindGroupLayout(bgl_desc);
+    }
+
+    const wgpu::raii::PipelineLayout& get_pipeline_layout(std::span<const wgpu::BindGroupLayout> layouts) const {
+        std::vector<WGPUBindGroupLayout> key(layouts.begin(), layouts.end());
+
+        auto it = pipeline_layouts.find(key);
+        if (it != pipeline_layouts.end()) {
+            stats.hits++;
+            return it->second;
+        }
+        stats.misses++;
+
+        wgpu::PipelineLayoutDescriptor pipeline_layout_desc;
+        pipeline_layout_desc.bindGroupLayoutCount = key.size();
+        pipeline_layout_desc.bindGroupLayouts = key.data();
+        return pipeline_layouts[key] = gpu.get_device().createPipelineLayout(pipeline_layout_desc);
+    }
+
+    const AsyncPipeline& get_render_pipeline(
+        const ShaderSource& vertex_source,
+        const ShaderSource& frag_source,
+        std::span<const wgpu::BindGroupLayout> layouts,
+        wgpu::TextureFormat format = wgpu::TextureFormat::RGBA8Unorm
+    ) const {
+        PipelineKey key = {
+            &vertex_source,
+            &frag_source,
+            std::vector<WGPUBindGroupLayout>(layouts.begin(), layouts.end()),
+            static_cast<WGPUTextureFormat>(format)
+        };
+
+        auto it = render_pipelines.find(key);
+        if (it != render_pipelines.end()) {
+            stats.hits++;
+            return *it->second;
+        }
+        stats.misses++;
+
+        const wgpu::raii::PipelineLayout& pipeline_layout = get_pipeline_layout(layouts);
+        return *(render_pipelines[key] =
+                     std::make_unique<AsyncPipeline>(gpu, vertex_source, frag_source, pipeline_layout, format));
+    }
+
+  private:
+    using PipelineKey =
+        std::tuple<const ShaderSource*, const ShaderSource*, std::vector<WGPUBindGroupLayout>, WGPUTextureFormat>;
+
+    mutable std::map<std::vector<uint64_t>, wgpu::raii::BindGroupLayout> bind_group_layouts;
+    mutable std::map<std::vector<WGPUBindGroupLayout>, wgpu::raii::PipelineLayout> pipeline_layouts;
+    mutable std::map<PipelineKey, std::unique_ptr<AsyncPipeline>> render_pipelines;
+};
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <webgpu/webgpu-raii.hpp>
+
+#include "gpu.hpp"
+#include "src/log.hpp"
+
+
+// `copyTextureToBuffer` requires rows aligned to 256 bytes
+inline uint32_t padded_bytes_per_row(uint32_t width) {
+    return (width * 4 + 255) & ~255u;
+}
+
+
+// Ring of `MapRead` staging buffers receiving RGBA8 texture copies, mapped asynchronously.
+// `enqueue` records the copy, `flush` requests the mappings once the encoder is submitted and the callback runs when the
+// mapping completes (during a later device poll on native, from the event loop on the web), with rows padded to
+// `bytes_per_row`. The mapped range is only valid during the callback.
+struct ReadbackRing {
+    struct Frame {
+        const uint8_t* pixels;
+        uint32_t width;
+        uint32_t height;
+        uint32_t bytes_per_row;
+    };
+    using Callback = std::function<void(const Frame&)>;  // not called when the mapping fails
+
+    ReadbackRing(const GPU& gpu, size_t slot_count) : gpu(gpu), slots(slot_count) {}
+
+    ReadbackRing(const ReadbackRing&) = delete;
+    ReadbackRing(ReadbackRing&&) = delete;  // slots are handed to map callbacks
+
+    // Returns false when every slot is busy, the caller should let pending mappings complete and retry.
+    bool enqueue(
+        const wgpu::CommandEncoder& encoder,
+        const wgpu::Texture& texture,
+        uint32_t width,
+        uint32_t height,
+        Callback&& callback  // left untouched when no slot is free
+    ) {
+        Slot* slot = nullptr;
+        for (Slot& s : slots) {
+            if (s.state == Slot::State::Free) {
+                slot = &s;
+                break;
+            }
+        }
+        if (!slot) return false;
+
+        slot->width = width;
+        slot->height = height;
+        slot->bytes_per_row = padded_bytes_per_row(width);
+        slot->callback = std::move(callback);
+
+        uint64_t size = static_cast<uint64_t>(slot->bytes_per_row) * height;
+        if (!slot->buffer || slot->buffer->getSize() < size) {
+            wgpu::BufferDescriptor buffer_desc;
+            buffer_desc.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+            buffer_desc.size = size;
+            buffer_desc.mappedAtCreation = false;
+            slot->buffer = gpu.get_device().createBuffer(buffer_desc);
+        }
+
+#ifdef __EMSCRIPTEN__
+        wgpu::ImageCopyTexture source;
+        wgpu::ImageCopyBuffer destination;
+#else
+        wgpu::TexelCopyTextureInfo source;
+        wgpu::TexelCopyBufferInfo destination;
+#endif
+        source.texture = texture;
+        source.mipLevel = 0;
+        source.origin = {0, 0, 0};
+        source.aspect = wgpu::TextureAspect::All;
+        destination.buffer = *slot->buffer;
+        destination.layout.offset = 0;
+        destination.layout.bytesPerRow = slot->bytes_per_row;
+        destination.layout.rowsPerImage = height;
+
+        encoder.copyTextureToBuffer(source, destination, {width, height, 1});
+        slot->state = Slot::State::Recorded;
+        return true;
+    }
+
+    // Maps every copy recorded since the last call, the encoder holding them must have been submitted.
+    void flush() {
+        for (Slot& slot : slots) {
+            if (slot.state != Slot::State::Recorded) continue;
+            slot.state = Slot::State::Mapping;
+            uint64_t size = static_cast<uint64_t>(slot.bytes_per_row) * slot.height;
+#ifdef __EMSCRIPTEN__
+            slot.map_callback = slot.buffer->mapAsync(
+                wgpu::MapMode::Read,
+                0,
+                size,
+                [&slot](wgpu::BufferMapAsyncStatus status) {
+                    slot.on_mapped(status == wgpu::BufferMapAsyncStatus::Success);
+                }
+            );
+#else
+            wgpu::BufferMapCallbackInfo callback_info;
+            callback_info.mode = wgpu::CallbackMode::AllowSpontaneous;
+            callback_info.callback = [](WGPUMapAsyncStatus status, WGPUStringView, void* slot, void*) {
+                static_cast<Slot*>(slot)->on_mapped(status == WGPUMapAsyncStatus_Success);
+            };
+            callback_info.userdata1 = &slot;
+            slot.buffer->mapAsync(wgpu::MapMode::Read, 0, size, callback_info);
+#endif
+        }
+    }
+
+    size_t in_flight() const {
+        size_t count = 0;
+        for (const Slot& slot : slots) count += slot.state != Slot::State::Free;
+        return count;
+    }
+
+    size_t capacity() const {
+        return slots.size();
+    }
+
+  private:
+    struct Slot {
+        enum class State { Free, Recorded, Mapping };
+
+        State state = State::Free;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t bytes_per_row = 0;
+        Callback callback;
+        wgpu::raii::Buffer buffer;
+#ifdef __EMSCRIPTEN__
+        std::unique_ptr<wgpu::BufferMapCallback> map_callback;
+#endif
+
+        void on_mapped(bool success) {
+            if (success) {
+                uint64_t size = static_cast<uint64_t>(bytes_per_row) * height;
+                const uint8_t* pixels = static_cast<const uint8_t*>(buffer->getConstMappedRange(0, size));
+                callback(Frame{pixels, width, height, bytes_per_row});
+                buffer->unmap();
+            } else {
+                Log::error("Readback mapping failed.");
+            }
+            callback = nullptr;
+            state = State::Free;
+        }
+    };
+
+    const GPU& gpu;
+    std::vector<Slot> slots;
+};
+
+
+#ifndef __EMSCRIPTEN__
+// Copies a RGBA8 texture (needs `CopySrc`) to host memory with tightly packed rows.
+// Blocks on the device until the copy is mapped, only meant for offline use, never on the interactive loop.
+inline std::vector<uint8_t> read_texture_blocking(
+    const GPU& gpu, const wgpu::Texture& texture, uint32_t width, uint32_t height
+) {
+    const wgpu::Device& device = gpu.get_device();
+    uint32_t bytes_per_row = padded_bytes_per_row(width);
+
+    wgpu::BufferDescriptor buffer_desc;
+    buffer_desc.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+    buffer_desc.size = static_cast<uint64_t>(bytes_per_row) * height;
+    buffer_desc.mappedAtCreation = false;
+    wgpu::raii::Buffer buffer = device.createBuffer(buffer_desc);
+
+    wgpu::TexelCopyTextureInfo source;
+    source.texture = texture;
+    source.mipLevel = 0;
+    source.origin = {0, 0, 0};
+    source.aspect = wgpu::TextureAspect::All;
+
+    wgpu::TexelCopyBufferInfo destination;
+    destination.buffer = *buffer;
+    destination.layout.offset = 0;
+    destination.layout.bytesPerRow = bytes_per_row;
+    destination.layout.rowsPerImage = height;
+
+    wgpu::raii::CommandEncoder cmd_encoder = device.createCommandEncoder();
+    cmd_encoder->copyTextureToBuffer(source, destination, {width, height, 1});
+    wgpu::raii::CommandBuffer cmd_buffer = cmd_encoder->finish();
+    wgpu::raii::Queue queue = device.getQueue();
+    queue->submit(1, &(*cmd_buffer));
+
+    struct MapState {
+        bool done = false;
+        bool success = false;
+    } state;
+
+    wgpu::BufferMapCallbackInfo callback_info;
+    callback_info.mode = wgpu::CallbackMode::AllowSpontaneous;
+    callback_info.callback = [](WGPUMapAsyncStatus status, WGPUStringView, void* state, void*) {
+        static_cast<MapState*>(state)->done = true;
+        static_cast<MapState*>(state)->success = status == WGPUMapAsyncStatus_Success;
+    };
+    callback_info.userdata1 = &state;
+    buffer->mapAsync(wgpu::MapMode::Read, 0, buffer_desc.size, callback_info);
+    while (!state.done) device.poll(true, nullptr);
+
+    std::vector<uint8_t> pixels;
+    if (!state.success) {
+        Log::error("Texture readback failed.");
+        return pixels;
+    }
+
+    pixels.resize(static_cast<size_t>(width) * height * 4);
+    const uint8_t* mapped = static_cast<const uint8_t*>(buffer->getConstMappedRange(0, buffer_desc.size));
+    for (size_t y = 0; y < height; y++) {
+        std::memcpy(pixels.data() + y * width * 4, mapped + y * bytes_per_row, width * 4);
+    }
+    buffer->unmap();
+
+    return pixels;
+}
+#endif
@@ -1,23 +1,77 @@
 #pragma once
 
-#include <stb/stb_image.h>
-
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <format>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <webgpu/webgpu-raii.hpp>
 
 #include "imgui.h"
 #include "imgui_internal.h"
+#include "src/bounded_queue.hpp"
 #include "src/context/gpu.hpp"
+#include "src/context/image_decoder.hpp"
+#include "src/context/mipmap.hpp"
+#include "src/context/pipeline_cache.hpp"
+#include "src/context/shader_source.hpp"
+#include "src/context/texture.hpp"
+#include "src/context/thumbnail.hpp"
+#include "src/context/virtual_texture.hpp"
+#include "src/hash.hpp"
 #include "src/log.hpp"
+#include "src/qoi.hpp"
+#include "src/slot_map.hpp"
+#ifndef __EMSCRIPTEN__
+#include "src/context/video_decoder.hpp"
+#include "src/thread_pool.hpp"
+#endif
 
 
 enum class ResourceKind {
     Image,
-    // Video, TODO
+    Video,  // native only, decoding runs on threads
+};
+
+
+// What happens to the decoded pixels of an image once its texture holds them. Virtual textures (images larger than
+// the device limit) always keep them raw, their tiles are cut from them.
+enum class PixelRetention {
+    Free,        // the texture is the only copy
+    Compressed,  // lossless QOI copy, a few times smaller
+    Raw,
+};
+
+inline const char* pixel_retention_name(PixelRetention retention) {
+    constexpr const char* names[] = {"free after upload", "compressed copy", "raw copy"};
+    return names[static_cast<size_t>(retention)];
+}
+
+
+struct MemoryUsage {
+    size_t id;
+    std::string name;
+    size_t cpu_bytes;
+    size_t gpu_bytes;
 };
 
 
@@ -31,6 +85,97 @@ template <ResourceKind T>
 struct Resource;
 
 
+inline wgpu::raii::TextureView create_texture_view(const wgpu::Texture& texture, uint32_t mip_level_count = 1) {
+    wgpu::TextureViewDescriptor tex_view_desc = {};
+    tex_view_desc.format = texture.getFormat();
+    tex_view_desc.dimension = wgpu::TextureViewDimension::_2D;
+    tex_view_desc.mipLevelCount = mip_level_count;
+    tex_view_desc.baseMipLevel = 0;
+    tex_view_desc.arrayLayerCount = 1;
+    tex_view_desc.baseArrayLayer = 0;
+    tex_view_desc.aspect = wgpu::TextureAspect::All;
+
+    return texture.createView(tex_view_desc);
+}
+
+
+// `format` is one of `image_texture_format`
+inline wgpu::raii::Texture create_image_texture(
+    const GPU& gpu,
+    uint32_t width,
+    uint32_t height,
+    uint32_t mip_level_count = 1,
+    wgpu::TextureFormat format = wgpu::TextureFormat::RGBA8Unorm
+) {
+    wgpu::TextureDescriptor tex_desc;
+    tex_desc.size = {width, height, 1};
+    tex_desc.format = format;
+    tex_desc.usage = mip_level_count > 1 ? wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopyDst |
+                                               wgpu::TextureUsage::RenderAttachment
+                                         : wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopyDst;
+    tex_desc.dimension = wgpu::TextureDimension::_2D;
+    tex_desc.mipLevelCount = mip_level_count;
+    tex_desc.sampleCount = 1;
+    tex_desc.viewFormatCount = 0;
+    tex_desc.viewFormats = nullptr;
+
+    return gpu.get_device().createTexture(tex_desc);
+}
+
+// `texture_view` only covers the base level, mip levels are filled by a `MipmapGenerator`.
+inline void create_rgba_texture(
+    const GPU& gpu,
+    uint32_t width,
+    uint32_t height,
+    wgpu::raii::Texture& texture,
+    wgpu::raii::TextureView& texture_view,
+    uint32_t mip_level_count = 1
+) {
+    texture = create_image_texture(gpu, width, height, mip_level_count);
+    texture_view = create_texture_view(*texture);
+}
+
+
+// Draws the texture (or its `uv0`-`uv1` part) fit to the available region, with its name under it.
+inline void display_texture(
+    const std::string& name,
+    const wgpu::TextureView& texture_view,
+    int width,
+    int height,
+    ImVec2 uv0 = ImVec2(0, 0),
+    ImVec2 uv1 = ImVec2(1, 1)
+) {
+    ImVec2 display_region = ImGui::GetContentRegionAvail();
+    ImVec2 text_size = ImGui::CalcTextSize(name.c_str());
+
+    float start_x = ImGui::GetCursorPosX();
+    float start_y = ImGui::GetCursorPosY();
+
+    display_region.y -= 1.5 * text_size.y;
+
+    ImVec2 display_dim;
+    ImVec2 tex_to_display_ratio(display_region.x / width, display_region.y / height);
+
+    if (tex_to_display_ratio.x < tex_to_display_ratio.y) {
+        display_dim.x = tex_to_display_ratio.x * width;
+        display_dim.y = tex_to_display_ratio.x * height;
+    } else {
+        display_dim.x = tex_to_display_ratio.y * width;
+        display_dim.y = tex_to_display_ratio.y * height;
+    }
+
+    ImGui::SetCursorPos(ImVec2(
+        -(display_dim.x - display_region.x) * 0.5 + start_x,
+        -(display_dim.y - display_region.y) * 0.5 + start_y
+    ));
+
+    ImGui::Image(reinterpret_cast<ImTextureID>(static_cast<WGPUTextureView>(texture_view)), display_dim, uv0, uv1);
+
+    ImGui::SetCursorPosX((display_region.x - text_size.x) / 2);
+    ImGui::Text("%s", name.c_str());
+}
+
+
 template <>
 struct Resource<ResourceKind::Image> {
 #ifdef __EMSCRIPTEN__
@@ -42,126 +187,250 @@ struct Resource<ResourceKind::Image> {
     using Handle = std::filesystem::path;
 #endif
 
-    struct Data {
-        uint8_t* ptr;
-        int width;
-        int height;
-    };
+    using Data = ImageData;
 
-    Data data{};
+    Data data{};  // `ptr` is null once released, see `retain_pixels`
+    // QOI copy of released pixels under `PixelRetention::Compressed`, grey ones expanded to RGBA
+    std::vector<uint8_t> compressed;
 
     bool uploaded = false;
+    bool placeholder = false;  // `texture` is the shared placeholder, `data` only holds the dimensions
+    bool mipmaps_pending = false;  // levels below the base one are stale, see `ResourceManager::generate_mipmaps`
+    uint64_t version = 0;          // bumped whenever new pixels are uploaded
     wgpu::raii::Texture texture;
-    wgpu::raii::TextureView texture_view;
+    wgpu::raii::TextureView texture_view;  // base level only while `mipmaps_pending`, whole mip chain after
+    // receives the pixels band by band (see `upload_band`) while `texture` keeps showing the previous ones, the
+    // placeholder for imports, and replaces it once complete
+    wgpu::raii::Texture upload_target;
+    uint32_t uploaded_rows = 0;  // of `upload_target`
+    // images larger than the device limit, `texture` is then its overview and `data` feeds its tiles
+    std::shared_ptr<VirtualTexture> virtual_texture;
 
     std::string name;
 
     mutable std::vector<SafeCallback> update_callbacks;
 
-    ~Resource() {
-        if (data.ptr) stbi_image_free(data.ptr);
-    }
-
 
     Resource(const std::string& name, const Handle& handle, const GPU& gpu, bool upload = true) : name(name) {
         update(handle, gpu, upload);
     }
 
+    Resource(const std::string& name, Data data, const GPU& gpu, bool upload = true) : name(name) {
+        update(std::move(data), gpu, upload);
+    }
+
+    // Shows `placeholder_view` until `update` receives the pixels decoded elsewhere, `width` and `height` already give
+    // stages their layout.
+    Resource(
+        const std::string& name,
+        int width,
+        int height,
+        const wgpu::raii::Texture& placeholder_texture,
+        const wgpu::raii::TextureView& placeholder_view,
+        const GPU& gpu
+    )
+        : data{nullptr, width, height, nullptr, 4},
+          placeholder(true),
+          texture(placeholder_texture),
+          texture_view(placeholder_view),
+          name(name) {
+        if (VirtualTexture::is_needed(width, height)) {
+            virtual_texture = std::make_shared<VirtualTexture>(gpu, width, height);
+        }
+    }
+
 
     Resource(Resource&& other)
-        : data(other.data),
+        : data(std::move(other.data)),
+          compressed(std::move(other.compressed)),
           uploaded(other.uploaded),
+          placeholder(other.placeholder),
+          mipmaps_pending(other.mipmaps_pending),
+          version(other.version),
           texture(std::move(other.texture)),
           texture_view(std::move(other.texture_view)),
-          name(std::move(other.name)) {
+          upload_target(std::move(other.upload_target)),
+          uploaded_rows(other.uploaded_rows),
+          virtual_texture(std::move(other.virtual_texture)),
+          name(std::move(other.name)),
+          update_callbacks(std::move(other.update_callbacks)) {
         other.data.ptr = nullptr;
     }
 
     void update(const Handle& handle, const GPU& gpu, bool upload = true) {
-        data = load(handle);
+        update(load(handle), gpu, upload);
+    }
+
+    // Takes already decoded pixels. Uploaded right away, they overwrite the texture when dimensions and channels match.
+    // Images larger than the device limit take the `pyramid` of their virtual texture, built here when not given, and
+    // are always RGBA since their tiles share one atlas. Without `upload`, the pixels are left for `upload_band` in a
+    // new texture, the resource keeps showing its current one meanwhile.
+    void update(Data new_data, const GPU& gpu, bool upload = true, VirtualTexture::Pyramid&& pyramid = {}) {
+        data = VirtualTexture::is_needed(new_data.width, new_data.height) ? to_rgba(std::move(new_data))
+                                                                           : std::move(new_data);
+        compressed.clear();
+        uploaded = false;
+        upload_target = {};
+        uploaded_rows = 0;
 
         if (!data.ptr) {
             Log::error("Image loading failed.");
+            virtual_texture.reset();  // its tiles were cut from the freed pixels
             return;
         }
 
-        wgpu::TextureDescriptor tex_desc;
-        tex_desc.size = {static_cast<uint32_t>(data.width), static_cast<uint32_t>(data.height), 1};
-        tex_desc.format = wgpu::TextureFormat::RGBA8Unorm;
-        tex_desc.usage = wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopyDst;
-        tex_desc.dimension = wgpu::TextureDimension::_2D;
-        tex_desc.mipLevelCount = 1;
-        tex_desc.sampleCount = 1;
-        tex_desc.viewFormatCount = 0;
-        tex_desc.viewFormats = nullptr;
-
-        texture = gpu.get_device().createTexture(tex_desc);
-
-        wgpu::TextureViewDescriptor tex_view_desc = {};
-        tex_view_desc.format = wgpu::TextureFormat::RGBA8Unorm;
-        tex_view_desc.dimension = wgpu::TextureViewDimension::_2D;
-        tex_view_desc.mipLevelCount = 1;
-        tex_view_desc.baseMipLevel = 0;
-        tex_view_desc.arrayLayerCount = 1;
-        tex_view_desc.baseArrayLayer = 0;
-        tex_view_desc.aspect = wgpu::TextureAspect::All;
-
-        texture_view = texture->createView(tex_view_desc);
+        if (!VirtualTexture::is_needed(data.width, data.height)) {
+            virtual_texture.reset();
+        } else {
+            bool same_size = virtual_texture && virtual_texture->width == static_cast<uint32_t>(data.width) &&
+                             virtual_texture->height == static_cast<uint32_t>(data.height);
+            if (!same_size) virtual_texture = std::make_shared<VirtualTexture>(gpu, data.width, data.height);
+            virtual_texture->set_pixels(data.ptr, std::move(pyramid));
+        }
 
-        if (upload) upload_to_gpu(gpu);
+        auto [texture_width, texture_height] = texture_size();
+        wgpu::TextureFormat format = image_texture_format(data.channels);
+        // bands written over several frames must not land in the shown texture
+        if (upload && texture && !placeholder && texture->getWidth() == texture_width &&
+            texture->getHeight() == texture_height && texture->getFormat() == format) {
+            upload_target = texture;
+        } else {
+            uint32_t levels = mip_level_count(texture_width, texture_height);
+            upload_target = create_image_texture(gpu, texture_width, texture_height, levels, format);
+        }
 
+        if (!upload) return;
+        upload_to_gpu(gpu);
         notify_update();
     }
 
 
 
+    // Decodes with the first format of `image_decoders` accepting the file. Natively the file is mapped, raw formats
+    // then keep the mapping as their pixels and are uploaded from it without a copy.
     static Data load(const Handle& handle) {
-        Data data;
 #ifdef __EMSCRIPTEN__
-        data.ptr = stbi_load_from_memory(handle.data, handle.len, &data.width, &data.height, nullptr, 4);
+        return decode_image({{handle.data, handle.len}, {}, nullptr});
 #else
-        data.ptr = stbi_load(handle.c_str(), &data.width, &data.height, nullptr, 4);
+        return load_image(handle);
 #endif
-        return data;
     }
 
 
-    void upload_to_gpu(const GPU& gpu) {
-        if (uploaded) return;
+    wgpu::TextureView get_texture_view() const {
+        return *texture_view;
+    }
 
-        if (!texture) {
-            Log::error("Tried to upload to a texture that has not been created.");
+    // Whether the pixels reached the texture, decoding failures leave it false.
+    bool is_loaded() const {
+        return uploaded;
+    }
+
+    // of the shown texture, 1 or 2 for grey images, see `image_texture_format`
+    uint32_t texture_channels() const {
+        return texture ? texel_bytes(texture->getFormat()) : 4;
+    }
+
+    // Applies `retention` to the uploaded pixels: frees or compresses the CPU copy, or restores a compressed one when
+    // raw pixels are wanted again. Freed pixels cannot come back.
+    void retain_pixels(PixelRetention retention) {
+        if (!uploaded || virtual_texture) return;
+        if (retention == PixelRetention::Raw) {
+            if (data.ptr || compressed.empty()) return;
+            std::optional<QoiImage> image = qoi_decode(compressed.data(), compressed.size());
+            if (!image) return;
+            auto pixels = std::make_shared<std::vector<uint8_t>>(std::move(image->pixels));
+            if (data.channels != 4) {
+                pack_from_rgba(pixels->data(), pixels->size() / 4, data.channels, pixels->data());  // in place
+                pixels->resize(data.byte_size());
+            }
+            data.ptr = pixels->data();
+            data.storage = std::move(pixels);
+            compressed.clear();
             return;
         }
+        if (retention == PixelRetention::Free) compressed.clear();
+        if (!data.ptr) return;
+        if (retention == PixelRetention::Compressed) {
+            Data rgba = to_rgba(Data(data));
+            compressed = qoi_encode(rgba.ptr, rgba.width, rgba.height);
+        }
+        data.ptr = nullptr;
+        data.storage.reset();
+    }
 
-        wgpu::raii::Queue queue = gpu.get_device().getQueue();
-#ifdef __EMSCRIPTEN__
-        wgpu::ImageCopyTexture tcti;
-#else
-        wgpu::TexelCopyTextureInfo tcti;
-#endif
-        tcti.texture = *texture;
-        tcti.mipLevel = 0;
-        tcti.origin = {0, 0, 0};
-        tcti.aspect = wgpu::TextureAspect::All;
+    size_t cpu_bytes() const {
+        size_t bytes = compressed.size();
+        if (data.ptr) bytes += data.byte_size();
+        if (virtual_texture) bytes += virtual_texture->cpu_bytes();
+        return bytes;
+    }
 
-#ifdef __EMSCRIPTEN__
-        wgpu::TextureDataLayout tcbl;
-#else
-        wgpu::TexelCopyBufferLayout tcbl;
-#endif
-        tcbl.bytesPerRow = data.width * 4;
-        tcbl.rowsPerImage = data.height;
-        tcbl.offset = 0;
+    size_t gpu_bytes() const {  // the placeholder is shared, not counted
+        size_t bytes = texture && !placeholder ? texture_bytes(*texture) : 0;
+        // both are alive until the upload completes
+        WGPUTexture target = upload_target ? static_cast<WGPUTexture>(*upload_target) : nullptr;
+        if (target && target != static_cast<WGPUTexture>(*texture)) bytes += texture_bytes(*upload_target);
+        if (virtual_texture) bytes += virtual_texture->gpu_bytes();
+        return bytes;
+    }
+
+    // of `texture`, the overview for virtual textures
+    std::array<uint32_t, 2> texture_size() const {
+        if (virtual_texture) return {virtual_texture->overview_width, virtual_texture->overview_height};
+        return {static_cast<uint32_t>(data.width), static_cast<uint32_t>(data.height)};
+    }
 
-        wgpu::Extent3D e3d;
-        e3d.width = data.width;
-        e3d.height = data.height;
-        e3d.depthOrArrayLayers = 1;
 
-        queue->writeTexture(tcti, data.ptr, data.height * data.width * 4, tcbl, e3d);
+    void upload_to_gpu(const GPU& gpu) {
+        upload_band(gpu, SIZE_MAX);
+    }
 
+    // Writes the next rows of the pixels, as many as fit in `byte_budget` but at least one, and returns the bytes
+    // written. The last band swaps `upload_target` in, subscribers are not notified.
+    size_t upload_band(const GPU& gpu, size_t byte_budget) {
+        if (uploaded) return 0;
+
+        if (!upload_target) {
+            Log::error("Tried to upload to a texture that has not been created.");
+            return 0;
+        }
+
+        auto [texture_width, texture_height] = texture_size();
+        const uint8_t* pixels = virtual_texture ? virtual_texture->overview_pixels() : data.ptr;
+        uint32_t channels = virtual_texture ? 4 : data.channels;
+        size_t row_bytes = static_cast<size_t>(texture_width) * channels;
+        uint32_t rows = static_cast<uint32_t>(
+            std::clamp<size_t>(byte_budget / row_bytes, 1, texture_height - uploaded_rows)
+        );
+        const uint8_t* band = pixels + uploaded_rows * row_bytes;
+        write_texture(gpu, *upload_target, band, channels, 0, uploaded_rows, texture_width, rows);
+        uploaded_rows += rows;
+        if (uploaded_rows < texture_height) return rows * row_bytes;
+
+        texture = std::move(upload_target);
+        placeholder = false;
         uploaded = true;
+        version++;
+        mipmaps_pending = texture->getMipLevelCount() > 1;
+        texture_view = create_texture_view(*texture);  // stale levels must not be sampled
+        return rows * row_bytes;
+    }
+
+    bool is_uploading() const {
+        return upload_target && !uploaded;
+    }
+
+    float upload_progress() const {  // from 0 to 1
+        if (uploaded) return 1.0f;
+        return static_cast<float>(uploaded_rows) / std::max(texture_size()[1], 1u);
+    }
+
+    // Called once the mip chain is filled, subscribers rebind to the complete chain.
+    void mipmaps_generated() {
+        mipmaps_pending = false;
+        texture_view = create_texture_view(*texture, texture->getMipLevelCount());
+        notify_update();
     }
 
 
@@ -184,74 +453,770 @@ struct Resource<ResourceKind::Image> {
 
 
     void display() {
-        ImVec2 display_region = ImGui::GetContentRegionAvail();
-        ImVec2 text_size = ImGui::CalcTextSize(name.c_str());
+        display_texture(placeholder ? name + " (loading)" : name, *texture_view, data.width, data.height);
+    }
+};
 
-        float start_x = ImGui::GetCursorPosX();
-        float start_y = ImGui::GetCursorPosY();
 
-        display_region.y -= 1.5 * text_size.y;
+#ifndef __EMSCRIPTEN__
+// Streaming video, decoded ahead of the playback position by worker threads into a bounded queue of RGBA frames.
+// `advance` runs on the render thread: it takes the frame matching the playback time and uploads it into the next
+// texture of a ring allocated once, so showing a frame never creates a texture and never overwrites the one the
+// previous frames were drawn from. Subscribers are notified for every new frame, to rebind `texture_view`.
+template <>
+struct Resource<ResourceKind::Video> {
+    using Handle = std::filesystem::path;
 
-        ImVec2 display_dim;
-        ImVec2 tex_to_display_ratio(display_region.x / data.width, display_region.y / data.height);
+    static constexpr size_t TEXTURE_RING = 3;
+    static constexpr size_t DECODE_AHEAD = 4;  // decoded frames waiting for upload, bounds memory
 
-        if (tex_to_display_ratio.x < tex_to_display_ratio.y) {
-            display_dim.x = tex_to_display_ratio.x * data.width;
-            display_dim.y = tex_to_display_ratio.x * data.height;
-        } else {
-            display_dim.x = tex_to_display_ratio.y * data.width;
-            display_dim.y = tex_to_display_ratio.y * data.height;
+    struct Data {
+        int width;
+        int height;
+    };
+
+    struct DecodedFrame {
+        int64_t sequence;  // frame number since playback started, wraps around the video when looping
+        std::vector<uint8_t> pixels;
+    };
+
+    Data data{};
+    std::string name;
+
+    std::array<wgpu::raii::Texture, TEXTURE_RING> textures;
+    std::array<wgpu::raii::TextureView, TEXTURE_RING> texture_views;
+    size_t current_texture = 0;
+    wgpu::TextureView texture_view;  // frame currently shown, one of `texture_views`
+
+    mutable std::vector<SafeCallback> update_callbacks;
+
+    Resource(const std::string& name, const Handle& handle, const GPU& gpu, double sequence_fps = 30.0)
+        : name(name), decoded(DECODE_AHEAD) {
+        if (!decoder.open(handle, sequence_fps)) return;
+        data = {static_cast<int>(decoder.width), static_cast<int>(decoder.height)};
+
+        for (size_t i = 0; i < TEXTURE_RING; i++) {
+            create_rgba_texture(gpu, decoder.width, decoder.height, textures[i], texture_views[i]);
         }
+        texture_view = *texture_views[current_texture];
+
+        size_t decoder_count = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+        for (size_t i = 0; i < decoder_count; i++) {
+            decoders.emplace_back([this](std::stop_token stop) { decode_loop(stop); });
+        }
+    }
 
-        ImGui::SetCursorPos(ImVec2(
-            -(display_dim.x - display_region.x) * 0.5 + start_x,
-            -(display_dim.y - display_region.y) * 0.5 + start_y
-        ));
+    Resource(const Resource&) = delete;
+    Resource(Resource&&) = delete;  // decoding threads point to it
 
-        ImGui::Image(reinterpret_cast<ImTextureID>(static_cast<WGPUTextureView>(*texture_view)), display_dim);
+    ~Resource() {
+        for (std::jthread& decoder_thread : decoders) decoder_thread.request_stop();
+        decoded.close();
+        decoders.clear();  // joins
+    }
 
-        ImGui::SetCursorPosX((display_region.x - text_size.x) / 2);
-        ImGui::Text("%s", name.c_str());
+    bool is_open() const {
+        return !decoders.empty();
+    }
+
+    wgpu::TextureView get_texture_view() const {
+        return texture_view;
+    }
+
+    uint32_t texture_channels() const {  // frames are RGBA
+        return 4;
+    }
+
+    // Shows the frame at `time` seconds, looping. Without `wait`, the most recent decoded frame not after `time` is
+    // shown when decoding lags behind, with `wait` the call blocks until the exact frame is decoded (offline
+    // rendering). Time is expected to increase, decoding only moves forward.
+    void advance(double time, bool wait, const GPU& gpu) {
+        if (!is_open()) return;
+        int64_t wanted = static_cast<int64_t>(std::floor(std::max(time, 0.0) * decoder.fps));
+        wanted_sequence = wanted;  // lets decoders skip frames that would be late anyway
+
+        std::optional<DecodedFrame> latest;
+        while (true) {
+            bool reached = (latest && latest->sequence >= wanted) || shown_sequence >= wanted;
+            if (!pending) pending = wait && !reached ? decoded.pop() : decoded.try_pop();
+            if (!pending || pending->sequence > wanted) break;
+            if (latest) recycle(std::move(latest->pixels));
+            latest = std::move(pending);
+            pending.reset();
+        }
+        if (!latest) return;
+
+        current_texture = (current_texture + 1) % TEXTURE_RING;
+        write_rgba_texture(gpu, *textures[current_texture], latest->pixels.data(), decoder.width, decoder.height);
+        texture_view = *texture_views[current_texture];
+        shown_sequence = latest->sequence;
+        recycle(std::move(latest->pixels));
+
+        notify_update();
     }
-};
 
 
+    template <typename T>
+        requires std::is_same_v<const std::shared_ptr<void>, decltype(std::declval<T>().lifetime_token)>
+    void subscribe(const std::function<void()>& callback, T& subscriber) const {
+        update_callbacks.push_back(SafeCallback{
+            .subscriber_lifetime = subscriber.lifetime_token,
+            .callback = callback,
+        });
+    }
+
+
+    void notify_update() {
+        std::erase_if(update_callbacks, [](auto& scb) { return scb.subscriber_lifetime.expired(); });
+        for (auto& scb : update_callbacks) {
+            scb.callback();
+        }
+    }
+
+
+    void display() {
+        if (is_open()) display_texture(name, texture_view, data.width, data.height);
+    }
+
+    size_t cpu_bytes() const {  // decoded frames in flight, an upper bound
+        return (DECODE_AHEAD + decoders.size()) * frame_bytes();
+    }
+
+    size_t gpu_bytes() const {
+        return is_open() ? TEXTURE_RING * frame_bytes() : 0;
+    }
+
+  private:
+    VideoDecoder decoder;
+    BoundedQueue<DecodedFrame> decoded;
+    std::optional<DecodedFrame> pending;  // popped ahead of the playback time
+    int64_t shown_sequence = -1;
+    std::atomic<int64_t> wanted_sequence = 0;
+
+    // frames are claimed in order by tickets and pushed in ticket order, whichever decoder finishes first
+    std::mutex claim_mutex;
+    int64_t next_sequence = 0;
+    uint64_t next_ticket = 0;
+    std::mutex push_mutex;
+    std::condition_variable_any push_turn;
+    uint64_t pushed_tickets = 0;
+
+    std::mutex recycled_mutex;
+    std::vector<std::vector<uint8_t>> recycled;  // pixel buffers of uploaded frames, reused by the decoders
+
+    std::vector<std::jthread> decoders;  // last, joined before the members they use are destroyed
+
+
+    size_t frame_bytes() const {
+        return static_cast<size_t>(data.width) * data.height * 4;
+    }
+
+    void recycle(std::vector<uint8_t>&& pixels) {
+        std::lock_guard lock(recycled_mutex);
+        if (recycled.size() < DECODE_AHEAD + decoders.size()) recycled.push_back(std::move(pixels));
+    }
+
+    void decode_loop(std::stop_token stop) {
+        while (!stop.stop_requested()) {
+            DecodedFrame frame;
+            uint64_t ticket;
+            {
+                std::lock_guard lock(claim_mutex);
+                frame.sequence = std::max(next_sequence, wanted_sequence.load());
+                next_sequence = frame.sequence + 1;
+                ticket = next_ticket++;
+            }
+            {
+                std::lock_guard lock(recycled_mutex);
+                if (!recycled.empty()) {
+                    frame.pixels = std::move(recycled.back());
+                    recycled.pop_back();
+                }
+            }
+            bool decoded_frame = decoder.decode(frame.sequence % decoder.frame_count(), frame.pixels);
+            if (!decoded_frame) std::this_thread::sleep_for(std::chrono::milliseconds(10));  // do not spin on errors
+
+            std::unique_lock lock(push_mutex);
+            if (!push_turn.wait(lock, stop, [&] { return pushed_tickets == ticket; })) return;
+            if (decoded_frame && !decoded.push(std::move(frame))) return;  // closed
+            pushed_tickets++;
+            push_turn.notify_all();
+        }
+    }
+};
+#endif
+
 
 struct ResourceManager {
     const GPU& gpu;
-    wgpu::raii::Sampler default_texture_sampler;
+    wgpu::raii::Sampler default_texture_sampler;  // trilinear, images are mipmapped
 
-    ResourceManager(const GPU& gpu) : gpu(gpu) {
+    ResourceManager(const GPU& gpu, const ShaderSourceCache& shader_source_cache, const PipelineCache& pipeline_cache)
+        : gpu(gpu),
+          mipmap_generator(gpu, shader_source_cache, pipeline_cache),
+          thumbnail_atlas(gpu, shader_source_cache, pipeline_cache),
+          tile_cache(gpu),
+          fallback_virtual_texture(std::make_shared<VirtualTexture>(gpu, 1, 1)) {
         wgpu::SamplerDescriptor default_texture_sampler_desc = {};
         default_texture_sampler_desc.addressModeU = wgpu::AddressMode::ClampToEdge;
         default_texture_sampler_desc.addressModeV = wgpu::AddressMode::ClampToEdge;
         default_texture_sampler_desc.addressModeW = wgpu::AddressMode::ClampToEdge;
         default_texture_sampler_desc.magFilter = wgpu::FilterMode::Linear;
         default_texture_sampler_desc.minFilter = wgpu::FilterMode::Linear;
-        default_texture_sampler_desc.mipmapFilter = wgpu::MipmapFilterMode::Nearest;
+        default_texture_sampler_desc.mipmapFilter = wgpu::MipmapFilterMode::Linear;
         default_texture_sampler_desc.maxAnisotropy = 1;
 
         default_texture_sampler = gpu.get_device().createSampler(default_texture_sampler_desc);
+
+        static constexpr uint8_t PLACEHOLDER_COLOR[4] = {64, 64, 64, 255};
+        create_rgba_texture(gpu, 1, 1, placeholder_texture, placeholder_view);
+        write_rgba_texture(gpu, *placeholder_texture, PLACEHOLDER_COLOR, 1, 1);
+    }
+
+#ifndef __EMSCRIPTEN__
+    ~ResourceManager() {
+        loaded.close();  // unblocks decoders waiting for room
+        loader.reset();  // joins
+        while (loaded.try_pop()) {}
     }
+#endif
+
+    ResourceManager(const ResourceManager&) = delete;
+    ResourceManager(ResourceManager&&) = delete;
 
+    // Imports the same bytes as a previous import as an alias of it (see `add_alias`), without decoding them again. The
+    // file is mapped once, for both the hash and the decoding.
     size_t add_image(const std::string& name, const Resource<ResourceKind::Image>::Handle& handle) {
-        images.push_back(Resource<ResourceKind::Image>(name, handle, gpu));
-        size_t id = next_id();
-        images_index_map[id] = images.size() - 1;
-        return id;
+#ifdef __EMSCRIPTEN__
+        std::optional<EncodedImage> file = EncodedImage{{handle.data, handle.len}, {}, nullptr};
+#else
+        std::optional<EncodedImage> file = map_image_file(handle);
+#endif
+        std::optional<uint64_t> hash;
+        if (file) {
+            hash = xxh64(std::as_bytes(file->bytes));
+            if (std::optional<size_t> alias = add_alias(name, hash.value())) return alias.value();
+        }
+        auto image = std::make_shared<Resource<ResourceKind::Image>>(
+            name, file ? decode_image(file.value()) : Resource<ResourceKind::Image>::Data{}, gpu
+        );
+        if (image->virtual_texture) tile_cache.create_atlas();
+        image->retain_pixels(pixel_retention);
+        return insert_image(std::move(image), hash);
     }
 
+    // `id` must be the one of an image, throws `std::out_of_range` once the image was destroyed
     const Resource<ResourceKind::Image>& get_image(size_t id) const {
-        return images[images_index_map.at(id)];
+        return *resources.at(id).image;
+    }
+
+    Resource<ResourceKind::Image>& get_image(size_t id) {
+        return *resources.at(id).image;
+    }
+
+#ifndef __EMSCRIPTEN__
+    // Decodes on the loader pool and returns right away, the resource shows a placeholder of the right dimensions until
+    // `upload_loaded_images` receives its pixels and `upload_bands` wrote them all. The contents are hashed on the pool
+    // too, files with the contents of a previous import become aliases of it once hashed (see `add_alias`). Nothing if
+    // the file is not a readable image.
+    std::optional<size_t> add_image_async(const std::string& name, const std::filesystem::path& path) {
+        std::optional<EncodedImage> file = map_image_file(path);
+        const ImageDecoder* decoder = file ? find_image_decoder(file.value()) : nullptr;
+        if (!decoder) {
+            Log::error("{} is not a readable image.", path.string());
+            return std::nullopt;
+        }
+
+        auto [width, height] = decoder->info(file.value()).value();
+        auto image = std::make_shared<Resource<ResourceKind::Image>>(
+            name, width, height, placeholder_texture, placeholder_view, gpu
+        );
+        if (image->virtual_texture) tile_cache.create_atlas();
+        std::weak_ptr<Resource<ResourceKind::Image>> resource = image;
+        size_t id = insert_image(std::move(image), std::nullopt);
+
+        if (!loader) loader = std::make_unique<ThreadPool>(LOADER_THREADS);
+        loading++;
+        loader->submit([this, resource, file = std::move(file.value())]() {
+            uint64_t hash = xxh64(std::as_bytes(file.bytes));  // reads the whole file, kept off the render thread
+            LoadedImage image{resource, hash, decode_image(file), {}};
+            Resource<ResourceKind::Image>::Data& data = image.data;
+            if (data.ptr && VirtualTexture::is_needed(data.width, data.height)) {
+                data = to_rgba(std::move(data));
+                image.pyramid = VirtualTexture::build_pyramid(data.ptr, data.width, data.height);
+            }
+            loaded.push(std::move(image));  // dropped with its pixels once the manager is closing
+        });
+        return id;
+    }
+
+    // Hands one decoded image per call to its resource, the render thread calls it every frame. Its pixels are then
+    // written by `upload_bands`, unless an image with the same contents was imported meanwhile: the resource then
+    // becomes an alias of it and its pixels are dropped.
+    void upload_loaded_images() {
+        std::optional<LoadedImage> image = loaded.try_pop();
+        if (!image) return;
+        loading--;
+        std::shared_ptr<Resource<ResourceKind::Image>> resource = image->resource.lock();
+        if (!resource) return;  // removed while decoding
+        std::optional<size_t> id = find_original(*resource);
+        if (!id) return;
+        if (!image->data.ptr) {
+            // not registered as imported contents, later imports of the same bytes would alias a broken image
+            Log::error("Decoding {} failed.", resource->name);
+            remove(id.value());
+            return;
+        }
+        if (make_alias(id.value(), image->content_hash)) return;
+
+        resources.at(id.value()).content_hash = image->content_hash;
+        imported_contents[image->content_hash] = id.value();
+        resource->update(std::move(image->data), gpu, false, std::move(image->pyramid));
+        if (resource->virtual_texture) tile_cache.create_atlas();
+    }
+
+    size_t loading_count() const {  // images imported with `add_image_async` not uploaded yet
+        return loading;
+    }
+
+    // `sequence_fps` is the frame rate of image sequences, other containers carry theirs. Nothing if unreadable.
+    std::optional<size_t> add_video(
+        const std::string& name, const std::filesystem::path& path, double sequence_fps = 30.0
+    ) {
+        auto video = std::make_unique<Resource<ResourceKind::Video>>(name, path, gpu, sequence_fps);
+        if (!video->is_open()) return std::nullopt;
+        Entry entry;
+        entry.video = std::move(video);
+        return resources.insert(std::move(entry));
+    }
+
+    const Resource<ResourceKind::Video>& get_video(size_t id) const {
+        return *resources.at(id).video;
+    }
+
+    // Moves every video to the frame at `time`, called by the render thread before drawing.
+    void advance_videos(double time, bool wait) {
+        for_each_video([&](size_t, Resource<ResourceKind::Video>& video) { video.advance(time, wait, gpu); });
+    }
+#else
+    void upload_loaded_images() {}
+    void advance_videos(double, bool) {}
+#endif
+
+    // Writes the pixels of pending imports as row bands, at most `upload_budget` bytes per call (at least one row) so a
+    // large image takes several frames instead of stalling one. Render thread only, images are
+    // shown and their subscribers notified once complete.
+    void upload_bands() {
+        size_t budget = upload_budget;
+        for_each_image([&](size_t, Resource<ResourceKind::Image>& image) {
+            if (budget == 0 || !image.is_uploading()) return;
+            budget -= std::min(budget, image.upload_band(gpu, budget));
+            if (image.is_uploading()) return;
+            image.retain_pixels(pixel_retention);
+            image.notify_update();
+        });
+    }
+
+    size_t get_upload_budget() const {
+        return upload_budget;
+    }
+
+    void set_upload_budget(size_t bytes) {
+        upload_budget = std::max<size_t>(bytes, 1);
+    }
+
+    // Fills the mip chain of the images uploaded since the last call, render thread only. Images keep sampling their
+    // base level until then.
+    void generate_mipmaps() {
+        if (!mipmap_generator.is_ready()) return;
+        for_each_image([&](size_t, Resource<ResourceKind::Image>& image) {
+            if (image.mipmaps_pending && mipmap_generator.generate(*image.texture)) image.mipmaps_generated();
+        });
+    }
+
+    // Draws the thumbnails of images whose pixels changed, once their mip chain is complete so the downscale reads the
+    // right level. A few per call, render thread only.
+    void generate_thumbnails() {
+        static constexpr size_t THUMBNAILS_PER_FRAME = 4;
+        size_t drawn = 0;
+        bool compiling = false;
+        for_each_image([&](size_t id, Resource<ResourceKind::Image>& image) {
+            if (drawn == THUMBNAILS_PER_FRAME || compiling) return;
+            auto thumbnail = thumbnails.find(id);
+            bool outdated = thumbnail == thumbnails.end() || thumbnail->second.version != image.version;
+            if (!outdated || image.placeholder || image.mipmaps_pending) return;
+
+            std::optional<ThumbnailAtlas::Thumbnail> drawn_thumbnail = thumbnail_atlas.draw(
+                *image.texture_view,
+                *default_texture_sampler,
+                image.data.width,
+                image.data.height,
+                image.texture_channels(),
+                thumbnail != thumbnails.end() ? std::optional(thumbnail->second.thumbnail.cell) : std::nullopt
+            );
+            compiling = !drawn_thumbnail;
+            if (compiling) return;
+            thumbnails[id] = {drawn_thumbnail.value(), image.version};
+            drawn++;
+        });
+    }
+
+    // Vignette of the resource browser: the atlas thumbnail of images, the playing frame of videos.
+    void display_thumbnail(size_t id) const {
+#ifndef __EMSCRIPTEN__
+        if (const Entry& entry = resources.at(id); entry.video) {
+            entry.video->display();
+            return;
+        }
+#endif
+        const Entry& entry = resources.at(id);
+        const Resource<ResourceKind::Image>& image = *entry.image;
+        auto thumbnail = thumbnails.find(entry.alias_of.value_or(id));
+        if (thumbnail == thumbnails.end()) {
+            std::string label = image.is_uploading()
+                                    ? std::format("{} (uploading {:.0f}%)", image.name, image.upload_progress() * 100)
+                                    : image.name + " (loading)";
+            display_texture(label, *placeholder_view, image.data.width, image.data.height);
+            return;
+        }
+        const ThumbnailAtlas::Thumbnail& t = thumbnail->second.thumbnail;
+        auto [u0, v0, u1, v1] = t.uv_rect();
+        display_texture(
+            image.name, thumbnail_atlas.get_page_view(t.page()), t.width, t.height, ImVec2(u0, v0), ImVec2(u1, v1)
+        );
+    }
+
+    PixelRetention get_pixel_retention() const {
+        return pixel_retention;
+    }
+
+    // Applies to every image already uploaded too.
+    void set_pixel_retention(PixelRetention retention) {
+        pixel_retention = retention;
+        for_each_image([&](size_t, Resource<ResourceKind::Image>& image) { image.retain_pixels(retention); });
+    }
+
+    // CPU and GPU bytes held by each resource, largest first. Aliases hold nothing of their own and are not listed.
+    std::vector<MemoryUsage> memory_usage() const {
+        std::vector<MemoryUsage> usage;
+        resources.for_each([&](size_t id, const Entry& entry) {
+            if (entry.alias_of) return;
+            visit_texture(id, [&](const auto& resource) {
+                usage.push_back({id, resource.name, resource.cpu_bytes(), resource.gpu_bytes()});
+            });
+        });
+        std::sort(usage.begin(), usage.end(), [](const MemoryUsage& a, const MemoryUsage& b) {
+            return a.cpu_bytes + a.gpu_bytes > b.cpu_bytes + b.gpu_bytes;
+        });
+        return usage;
+    }
+
+    // GPU bytes not owned by a single resource: thumbnail atlas, tile atlas, placeholder.
+    size_t shared_gpu_bytes() const {
+        return thumbnail_atlas.gpu_bytes() + tile_cache.gpu_bytes() + texture_bytes(*placeholder_texture) +
+               fallback_virtual_texture->gpu_bytes();
+    }
+
+    // Images larger than the device limit, drawn through their virtual texture (see `Shader<ShaderKind::Image>`).
+    bool is_virtual(size_t id) const {
+        const Resource<ResourceKind::Image>* image = find_image(id);
+        return image && image->virtual_texture;
+    }
+
+    // The virtual texture of an image, one without tiled level (always sampling the overview) for other resources.
+    const VirtualTexture& get_virtual_texture(size_t id) const {
+        const Resource<ResourceKind::Image>* image = find_image(id);
+        return image && image->virtual_texture ? *image->virtual_texture : *fallback_virtual_texture;
+    }
+
+    wgpu::TextureView get_tile_atlas_view() const {
+        return tile_cache.get_atlas_view();
+    }
+
+    // Keeps resident the tiles a stage samples this frame: `region` is the visible part of the image in uv (min u,
+    // min v, max u, max v) and `display_size` the size it is drawn at, which selects the level. Render thread, before
+    // `stream_tiles`.
+    void request_tiles(size_t id, const std::array<float, 4>& region, const std::array<float, 2>& display_size) {
+        Resource<ResourceKind::Image>* image = find_image(id);
+        if (!image || !image->virtual_texture || !image->virtual_texture->has_pixels()) return;
+        const std::shared_ptr<VirtualTexture>& virtual_texture = image->virtual_texture;
+        tile_cache.request(virtual_texture, virtual_texture->level_for(display_size), region);
+    }
+
+    // Uploads the tiles requested this frame that are not resident yet, within the residency budget. Stages drawing
+    // an image whose page table changed are notified.
+    void stream_tiles() {
+        tile_cache.stream();
+        for_each_image([&](size_t, Resource<ResourceKind::Image>& image) {
+            if (image.virtual_texture && image.virtual_texture->flush_page_table(gpu)) image.notify_update();
+        });
+    }
+
+    bool tiles_streamed() const {  // see `TileCache::is_streamed`
+        return tile_cache.is_streamed();
     }
 
+    bool is_compiling() const {  // whether mip chains wait for their pipeline
+        return mipmap_generator.is_compiling();
+    }
+
+    // Hides the resource from listings, it is destroyed with its textures by `collect_removed` once no
+    // `ResourceReference` holds it anymore. False if it does not exist.
+    bool remove(size_t id) {
+        Entry* entry = resources.find(id);
+        if (!entry) return false;
+        entry->removed = true;
+        return true;
+    }
+
+    // Destroys removed resources nobody references, render thread, between frames.
+    void collect_removed() {
+        std::vector<size_t> collected;
+        resources.for_each([&](size_t id, const Entry& entry) {
+            if (entry.removed && entry.references == 0) collected.push_back(id);
+        });
+        for (size_t id : collected) {
+            promote_alias(id);
+            if (auto thumbnail = thumbnails.find(id); thumbnail != thumbnails.end()) {
+                thumbnail_atlas.release(thumbnail->second.thumbnail);
+                thumbnails.erase(thumbnail);
+            }
+            if (std::optional<uint64_t> hash = resources.at(id).content_hash) imported_contents.erase(hash.value());
+            resources.erase(id);
+        }
+    }
+
+    // see `ResourceReference`
+    void acquire(size_t id) const {
+        if (const Entry* entry = resources.find(id)) entry->references++;
+    }
+
+    void release(size_t id) const {
+        if (const Entry* entry = resources.find(id)) entry->references--;
+    }
+
+    // Resources that can be drawn as a texture (images and videos), by id. Removed ones are skipped.
+    template <typename F>
+    void for_each_texture(F&& f) const {
+        resources.for_each([&](size_t id, const Entry& entry) {
+            if (!entry.removed) f(id, get_name(id));
+        });
+    }
+
+    template <typename F>
+    decltype(auto) visit_texture(size_t id, F&& f) const {
+        const Entry& entry = resources.at(id);
+#ifndef __EMSCRIPTEN__
+        if (entry.video) return f(*entry.video);
+#endif
+        return f(*entry.image);
+    }
+
+    const std::string& get_name(size_t id) const {
+        if (const Entry& entry = resources.at(id); entry.alias_of) return entry.alias_name;
+        return visit_texture(id, [](const auto& resource) -> const std::string& { return resource.name; });
+    }
+
+    std::array<int, 2> get_dimensions(size_t id) const {
+        return visit_texture(id, [](const auto& resource) {
+            return std::array{resource.data.width, resource.data.height};
+        });
+    }
+
+    wgpu::TextureView get_texture_view(size_t id) const {
+        return visit_texture(id, [](const auto& resource) { return resource.get_texture_view(); });
+    }
+
+    // of the texture view, stages sampling it swizzle grey ones to RGBA
+    uint32_t get_channels(size_t id) const {
+        return visit_texture(id, [](const auto& resource) { return resource.texture_channels(); });
+    }
+
+    template <typename T>
+    void subscribe(size_t id, const std::function<void()>& callback, T& subscriber) const {
+        visit_texture(id, [&](const auto& resource) { resource.subscribe(callback, subscriber); });
+    }
+
+  private:
+    struct Entry {
+        // one of them is set, aliases share the image of their original
+        std::shared_ptr<Resource<ResourceKind::Image>> image;
+#ifndef __EMSCRIPTEN__
+        std::unique_ptr<Resource<ResourceKind::Video>> video;
+#endif
+        mutable uint32_t references = 0;  // `ResourceReference`s held, by the Image stages drawing it
+        bool removed = false;
+        std::optional<uint64_t> content_hash;  // of the imported bytes, originals only
+        std::optional<size_t> alias_of;        // id of the original, which does the per image work for its aliases
+        std::string alias_name;                // the image keeps the name of the original
+    };
+
+    // ids are the handles of this map, stable and never reused for another resource
+    SlotMap<Entry> resources;
+    std::unordered_map<uint64_t, size_t> imported_contents;  // content hash -> original
+
+    MipmapGenerator mipmap_generator;
+
+    struct CachedThumbnail {
+        ThumbnailAtlas::Thumbnail thumbnail;
+        uint64_t version;  // of the image when drawn
+    };
+    ThumbnailAtlas thumbnail_atlas;
+    std::unordered_map<size_t, CachedThumbnail> thumbnails;
+
+    TileCache tile_cache;
+    std::shared_ptr<VirtualTexture> fallback_virtual_texture;
+
+    wgpu::raii::Texture placeholder_texture;
+    wgpu::raii::TextureView placeholder_view;
+
+    PixelRetention pixel_retention = PixelRetention::Free;
+    size_t upload_budget = 16 << 20;  // bytes per frame, see `upload_bands`
 
-    // private:
-    std::unordered_map<size_t, size_t> images_index_map;
-    std::vector<Resource<ResourceKind::Image>> images;
+#ifndef __EMSCRIPTEN__
+    struct LoadedImage {
+        std::weak_ptr<Resource<ResourceKind::Image>> resource;  // not the id, which may be collected meanwhile
+        uint64_t content_hash;                     // of the file bytes
+        Resource<ResourceKind::Image>::Data data;  // null pixels when decoding failed
+        VirtualTexture::Pyramid pyramid;           // of images larger than the device limit
+    };
+
+    // Decoding threads, and decoded images waiting for the render thread. Decoders block while the queue is full, so
+    // at most 2 * LOADER_THREADS decoded images are held in memory during bulk imports.
+    static constexpr size_t LOADER_THREADS = 4;
+    BoundedQueue<LoadedImage> loaded{LOADER_THREADS};
+    size_t loading = 0;
+    std::unique_ptr<ThreadPool> loader;  // created on the first asynchronous import
+#endif
+
+    Resource<ResourceKind::Image>* find_image(size_t id) {
+        Entry* entry = resources.find(id);
+        return entry ? entry->image.get() : nullptr;
+    }
+
+    const Resource<ResourceKind::Image>* find_image(size_t id) const {
+        const Entry* entry = resources.find(id);
+        return entry ? entry->image.get() : nullptr;
+    }
+
+    // originals only, aliases share their image
+    template <typename F>
+    void for_each_image(F&& f) {
+        resources.for_each([&](size_t id, Entry& entry) {
+            if (entry.image && !entry.alias_of) f(id, *entry.image);
+        });
+    }
 
-    static size_t next_id() {
-        static size_t id = 0;
-        return id++;
+    size_t insert_image(std::shared_ptr<Resource<ResourceKind::Image>>&& image, std::optional<uint64_t> content_hash) {
+        Entry entry;
+        entry.image = std::move(image);
+        entry.content_hash = content_hash;
+        size_t id = resources.insert(std::move(entry));
+        if (content_hash) imported_contents[content_hash.value()] = id;
+        return id;
+    }
+
+    // A new resource sharing the image imported from bytes hashing to `content_hash`: it has its own id, name and
+    // references but the pixels are decoded, uploaded and stored once. Nothing if no such image exists.
+    std::optional<size_t> add_alias(const std::string& name, uint64_t content_hash) {
+        auto original = imported_contents.find(content_hash);
+        if (original == imported_contents.end()) return std::nullopt;
+        Entry entry;
+        entry.image = resources.at(original->second).image;
+        entry.alias_of = original->second;
+        entry.alias_name = name;
+        Log::info("{} has the contents of {}, imported as an alias of it.", name, entry.image->name);
+        return resources.insert(std::move(entry));
+    }
+
+#ifndef __EMSCRIPTEN__
+    // Entry owning `image`, aliases excluded.
+    std::optional<size_t> find_original(const Resource<ResourceKind::Image>& image) const {
+        std::optional<size_t> found;
+        resources.for_each([&](size_t id, const Entry& entry) {
+            if (entry.image.get() == &image && !entry.alias_of) found = id;
+        });
+        return found;
+    }
+
+    // Turns the still loading image `id` into an alias of a previous import of the same bytes, if any. Its stages are
+    // moved to the image of the original and notified so they rebind to it. Aliases can not point to a loading image,
+    // its hash is not known before.
+    bool make_alias(size_t id, uint64_t content_hash) {
+        auto original = imported_contents.find(content_hash);
+        if (original == imported_contents.end() || original->second == id) return false;
+        Entry& entry = resources.at(id);
+        std::shared_ptr<Resource<ResourceKind::Image>> loading_image = std::exchange(
+            entry.image, resources.at(original->second).image
+        );
+        entry.alias_of = original->second;
+        entry.alias_name = loading_image->name;
+        Log::info("{} has the contents of {}, imported as an alias of it.", entry.alias_name, entry.image->name);
+
+        if (auto thumbnail = thumbnails.find(id); thumbnail != thumbnails.end()) {
+            thumbnail_atlas.release(thumbnail->second.thumbnail);
+            thumbnails.erase(thumbnail);
+        }
+        std::ranges::copy(loading_image->update_callbacks, std::back_inserter(entry.image->update_callbacks));
+        loading_image->notify_update();  // the entry already resolves to the original
+        return true;
     }
+#endif
+
+    // Before the original `id` is destroyed, its first alias takes its place (thumbnail, content hash, name of the
+    // image) and the other aliases point to it.
+    void promote_alias(size_t id) {
+        Entry& original = resources.at(id);
+        if (!original.image || original.alias_of) return;
+        std::optional<size_t> successor;
+        resources.for_each([&](size_t alias_id, Entry& entry) {
+            if (entry.alias_of != id) return;
+            if (successor) {
+                entry.alias_of = successor;
+                return;
+            }
+            successor = alias_id;
+            entry.alias_of.reset();
+            entry.image->name = std::move(entry.alias_name);
+            entry.content_hash = std::exchange(original.content_hash, std::nullopt);
+        });
+        if (!successor) return;
+
+        if (std::optional<uint64_t> hash = resources.at(successor.value()).content_hash) {
+            imported_contents[hash.value()] = successor.value();
+        }
+        if (auto thumbnail = thumbnails.find(id); thumbnail != thumbnails.end()) {
+            CachedThumbnail cached = thumbnail->second;
+            thumbnails.erase(thumbnail);
+            thumbnails.emplace(successor.value(), cached);
+        }
+    }
+
+#ifndef __EMSCRIPTEN__
+    template <typename F>
+    void for_each_video(F&& f) {
+        resources.for_each([&](size_t id, Entry& entry) {
+            if (entry.video) f(id, *entry.video);
+        });
+    }
+#endif
+};
+
+
+// Keeps a resource alive while held: `ResourceManager::remove` only hides it until the last reference goes.
+struct ResourceReference {
+    ResourceReference(const ResourceManager& resource_manager, size_t id) : resource_manager(resource_manager), id(id) {
+        resource_manager.acquire(id);
+    }
+
+    ResourceReference(const ResourceReference&) = delete;
+    ResourceReference(ResourceReference&&) = delete;
+
+    ~ResourceReference() {
+        resource_manager.release(id);
+    }
+
+  private:
+    const ResourceManager& resource_manager;
+    const size_t id;
 };
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <webgpu/webgpu-raii.hpp>
+
+#include "gpu.hpp"
+
+
+// Writes a `width` x `height` block of tightly packed texels at (`x`, `y`) of the base level.
+inline void write_texture(
+    const GPU& gpu,
+    const wgpu::Texture& texture,
+    const void* texels,
+    uint32_t bytes_per_texel,
+    uint32_t x,
+    uint32_t y,
+    uint32_t width,
+    uint32_t height
+) {
+    wgpu::raii::Queue queue = gpu.get_device().getQueue();
+#ifdef __EMSCRIPTEN__
+    wgpu::ImageCopyTexture tcti;
+#else
+    wgpu::TexelCopyTextureInfo tcti;
+#endif
+    tcti.texture = texture;
+    tcti.mipLevel = 0;
+    tcti.origin = {x, y, 0};
+    tcti.aspect = wgpu::TextureAspect::All;
+
+#ifdef __EMSCRIPTEN__
+    wgpu::TextureDataLayout tcbl;
+#else
+    wgpu::TexelCopyBufferLayout tcbl;
+#endif
+    tcbl.bytesPerRow = width * bytes_per_texel;
+    tcbl.rowsPerImage = height;
+    tcbl.offset = 0;
+
+    wgpu::Extent3D e3d;
+    e3d.width = width;
+    e3d.height = height;
+    e3d.depthOrArrayLayers = 1;
+
+    queue->writeTexture(tcti, texels, static_cast<size_t>(height) * width * bytes_per_texel, tcbl, e3d);
+}
+
+
+// Sampled formats of 8 bit images by channel count: grey, grey and alpha, RGBA. Image stages and thumbnails swizzle
+// the first two back to RGBA (see image.wgsl).
+inline wgpu::TextureFormat image_texture_format(uint32_t channels) {
+    switch (channels) {
+        case 1:
+            return wgpu::TextureFormat::R8Unorm;
+        case 2:
+            return wgpu::TextureFormat::RG8Unorm;
+        default:
+            return wgpu::TextureFormat::RGBA8Unorm;
+    }
+}
+
+// Bytes per texel of the formats used here, 4 for RGBA8 and R32Uint.
+inline uint32_t texel_bytes(wgpu::TextureFormat format) {
+    switch (format) {
+        case wgpu::TextureFormat::R8Unorm:
+            return 1;
+        case wgpu::TextureFormat::RG8Unorm:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+
+inline void write_rgba_texture(
+    const GPU& gpu, const wgpu::Texture& texture, const uint8_t* pixels, uint32_t width, uint32_t height
+) {
+    write_texture(gpu, texture, pixels, 4, 0, 0, width, height);
+}
+
+
+// Memory taken by a texture and its mip chain.
+inline size_t texture_bytes(const wgpu::Texture& texture) {
+    uint32_t bytes_per_texel = texel_bytes(texture.getFormat());
+    size_t bytes = 0;
+    for (uint32_t level = 0; level < texture.getMipLevelCount(); level++) {
+        size_t width = std::max(texture.getWidth() >> level, 1u);
+        size_t height = std::max(texture.getHeight() >> level, 1u);
+        bytes += width * height * bytes_per_texel;
+    }
+    return bytes;
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include <webgpu/webgpu-raii.hpp>
+
+#include "gpu.hpp"
+#include "pipeline_cache.hpp"
+#include "shader_source.hpp"
+#include "shaders_code.hpp"
+
+
+// Small copies of resources for the resource browser, packed into atlas pages of fixed size cells. A thumbnail is
+// drawn once from the mip chain of its resource, the browser then samples a few kilobytes instead of the full
+// texture. Pages are added as cells run out, released cells are reused.
+struct ThumbnailAtlas {
+    static constexpr uint32_t CELL_SIZE = 256;
+    static constexpr uint32_t PAGE_SIZE = 2048;
+    static constexpr uint32_t CELLS_PER_ROW = PAGE_SIZE / CELL_SIZE;
+    static constexpr uint32_t CELLS_PER_PAGE = CELLS_PER_ROW * CELLS_PER_ROW;
+
+    struct Thumbnail {
+        uint32_t cell;    // page * CELLS_PER_PAGE + index in the page
+        uint32_t width;   // of the drawn content, the source fit in the cell
+        uint32_t height;
+
+        uint32_t page() const {
+            return cell / CELLS_PER_PAGE;
+        }
+
+        // normalized coordinates of the content in its page
+        std::array<float, 4> uv_rect() const {
+            uint32_t index = cell % CELLS_PER_PAGE;
+            float x = static_cast<float>(index % CELLS_PER_ROW * CELL_SIZE) / PAGE_SIZE;
+            float y = static_cast<float>(index / CELLS_PER_ROW * CELL_SIZE) / PAGE_SIZE;
+            return {x, y, x + static_cast<float>(width) / PAGE_SIZE, y + static_cast<float>(height) / PAGE_SIZE};
+        }
+    };
+
+    ThumbnailAtlas(const GPU& gpu, const ShaderSourceCache& shader_source_cache, const PipelineCache& pipeline_cache)
+        : gpu(gpu) {
+        wgpu::BindGroupLayoutEntry bgl_entries[3];
+        // source entry
+        bgl_entries[0].binding = 0;
+        bgl_entries[0].visibility = wgpu::ShaderStage::Fragment;
+        bgl_entries[0].texture.sampleType = wgpu::TextureSampleType::Float;
+        bgl_entries[0].texture.viewDimension = wgpu::TextureViewDimension::_2D;
+        bgl_entries[0].texture.multisampled = false;
+        // sampler entry
+        bgl_entries[1].binding = 1;
+        bgl_entries[1].visibility = wgpu::ShaderStage::Fragment;
+        bgl_entries[1].sampler.type = wgpu::SamplerBindingType::Filtering;
+        // channels entry
+        bgl_entries[2].binding = 2;
+        bgl_entries[2].visibility = wgpu::ShaderStage::Fragment;
+        bgl_entries[2].buffer.type = wgpu::BufferBindingType::Uniform;
+        bgl_entries[2].buffer.minBindingSize = sizeof(Uniforms);
+        bind_group_layout = pipeline_cache.get_bind_group_layout(bgl_entries);
+
+        wgpu::BufferDescriptor buffer_desc;
+        buffer_desc.size = sizeof(Uniforms);
+        buffer_desc.usage = wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst;
+        buffer_desc.mappedAtCreation = false;
+        uniforms_buffer = gpu.get_device().createBuffer(buffer_desc);
+
+        const ShaderSource& source = shader_source_cache.get(thumbnail);
+        wgpu::BindGroupLayout layouts[1] = {*bind_group_layout};
+        pipeline = &pipeline_cache.get_render_pipeline(source, source, layouts);
+    }
+
+    ThumbnailAtlas(const ThumbnailAtlas&) = delete;
+    ThumbnailAtlas(ThumbnailAtlas&&) = delete;
+
+    // Draws `source`, of `channels` channels (see `image_texture_format`), into `cell` (a new one if not given).
+    // Nothing while the pipeline compiles.
+    std::optional<Thumbnail> draw(
+        const wgpu::TextureView& source,
+        const wgpu::Sampler& sampler,
+        uint32_t source_width,
+        uint32_t source_height,
+        uint32_t channels,
+        std::optional<uint32_t> cell = std::nullopt
+    ) {
+        wgpu::RenderPipeline render_pipeline = pipeline->get();
+        if (!render_pipeline || source_width == 0 || source_height == 0) return std::nullopt;
+
+        float scale = static_cast<float>(CELL_SIZE) / std::max(source_width, source_height);
+        Thumbnail thumbnail = {
+            cell ? cell.value() : allocate(),
+            std::clamp(static_cast<uint32_t>(std::lround(source_width * scale)), 1u, CELL_SIZE),
+            std::clamp(static_cast<uint32_t>(std::lround(source_height * scale)), 1u, CELL_SIZE),
+        };
+        uint32_t index = thumbnail.cell % CELLS_PER_PAGE;
+        uint32_t x = index % CELLS_PER_ROW * CELL_SIZE;
+        uint32_t y = index / CELLS_PER_ROW * CELL_SIZE;
+
+        // draws are submitted one by one, the write lands before the draw using it
+        Uniforms uniforms = {channels};
+        wgpu::raii::Queue queue = gpu.get_device().getQueue();
+        queue->writeBuffer(*uniforms_buffer, 0, &uniforms, sizeof(uniforms));
+
+        wgpu::BindGroupEntry bg_entries[3];
+        // source entry
+        bg_entries[0].binding = 0;
+        bg_entries[0].textureView = source;
+        // sampler entry
+        bg_entries[1].binding = 1;
+        bg_entries[1].sampler = sampler;
+        // channels entry
+        bg_entries[2].binding = 2;
+        bg_entries[2].buffer = *uniforms_buffer;
+        bg_entries[2].offset = 0;
+        bg_entries[2].size = sizeof(Uniforms);
+
+        wgpu::BindGroupDescriptor bg_desc;
+        bg_desc.layout = *bind_group_layout;
+        bg_desc.entryCount = 3;
+        bg_desc.entries = bg_entries;
+        wgpu::raii::BindGroup bind_group = gpu.get_device().createBindGroup(bg_desc);
+
+        wgpu::RenderPassColorAttachment color_attachment;
+        color_attachment.view = *pages[thumbnail.page()].texture_view;
+        color_attachment.loadOp = wgpu::LoadOp::Load;  // other cells are kept
+        color_attachment.storeOp = wgpu::StoreOp::Store;
+        color_attachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+
+        wgpu::RenderPassDescriptor render_pass_desc;
+        render_pass_desc.colorAttachmentCount = 1;
+        render_pass_desc.colorAttachments = &color_attachment;
+        render_pass_desc.depthStencilAttachment = nullptr;
+
+        wgpu::raii::CommandEncoder cmd_encoder = gpu.get_device().createCommandEncoder();
+        wgpu::raii::RenderPassEncoder pass_encoder = cmd_encoder->beginRenderPass(render_pass_desc);
+        pass_encoder->setViewport(x, y, thumbnail.width, thumbnail.height, 0.0f, 1.0f);
+        pass_encoder->setScissorRect(x, y, thumbnail.width, thumbnail.height);
+        pass_encoder->setPipeline(render_pipeline);
+        pass_encoder->setBindGroup(0, *bind_group, 0, nullptr);
+        pass_encoder->draw(3, 1, 0, 0);
+        pass_encoder->end();
+
+        wgpu::raii::CommandBuffer cmd_buffer = cmd_encoder->finish();
+        queue->submit(1, &(*cmd_buffer));
+        return thumbnail;
+    }
+
+    void release(const Thumbnail& thumbnail) {
+        free_cells.push_back(thumbnail.cell);
+    }
+
+    wgpu::TextureView get_page_view(uint32_t page) const {
+        return *pages[page].texture_view;
+    }
+
+    size_t page_count() const {
+        return pages.size();
+    }
+
+    size_t gpu_bytes() const {
+        return pages.size() * PAGE_SIZE * PAGE_SIZE * 4;
+    }
+
+  private:
+    struct alignas(16) Uniforms {
+        uint32_t channels;
+    };
+
+    struct Page {
+        wgpu::raii::Texture texture;
+        wgpu::raii::TextureView texture_view;
+    };
+
+    const GPU& gpu;
+    wgpu::raii::BindGroupLayout bind_group_layout;
+    const AsyncPipeline* pipeline;
+    wgpu::raii::Buffer uniforms_buffer;
+    std::vector<Page> pages;
+    std::vector<uint32_t> free_cells;
+    uint32_t used_cells = 0;
+
+    uint32_t allocate() {
+        if (!free_cells.empty()) {
+            uint32_t cell = free_cells.back();
+            free_cells.pop_back();
+            return cell;
+        }
+        if (used_cells == pages.size() * CELLS_PER_PAGE) add_page();
+        return used_cells++;
+    }
+
+    void add_page() {
+        wgpu::TextureDescriptor tex_desc;
+        tex_desc.size = {PAGE_SIZE, PAGE_SIZE, 1};
+        tex_desc.format = wgpu::TextureFormat::RGBA8Unorm;
+        tex_desc.usage = wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::RenderAttachment;
+        tex_desc.dimension = wgpu::TextureDimension::_2D;
+        tex_desc.mipLevelCount = 1;
+        tex_desc.sampleCount = 1;
+        tex_desc.viewFormatCount = 0;
+        tex_desc.viewFormats = nullptr;
+
+        wgpu::TextureViewDescriptor tex_view_desc = {};
+        tex_view_desc.format = wgpu::TextureFormat::RGBA8Unorm;
+        tex_view_desc.dimension = wgpu::TextureViewDimension::_2D;
+        tex_view_desc.mipLevelCount = 1;
+        tex_view_desc.baseMipLevel = 0;
+        tex_view_desc.arrayLayerCount = 1;
+        tex_view_desc.baseArrayLayer = 0;
+        tex_view_desc.aspect = wgpu::TextureAspect::All;
+
+        Page page;
+        page.texture = gpu.get_device().createTexture(tex_desc);
+        page.texture_view = page.texture->createView(tex_view_desc);
+        pages.push_back(std::move(page));
+    }
+};
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/context/image_decoder.hpp"
+#include "src/log.hpp"
+
+
+// Random access frame source decoding to tightly packed RGBA8, `decode` may be called from several threads at once.
+// Containers:
+//  - Y4M (`.y4m`): planar 4:2:0, 4:2:2, 4:4:4 or mono 8 bit YUV, BT.601, limited range unless `XCOLORRANGE=FULL`.
+//    Frame offsets are indexed on open so any frame can be read directly.
+//  - image sequence: every image of a directory in file name order, decoded by `image_decoders`, opening one of the
+//    images selects its directory.
+struct VideoDecoder {
+    enum class Container {
+        Y4M,
+        ImageSequence,
+    };
+
+    Container container = Container::Y4M;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    double fps = 30.0;
+
+    VideoDecoder() = default;
+    VideoDecoder(const VideoDecoder&) = delete;
+    VideoDecoder(VideoDecoder&&) = delete;
+
+    // `sequence_fps` is only used by image sequences, Y4M carries its own frame rate.
+    bool open(const std::filesystem::path& path, double sequence_fps = 30.0) {
+        if (std::filesystem::is_directory(path)) return open_sequence(path, sequence_fps);
+        if (path.extension() == ".y4m") return open_y4m(path);
+        return open_sequence(path.parent_path(), sequence_fps);
+    }
+
+    size_t frame_count() const {
+        return container == Container::Y4M ? frame_offsets.size() : frames.size();
+    }
+
+    bool decode(size_t frame, std::vector<uint8_t>& rgba) {
+        if (frame >= frame_count()) return false;
+        rgba.resize(static_cast<size_t>(width) * height * 4);
+        return container == Container::Y4M ? decode_y4m(frame, rgba.data()) : decode_sequence(frame, rgba.data());
+    }
+
+  private:
+    enum class Chroma {
+        C420,
+        C422,
+        C444,
+        Mono,
+    };
+
+    // Y4M
+    std::ifstream file;
+    std::mutex file_mutex;
+    std::vector<std::streamoff> frame_offsets;
+    Chroma chroma = Chroma::C420;
+    bool full_range = false;
+
+    // image sequence
+    std::vector<std::filesystem::path> frames;
+
+
+    uint32_t chroma_width() const {
+        return chroma == Chroma::C444 ? width : (width + 1) / 2;
+    }
+
+    uint32_t chroma_height() const {
+        return chroma == Chroma::C420 ? (height + 1) / 2 : height;
+    }
+
+    size_t y4m_frame_size() const {
+        size_t luma = static_cast<size_t>(width) * height;
+        return chroma == Chroma::Mono ? luma : luma + 2 * static_cast<size_t>(chroma_width()) * chroma_height();
+    }
+
+
+    bool open_y4m(const std::filesystem::path& path) {
+        container = Container::Y4M;
+        file.open(path, std::ios::binary);
+        std::string header;
+        if (!file || !std::getline(file, header) || !header.starts_with("YUV4MPEG2")) {
+            Log::error("{} is not a Y4M file.", path.string());
+            return false;
+        }
+
+        std::string_view fields = header;
+        while (!fields.empty()) {
+            size_t end = std::min(fields.find(' '), fields.size());
+            std::string_view field = fields.substr(0, end);
+            fields.remove_prefix(std::min(end + 1, fields.size()));
+            if (field.empty()) continue;
+
+            std::string value(field.substr(1));
+            switch (field[0]) {
+                case 'W':
+                    width = std::strtoul(value.c_str(), nullptr, 10);
+                    break;
+                case 'H':
+                    height = std::strtoul(value.c_str(), nullptr, 10);
+                    break;
+                case 'F': {
+                    size_t colon = value.find(':');
+                    double numerator = std::strtod(value.c_str(), nullptr);
+                    double denominator = 1.0;
+                    if (colon != std::string::npos) denominator = std::strtod(value.c_str() + colon + 1, nullptr);
+                    fps = denominator > 0.0 ? numerator / denominator : 0.0;
+                    break;
+                }
+                case 'C':
+                    if (value.starts_with("420")) {
+                        chroma = Chroma::C420;
+                    } else if (value.starts_with("422")) {
+                        chroma = Chroma::C422;
+                    } else if (value.starts_with("444") && value.size() == 3) {
+                        chroma = Chroma::C444;
+                    } else if (value == "mono") {
+                        chroma = Chroma::Mono;
+                    } else {
+                        Log::error("Unsupported Y4M colorspace {}.", value);
+                        return false;
+                    }
+                    break;
+                case 'X':
+                    if (value == "COLORRANGE=FULL") full_range = true;
+                    break;
+            }
+        }
+        if (width == 0 || height == 0 || !(fps > 0.0)) {
+            Log::error("Invalid Y4M header in {}.", path.string());
+            return false;
+        }
+
+        // Index frames, each starts with a `FRAME` line that may carry parameters
+        std::string frame_header;
+        while (std::getline(file, frame_header) && frame_header.starts_with("FRAME")) {
+            frame_offsets.push_back(file.tellg());
+            file.seekg(static_cast<std::streamoff>(y4m_frame_size()), std::ios::cur);
+        }
+        file.clear();
+        if (frame_offsets.empty()) {
+            Log::error("{} has no frame.", path.string());
+            return false;
+        }
+        return true;
+    }
+
+
+    bool decode_y4m(size_t frame, uint8_t* rgba) {
+        thread_local std::vector<uint8_t> planes;
+        planes.resize(y4m_frame_size());
+        {
+            std::lock_guard lock(file_mutex);
+            file.seekg(frame_offsets[frame]);
+            if (!file.read(reinterpret_cast<char*>(planes.data()), planes.size())) {
+                file.clear();
+                Log::error("Truncated Y4M frame {}.", frame);
+                return false;
+            }
+        }
+
+        const uint8_t* y_plane = planes.data();
+        const uint8_t* cb_plane = y_plane + static_cast<size_t>(width) * height;
+        const uint8_t* cr_plane = cb_plane + static_cast<size_t>(chroma_width()) * chroma_height();
+        uint32_t shift_x = chroma == Chroma::C444 ? 0 : 1;
+        uint32_t shift_y = chroma == Chroma::C420 ? 1 : 0;
+
+        // BT.601 in 8.8 fixed point
+        int luma_offset = full_range ? 0 : 16;
+        int luma_scale = full_range ? 256 : 298;
+        int cr_to_r = full_range ? 359 : 409;
+        int cb_to_g = full_range ? 88 : 100;
+        int cr_to_g = full_range ? 183 : 208;
+        int cb_to_b = full_range ? 454 : 516;
+
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                int luma = (y_plane[static_cast<size_t>(y) * width + x] - luma_offset) * luma_scale;
+                int cb = 0, cr = 0;
+                if (chroma != Chroma::Mono) {
+                    size_t c = static_cast<size_t>(y >> shift_y) * chroma_width() + (x >> shift_x);
+                    cb = cb_plane[c] - 128;
+                    cr = cr_plane[c] - 128;
+                }
+                uint8_t* p = rgba + (static_cast<size_t>(y) * width + x) * 4;
+                p[0] = static_cast<uint8_t>(std::clamp((luma + cr_to_r * cr + 128) >> 8, 0, 255));
+                p[1] = static_cast<uint8_t>(std::clamp((luma - cb_to_g * cb - cr_to_g * cr + 128) >> 8, 0, 255));
+                p[2] = static_cast<uint8_t>(std::clamp((luma + cb_to_b * cb + 128) >> 8, 0, 255));
+                p[3] = 255;
+            }
+        }
+        return true;
+    }
+
+
+    bool open_sequence(const std::filesystem::path& directory, double sequence_fps) {
+        static constexpr std::string_view EXTENSIONS[] = {
+            ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".ppm", ".pgm", ".pam", ".qoi", ".rgba"
+        };
+
+        container = Container::ImageSequence;
+        fps = sequence_fps;
+        for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory)) {
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+            if (entry.is_regular_file() &&
+                std::find(std::begin(EXTENSIONS), std::end(EXTENSIONS), extension) != std::end(EXTENSIONS)) {
+                frames.push_back(entry.path());
+            }
+        }
+        std::sort(frames.begin(), frames.end());
+
+        std::optional<std::array<int, 2>> size = frames.empty() ? std::nullopt : image_info(frames[0]);
+        if (!size) {
+            Log::error("No readable image sequence in {}.", directory.string());
+            return false;
+        }
+        width = size.value()[0];
+        height = size.value()[1];
+        return true;
+    }
+
+
+    bool decode_sequence(size_t frame, uint8_t* rgba) {
+        ImageData image = load_image(frames[frame]);
+        if (!image.ptr) {
+            Log::error("Could not decode {}.", frames[frame].string());
+            return false;
+        }
+        bool matches = static_cast<uint32_t>(image.width) == width && static_cast<uint32_t>(image.height) == height;
+        if (matches) {
+            expand_to_rgba(image.ptr, static_cast<size_t>(width) * height, image.channels, rgba);
+        } else {
+            Log::error("{} does not have the size of the first frame of its sequence.", frames[frame].string());
+        }
+        return matches;
+    }
+};
@@ -0,0 +1,445 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <webgpu/webgpu-raii.hpp>
+
+#include "gpu.hpp"
+#include "texture.hpp"
+
+
+// Image too large for a single texture, cut in tiles at every level of a mip pyramid kept on the CPU. The first level
+// fitting OVERVIEW_SIZE is the overview, an ordinary mipmapped texture sampled wherever tiles are missing. Tiles of the
+// larger levels are streamed on demand into the atlas of a `TileCache`, the page table texture maps every tile to its
+// atlas slot (see image_virtual.wgsl).
+struct VirtualTexture {
+    static constexpr uint32_t TILE_SIZE = 256;
+    static constexpr uint32_t TILE_BORDER = 1;  // texels copied from neighbour tiles so filtering crosses seams
+    static constexpr uint32_t SLOT_SIZE = TILE_SIZE + 2 * TILE_BORDER;
+    static constexpr uint32_t ATLAS_SLOTS_PER_ROW = 16;
+    static constexpr uint32_t ATLAS_SLOTS = ATLAS_SLOTS_PER_ROW * ATLAS_SLOTS_PER_ROW;  // 256 tiles, 68 MB
+    static constexpr uint32_t OVERVIEW_SIZE = 2048;
+    static constexpr uint32_t MAX_LEVELS = 8;
+
+    using Pyramid = std::vector<std::vector<uint8_t>>;  // RGBA8 levels after the full resolution one, overview last
+
+    struct Level {
+        uint32_t width;
+        uint32_t height;
+        uint32_t tiles_x;
+        uint32_t tiles_y;
+        uint32_t first_row;  // of its tiles in the page table
+    };
+
+    struct Tile {
+        uint32_t level;
+        uint32_t x;
+        uint32_t y;
+    };
+
+    struct alignas(16) Uniforms {  // `VirtualUniforms` of image_virtual.wgsl
+        float image_size[2];
+        uint32_t level_count;
+        uint32_t slots_per_row;
+        uint32_t levels[MAX_LEVELS][4];  // width, height, first row, unused
+    };
+
+    uint32_t width;
+    uint32_t height;
+    std::vector<Level> levels;  // tiled ones, the overview excluded
+    uint32_t overview_width;
+    uint32_t overview_height;
+    uint64_t generation = 0;  // bumped with new pixels, atlas slots filled by older generations are free
+
+    static bool is_needed(int width, int height) {
+        return static_cast<uint32_t>(std::max(width, height)) > GPU::MAX_TEXTURE_DIMENSION_2D;
+    }
+
+    // Allocates the page table, pixels come later with `set_pixels`. Images fitting OVERVIEW_SIZE have no tiled level
+    // and always sample their overview.
+    VirtualTexture(const GPU& gpu, uint32_t width, uint32_t height) : width(width), height(height) {
+        uint32_t level_width = width;
+        uint32_t level_height = height;
+        uint32_t rows = 0;
+        while (std::max(level_width, level_height) > OVERVIEW_SIZE && levels.size() < MAX_LEVELS) {
+            Level level = {
+                level_width,
+                level_height,
+                (level_width + TILE_SIZE - 1) / TILE_SIZE,
+                (level_height + TILE_SIZE - 1) / TILE_SIZE,
+                rows
+            };
+            levels.push_back(level);
+            rows += level.tiles_y;
+            level_width = half(level_width);
+            level_height = half(level_height);
+        }
+        overview_width = level_width;
+        overview_height = level_height;
+
+        page_table_width = levels.empty() ? 1 : levels[0].tiles_x;
+        page_table.assign(static_cast<size_t>(page_table_width) * std::max(rows, 1u), 0);
+
+        wgpu::TextureDescriptor tex_desc;
+        tex_desc.size = {page_table_width, std::max(rows, 1u), 1};
+        tex_desc.format = wgpu::TextureFormat::R32Uint;
+        tex_desc.usage = wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopyDst;
+        tex_desc.dimension = wgpu::TextureDimension::_2D;
+        tex_desc.mipLevelCount = 1;
+        tex_desc.sampleCount = 1;
+        tex_desc.viewFormatCount = 0;
+        tex_desc.viewFormats = nullptr;
+        page_table_texture = gpu.get_device().createTexture(tex_desc);
+
+        wgpu::TextureViewDescriptor tex_view_desc = {};
+        tex_view_desc.format = wgpu::TextureFormat::R32Uint;
+        tex_view_desc.dimension = wgpu::TextureViewDimension::_2D;
+        tex_view_desc.mipLevelCount = 1;
+        tex_view_desc.baseMipLevel = 0;
+        tex_view_desc.arrayLayerCount = 1;
+        tex_view_desc.baseArrayLayer = 0;
+        tex_view_desc.aspect = wgpu::TextureAspect::All;
+        page_table_view = page_table_texture->createView(tex_view_desc);
+        page_table_dirty = true;
+        flush_page_table(gpu);
+
+        Uniforms uniforms = {};
+        uniforms.image_size[0] = static_cast<float>(width);
+        uniforms.image_size[1] = static_cast<float>(height);
+        uniforms.level_count = levels.size();
+        uniforms.slots_per_row = ATLAS_SLOTS_PER_ROW;
+        for (size_t l = 0; l < levels.size(); l++) {
+            uniforms.levels[l][0] = levels[l].width;
+            uniforms.levels[l][1] = levels[l].height;
+            uniforms.levels[l][2] = levels[l].first_row;
+        }
+
+        wgpu::BufferDescriptor buffer_desc;
+        buffer_desc.size = sizeof(Uniforms);
+        buffer_desc.usage = wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst;
+        buffer_desc.mappedAtCreation = false;
+        uniforms_buffer = gpu.get_device().createBuffer(buffer_desc);
+        wgpu::raii::Queue queue = gpu.get_device().getQueue();
+        queue->writeBuffer(*uniforms_buffer, 0, &uniforms, sizeof(Uniforms));
+    }
+
+    VirtualTexture(const VirtualTexture&) = delete;
+    VirtualTexture(VirtualTexture&&) = delete;
+
+    // Downscaled levels of `pixels` matching the tiled levels of an image of this size, slow for large images so
+    // loaders build it on their threads.
+    static Pyramid build_pyramid(const uint8_t* pixels, uint32_t width, uint32_t height) {
+        Pyramid pyramid;
+        uint32_t level_width = width;
+        uint32_t level_height = height;
+        while (std::max(level_width, level_height) > OVERVIEW_SIZE && pyramid.size() < MAX_LEVELS) {
+            const uint8_t* source = pyramid.empty() ? pixels : pyramid.back().data();
+            pyramid.push_back(downsample(source, level_width, level_height));
+            level_width = half(level_width);
+            level_height = half(level_height);
+        }
+        return pyramid;
+    }
+
+    // Full resolution pixels, owned by the caller and kept alive as long as tiles may be streamed. Resident tiles are
+    // dropped. `pyramid` is built here when not given.
+    void set_pixels(const uint8_t* new_pixels, Pyramid&& new_pyramid = {}) {
+        pixels = new_pixels;
+        pyramid = new_pyramid.size() == levels.size() ? std::move(new_pyramid) : build_pyramid(pixels, width, height);
+        std::fill(page_table.begin(), page_table.end(), 0);
+        page_table_dirty = true;
+        generation++;
+    }
+
+    bool has_pixels() const {
+        return pixels;
+    }
+
+    const uint8_t* overview_pixels() const {
+        return pyramid.empty() ? pixels : pyramid.back().data();
+    }
+
+    // Level sampled when the image is drawn `display_size` pixels large, `levels.size()` when the overview is enough.
+    // Same rounding as image_virtual.wgsl, so requested tiles are the sampled ones.
+    uint32_t level_for(const std::array<float, 2>& display_size) const {
+        if (display_size[0] == 0.0f || display_size[1] == 0.0f) return levels.size();
+        float texels_per_pixel = std::max(width / std::abs(display_size[0]), height / std::abs(display_size[1]));
+        float level = std::floor(std::log2(std::max(texels_per_pixel, 1.0f)) + 0.5f);
+        return std::min(static_cast<uint32_t>(level), static_cast<uint32_t>(levels.size()));
+    }
+
+    // 0 when not resident, atlas slot + 1 otherwise
+    uint32_t get_entry(const Tile& tile) const {
+        return page_table[entry_index(tile)];
+    }
+
+    void set_entry(const Tile& tile, uint32_t entry) {
+        page_table[entry_index(tile)] = entry;
+        page_table_dirty = true;
+    }
+
+    // Texels of `tile` with its border, SLOT_SIZE x SLOT_SIZE RGBA8, clamped at the level edges.
+    void copy_tile(const Tile& tile, std::vector<uint8_t>& texels) const {
+        const Level& level = levels[tile.level];
+        const uint8_t* source = tile.level == 0 ? pixels : pyramid[tile.level - 1].data();
+        texels.resize(static_cast<size_t>(SLOT_SIZE) * SLOT_SIZE * 4);
+
+        int64_t x0 = static_cast<int64_t>(tile.x) * TILE_SIZE - TILE_BORDER;
+        int64_t y0 = static_cast<int64_t>(tile.y) * TILE_SIZE - TILE_BORDER;
+        for (uint32_t y = 0; y < SLOT_SIZE; y++) {
+            int64_t source_y = std::clamp<int64_t>(y0 + y, 0, level.height - 1);
+            const uint8_t* row = source + static_cast<size_t>(source_y) * level.width * 4;
+            uint8_t* destination = texels.data() + static_cast<size_t>(y) * SLOT_SIZE * 4;
+            for (uint32_t x = 0; x < SLOT_SIZE; x++) {
+                int64_t source_x = std::clamp<int64_t>(x0 + x, 0, level.width - 1);
+                std::copy_n(row + source_x * 4, 4, destination + x * 4);
+            }
+        }
+    }
+
+    // Uploads the page table when entries changed since the last call, returns whether it did.
+    bool flush_page_table(const GPU& gpu) {
+        if (!page_table_dirty) return false;
+        write_texture(
+            gpu,
+            *page_table_texture,
+            page_table.data(),
+            4,
+            0,
+            0,
+            page_table_texture->getWidth(),
+            page_table_texture->getHeight()
+        );
+        page_table_dirty = false;
+        return true;
+    }
+
+    wgpu::TextureView get_page_table_view() const {
+        return *page_table_view;
+    }
+
+    wgpu::Buffer get_uniforms_buffer() const {
+        return *uniforms_buffer;
+    }
+
+    // pyramid and page table, the full resolution pixels belong to the owner
+    size_t cpu_bytes() const {
+        size_t bytes = page_table.size() * sizeof(uint32_t);
+        for (const std::vector<uint8_t>& level : pyramid) bytes += level.size();
+        return bytes;
+    }
+
+    size_t gpu_bytes() const {
+        return texture_bytes(*page_table_texture) + sizeof(Uniforms);
+    }
+
+  private:
+    const uint8_t* pixels = nullptr;
+    Pyramid pyramid;
+
+    uint32_t page_table_width = 1;
+    std::vector<uint32_t> page_table;
+    bool page_table_dirty = false;
+    wgpu::raii::Texture page_table_texture;
+    wgpu::raii::TextureView page_table_view;
+    wgpu::raii::Buffer uniforms_buffer;
+
+
+    static uint32_t half(uint32_t size) {
+        return std::max((size + 1) / 2, 1u);
+    }
+
+    // 2x2 box filter, the last column and row of odd sizes are averaged with themselves
+    static std::vector<uint8_t> downsample(const uint8_t* source, uint32_t width, uint32_t height) {
+        uint32_t half_width = half(width);
+        uint32_t half_height = half(height);
+        std::vector<uint8_t> result(static_cast<size_t>(half_width) * half_height * 4);
+        for (uint32_t y = 0; y < half_height; y++) {
+            const uint8_t* row0 = source + static_cast<size_t>(std::min(2 * y, height - 1)) * width * 4;
+            const uint8_t* row1 = source + static_cast<size_t>(std::min(2 * y + 1, height - 1)) * width * 4;
+            uint8_t* destination = result.data() + static_cast<size_t>(y) * half_width * 4;
+            for (uint32_t x = 0; x < half_width; x++) {
+                size_t left = static_cast<size_t>(std::min(2 * x, width - 1)) * 4;
+                size_t right = static_cast<size_t>(std::min(2 * x + 1, width - 1)) * 4;
+                for (size_t c = 0; c < 4; c++) {
+                    uint32_t sum = row0[left + c] + row0[right + c] + row1[left + c] + row1[right + c];
+                    destination[x * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+                }
+            }
+        }
+        return result;
+    }
+
+    size_t entry_index(const Tile& tile) const {
+        return static_cast<size_t>(levels[tile.level].first_row + tile.y) * page_table_width + tile.x;
+    }
+};
+
+
+// Atlas of resident tiles shared by every virtual texture, its ATLAS_SLOTS slots are the residency budget. Stages
+// request the tiles they sample every frame, `stream` then uploads the missing ones closest to the centre of their
+// region, a few per frame, over the least recently used tiles not requested this frame. Tiles that do not fit are
+// drawn from coarser levels meanwhile.
+struct TileCache {
+    static constexpr size_t UPLOADS_PER_FRAME = 16;
+
+    TileCache(const GPU& gpu) : gpu(gpu) {}
+
+    TileCache(const TileCache&) = delete;
+    TileCache(TileCache&&) = delete;
+
+    // Allocated with the first virtual texture, the 68 MB are not paid otherwise.
+    void create_atlas() {
+        if (atlas) return;
+        uint32_t size = VirtualTexture::ATLAS_SLOTS_PER_ROW * VirtualTexture::SLOT_SIZE;
+
+        wgpu::TextureDescriptor tex_desc;
+        tex_desc.size = {size, size, 1};
+        tex_desc.format = wgpu::TextureFormat::RGBA8Unorm;
+        tex_desc.usage = wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopyDst;
+        tex_desc.dimension = wgpu::TextureDimension::_2D;
+        tex_desc.mipLevelCount = 1;
+        tex_desc.sampleCount = 1;
+        tex_desc.viewFormatCount = 0;
+        tex_desc.viewFormats = nullptr;
+        atlas = gpu.get_device().createTexture(tex_desc);
+
+        wgpu::TextureViewDescriptor tex_view_desc = {};
+        tex_view_desc.format = wgpu::TextureFormat::RGBA8Unorm;
+        tex_view_desc.dimension = wgpu::TextureViewDimension::_2D;
+        tex_view_desc.mipLevelCount = 1;
+        tex_view_desc.baseMipLevel = 0;
+        tex_view_desc.arrayLayerCount = 1;
+        tex_view_desc.baseArrayLayer = 0;
+        tex_view_desc.aspect = wgpu::TextureAspect::All;
+        atlas_view = atlas->createView(tex_view_desc);
+
+        slots.resize(VirtualTexture::ATLAS_SLOTS);
+    }
+
+    wgpu::TextureView get_atlas_view() const {
+        return *atlas_view;
+    }
+
+    // Tiles of `texture` at `level` covering `region` (min u, min v, max u, max v), for this frame.
+    void request(const std::shared_ptr<VirtualTexture>& texture, uint32_t level, const std::array<float, 4>& region) {
+        if (!atlas || level >= texture->levels.size()) return;
+        const VirtualTexture::Level& l = texture->levels[level];
+        auto tile_range = [](float u, uint32_t size, uint32_t tiles) {
+            float tile = std::floor(u * size / VirtualTexture::TILE_SIZE);
+            return static_cast<uint32_t>(std::clamp(tile, 0.0f, static_cast<float>(tiles - 1)));
+        };
+        uint32_t x0 = tile_range(region[0], l.width, l.tiles_x);
+        uint32_t y0 = tile_range(region[1], l.height, l.tiles_y);
+        uint32_t x1 = tile_range(region[2], l.width, l.tiles_x);
+        uint32_t y1 = tile_range(region[3], l.height, l.tiles_y);
+        float centre_x = (x0 + x1) * 0.5f;
+        float centre_y = (y0 + y1) * 0.5f;
+
+        for (uint32_t y = y0; y <= y1; y++) {
+            for (uint32_t x = x0; x <= x1; x++) {
+                VirtualTexture::Tile tile = {level, x, y};
+                if (uint32_t entry = texture->get_entry(tile)) {
+                    slots[entry - 1].last_used = frame;
+                } else {
+                    missing.push_back({texture, tile, std::hypot(x - centre_x, y - centre_y)});
+                }
+            }
+        }
+    }
+
+    // Uploads missing tiles requested this frame and starts the next one. Page tables are updated on the CPU, their
+    // owners flush them.
+    void stream() {
+        std::sort(missing.begin(), missing.end(), [](const MissingTile& a, const MissingTile& b) {
+            return a.distance < b.distance;
+        });
+        size_t uploads = 0;
+        streamed = true;
+        for (MissingTile& tile : missing) {
+            if (tile.texture->get_entry(tile.tile)) continue;  // requested by several stages
+            if (uploads == UPLOADS_PER_FRAME) {
+                streamed = false;
+                break;
+            }
+            std::optional<uint32_t> slot = evict();
+            if (!slot) break;  // every slot holds a tile in view, coarser levels are all the budget allows
+
+            tile.texture->copy_tile(tile.tile, staging);
+            write_texture(
+                gpu,
+                *atlas,
+                staging.data(),
+                4,
+                slot.value() % VirtualTexture::ATLAS_SLOTS_PER_ROW * VirtualTexture::SLOT_SIZE,
+                slot.value() / VirtualTexture::ATLAS_SLOTS_PER_ROW * VirtualTexture::SLOT_SIZE,
+                VirtualTexture::SLOT_SIZE,
+                VirtualTexture::SLOT_SIZE
+            );
+            tile.texture->set_entry(tile.tile, slot.value() + 1);
+            slots[slot.value()] = {tile.texture, tile.texture->generation, tile.tile, frame};
+            uploads++;
+        }
+        missing.clear();
+        frame++;
+    }
+
+    // Whether the last `stream` uploaded every tile requested in its frame that fits the budget, false while some
+    // wait for the next frames.
+    bool is_streamed() const {
+        return streamed;
+    }
+
+    size_t gpu_bytes() const {
+        return atlas ? texture_bytes(*atlas) : 0;
+    }
+
+    size_t resident_count() const {
+        return std::count_if(slots.begin(), slots.end(), [](const Slot& slot) { return is_held(slot); });
+    }
+
+  private:
+    struct Slot {
+        std::weak_ptr<VirtualTexture> owner;
+        uint64_t generation = 0;  // of the owner when uploaded
+        VirtualTexture::Tile tile = {};
+        uint64_t last_used = 0;
+    };
+
+    struct MissingTile {
+        std::shared_ptr<VirtualTexture> texture;
+        VirtualTexture::Tile tile;
+        float distance;  // to the centre of the requested region, in tiles
+    };
+
+    const GPU& gpu;
+    wgpu::raii::Texture atlas;
+    wgpu::raii::TextureView atlas_view;
+    std::vector<Slot> slots;
+    std::vector<MissingTile> missing;
+    std::vector<uint8_t> staging;
+    uint64_t frame = 1;  // slots start unused at frame 0
+    bool streamed = true;
+
+
+    static bool is_held(const Slot& slot) {
+        std::shared_ptr<VirtualTexture> owner = slot.owner.lock();
+        return owner && owner->generation == slot.generation;
+    }
+
+    // A free slot, or else the least recently used one not requested this frame, its tile is unmapped.
+    std::optional<uint32_t> evict() {
+        std::optional<uint32_t> lru;
+        for (uint32_t i = 0; i < slots.size(); i++) {
+            if (!is_held(slots[i])) return i;
+            if (slots[i].last_used < frame && (!lru || slots[i].last_used < slots[lru.value()].last_used)) lru = i;
+        }
+        if (lru) slots[lru.value()].owner.lock()->set_entry(slots[lru.value()].tile, 0);
+        return lru;
+    }
+};
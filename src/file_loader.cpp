@@ -48,10 +48,50 @@ bool FileLoader::check() {
     return true;  // page should be frozen when dialog is open anyway
 }
 
+
+EM_JS(void, download_png, (const uint8_t* pixels, uint32_t width, uint32_t height, const char* name), {
+    const canvas = document.createElement('canvas');
+    canvas.width = width;
+    canvas.height = height;
+    const rgba = new Uint8ClampedArray(HEAPU8.subarray(pixels, pixels + width * height * 4));
+    canvas.getContext('2d').putImageData(new ImageData(rgba, width, height), 0, 0);
+    const file_name = UTF8ToString(name) + '.png';
+    canvas.toBlob((blob) => {
+        const link = document.createElement('a');
+        link.href = URL.createObjectURL(blob);
+        link.download = file_name;
+        link.click();
+        URL.revokeObjectURL(link.href);
+    });
+});
+
+bool save_image(const std::string& name, const uint8_t* pixels, uint32_t width, uint32_t height) {
+    download_png(pixels, width, height, name.c_str());  // pixels are copied before returning
+    return true;
+}
+
+
+EM_JS(void, download_text, (const char* text, const char* name), {
+    const link = document.createElement('a');
+    link.href = URL.createObjectURL(new Blob([UTF8ToString(text)], {type : 'text/plain'}));
+    link.download = UTF8ToString(name);
+    link.click();
+    URL.revokeObjectURL(link.href);
+});
+
+bool save_text(const std::string& file_name, const std::string& text) {
+    download_text(text.c_str(), file_name.c_str());
+    return true;
+}
+
 #else
 
+    #include <filesystem>
+    #include <fstream>
     #include <optional>
 
+    #include "src/pnm.hpp"
+
 bool FileLoader::check() {
     if (handle.has_value() && handle.value().ready()) {
         assert(handle_callback.has_value());
@@ -66,4 +106,23 @@ bool FileLoader::check() {
     return !handle.has_value();
 }
 
+
+bool save_image(const std::string& name, const uint8_t* pixels, uint32_t width, uint32_t height) {
+    std::filesystem::path path = name + ".ppm";
+    if (!write_pnm(path, pixels, width, height)) return false;
+    Log::info("Saved {}.", std::filesystem::absolute(path).string());
+    return true;
+}
+
+
+bool save_text(const std::string& file_name, const std::string& text) {
+    std::ofstream file(file_name, std::ios::binary);
+    if (!file || !file.write(text.data(), text.size())) {
+        Log::error("Could not write {}.", file_name);
+        return false;
+    }
+    Log::info("Saved {}.", std::filesystem::absolute(file_name).string());
+    return true;
+}
+
 #endif
@@ -33,6 +33,13 @@ struct FileLoader {
 };
 
 
+// Saves tightly packed RGBA8 pixels: downloaded as `name`.png on the web, written to `name`.ppm in the working
+// directory on native.
+bool save_image(const std::string& name, const uint8_t* pixels, uint32_t width, uint32_t height);
+// Saves `text`: downloaded as `file_name` on the web, written to `file_name` in the working directory on native.
+bool save_text(const std::string& file_name, const std::string& text);
+
+
 #ifdef __EMSCRIPTEN__
 extern "C" {
     void open_file_dialog (const char* accept, void* file_loader_ptr);
@@ -42,7 +49,7 @@ template <ResourceKind K, typename CB> requires std::is_convertible_v<CB, FileLo
 bool FileLoader::open_dialog(CB callback) {
     handle_callback = std::forward<CB>(callback);
     if constexpr (K == ResourceKind::Image) {
-        open_file_dialog(".png,.jpg,.jpeg,.bmp", this);
+        open_file_dialog(".png,.jpg,.jpeg,.bmp,.qoi,.ppm,.pam", this);  // raw RGBA needs its file name
     }
     return true;
 }
@@ -58,10 +65,20 @@ bool FileLoader::open_dialog(CB callback) {
     handle_callback = std::forward<CB>(callback);
 
     if constexpr (K == ResourceKind::Image) {
-        handle =
-            pfd::open_file("Select an Image File", ".", {"Image Files", "*.png *.jpg *.jpeg *.bmp"}, pfd::opt::multiselect);
-    // } else if constexpr (K == ResourceKind::Video) {
-    //     static_assert(false, "Not implemented yet.");
+        handle = pfd::open_file(
+            "Select an Image File",
+            ".",
+            {"Image Files", "*.png *.jpg *.jpeg *.bmp *.qoi *.ppm *.pam *.rgba"},
+            pfd::opt::multiselect
+        );
+    } else if constexpr (K == ResourceKind::Video) {
+        // picking a frame of an image sequence opens the whole directory
+        handle = pfd::open_file(
+            "Select a Video File",
+            ".",
+            {"Videos", "*.y4m", "Image Sequence Frames", "*.png *.jpg *.jpeg *.bmp *.qoi *.ppm *.pam *.rgba"},
+            pfd::opt::multiselect
+        );
     }
 
     return true;
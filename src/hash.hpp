@@ -0,0 +1,97 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <type_traits>
+
+
+// FNV-1a, cheap non-cryptographic hash used for version stamps.
+inline uint64_t fnv1a(std::span<const std::byte> bytes, uint64_t seed = 0xcbf29ce484222325ull) {
+    uint64_t hash = seed;
+    for (std::byte b : bytes) {
+        hash ^= static_cast<uint64_t>(b);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+template <typename T>
+    requires std::is_trivially_copyable_v<T>
+inline uint64_t fnv1a_value(const T& value, uint64_t seed = 0xcbf29ce484222325ull) {
+    return fnv1a(std::span<const std::byte>(std::as_bytes(std::span<const T, 1>(&value, 1))), seed);
+}
+
+
+namespace xxh64_detail {
+
+constexpr uint64_t PRIME1 = 0x9e3779b185ebca87ull;
+constexpr uint64_t PRIME2 = 0xc2b2ae3d27d4eb4full;
+constexpr uint64_t PRIME3 = 0x165667b19e3779f9ull;
+constexpr uint64_t PRIME4 = 0x85ebca77c2b2ae63ull;
+constexpr uint64_t PRIME5 = 0x27d4eb2f165667c5ull;
+
+inline uint64_t read_u64(const std::byte* bytes) {  // little endian hosts only, like every target
+    uint64_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+inline uint32_t read_u32(const std::byte* bytes) {
+    uint32_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+inline uint64_t round(uint64_t accumulator, uint64_t input) {
+    return std::rotl(accumulator + input * PRIME2, 31) * PRIME1;
+}
+
+inline uint64_t merge(uint64_t hash, uint64_t accumulator) {
+    return (hash ^ round(0, accumulator)) * PRIME1 + PRIME4;
+}
+
+}  // namespace xxh64_detail
+
+// XXH64, non-cryptographic hash reading 32 bytes per step: an order of magnitude faster than `fnv1a` on large inputs
+// such as file contents.
+inline uint64_t xxh64(std::span<const std::byte> bytes, uint64_t seed = 0) {
+    using namespace xxh64_detail;
+    const std::byte* p = bytes.data();
+    const std::byte* end = p + bytes.size();
+
+    uint64_t hash;
+    if (bytes.size() >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+        for (; end - p >= 32; p += 32) {
+            v1 = round(v1, read_u64(p));
+            v2 = round(v2, read_u64(p + 8));
+            v3 = round(v3, read_u64(p + 16));
+            v4 = round(v4, read_u64(p + 24));
+        }
+        hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+        hash = merge(merge(merge(merge(hash, v1), v2), v3), v4);
+    } else {
+        hash = seed + PRIME5;
+    }
+    hash += bytes.size();
+
+    for (; end - p >= 8; p += 8) hash = std::rotl(hash ^ round(0, read_u64(p)), 27) * PRIME1 + PRIME4;
+    if (end - p >= 4) {
+        hash = std::rotl(hash ^ read_u32(p) * PRIME1, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) hash = std::rotl(hash ^ static_cast<uint64_t>(*p) * PRIME5, 11) * PRIME1;
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -0,0 +1,242 @@
+#define WEBGPU_CPP_IMPLEMENTATION
+#include <webgpu/webgpu-raii.hpp>
+
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "context.hpp"
+#include "headless.hpp"
+#include "src/context/readback.hpp"
+#include "src/log.hpp"
+#include "src/pnm.hpp"
+#include "src/shader/cpu_renderer.hpp"
+#include "src/shader/manager.hpp"
+
+
+// Offscreen entry point: runs an effect chain without window, surface or UI and writes the result to a file.
+// Stages are applied in argument order, `--image` adds an Image stage drawing the given file, `--video` one playing a
+// Y4M file or image sequence and `--chain` appends the stages of a saved chain. `batch` runs the chain over a whole
+// directory instead, see batch.cpp, `video` renders it over time into a video stream, see video.cpp, and `check` tests
+// and times canonical chains, see check.cpp. Without a usable GPU, or with `--cpu`, the chain is rendered by the CPU
+// renderer instead (see cpu_renderer.hpp).
+
+
+static void usage(const char* program) {
+    Log::log(
+        "usage: {0} [--fallback | --cpu] [--size WIDTHxHEIGHT] [--stage KIND | --image PATH | --video PATH |\n"
+        "         --chain FILE]... [--save-chain FILE] --output PATH(.ppm|.pam)\n"
+        "       {0} batch ...\n"
+        "       {0} video ...\n"
+        "       {0} check ...\n"
+        "  --fallback    force the software fallback adapter\n"
+        "  --cpu         render on the CPU, without any GPU (no --video stages)\n"
+        "  --save-chain  save the non image stages as a chain file\n"
+        "  KIND          one of ChromaticAbberation, Noise, Dithering",
+        program
+    );
+}
+
+
+std::optional<std::array<unsigned int, 2>> parse_size(std::string_view value) {
+    size_t x = value.find('x');
+    if (x == std::string_view::npos) return std::nullopt;
+    std::array<unsigned int, 2> size;
+    auto [width_end, width_error] = std::from_chars(value.data(), value.data() + x, size[0]);
+    auto [height_end, height_error] = std::from_chars(value.data() + x + 1, value.data() + value.size(), size[1]);
+    if (width_error != std::errc() || height_error != std::errc()) return std::nullopt;
+    return size;
+}
+
+
+bool add_stage(Context& ctx, ShaderManager& shader_manager, std::string_view option, std::string_view value) {
+    if (option == "--image") {
+        std::filesystem::path path = value;
+        size_t id = ctx.resource_manager.add_image(path.stem(), path);
+        if (!ctx.resource_manager.get_image(id).is_loaded()) return false;
+        shader_manager.add_shader<Shader<ShaderKind::Image>>(path.stem(), id, ctx);
+        return true;
+    }
+    if (option == "--video") {
+        std::filesystem::path path = value;
+        std::optional<size_t> id = ctx.resource_manager.add_video(path.stem(), path);
+        if (!id) return false;
+        shader_manager.add_shader<Shader<ShaderKind::Image>>(path.stem(), id.value(), ctx);
+        return true;
+    }
+    if (option == "--chain") {
+        std::ifstream chain_file{std::filesystem::path(value)};
+        if (!chain_file || !shader_manager.load_chain(chain_file)) {
+            Log::error("Could not load chain {}.", value);
+            return false;
+        }
+        return true;
+    }
+    std::optional<ShaderKind> kind = shader_kind_from_name(value);
+    if (!kind || !shader_manager.add_default_shader(kind.value())) {
+        Log::error("Unknown stage kind {}.", value);
+        return false;
+    }
+    return true;
+}
+
+
+bool add_cpu_stage(std::vector<CpuStage>& stages, std::string_view option, std::string_view value) {
+    if (option == "--image") {
+        ImageData image = load_image(std::filesystem::path(value));
+        if (!image.ptr) {
+            Log::error("Could not load image {}.", value);
+            return false;
+        }
+        stages.push_back(image_cpu_stage(std::move(image)));
+        return true;
+    }
+    if (option == "--video") {
+        Log::error("Video stages need the GPU renderer.");
+        return false;
+    }
+    if (option == "--chain") {
+        std::ifstream chain_file{std::filesystem::path(value)};
+        if (!chain_file || !load_cpu_chain(chain_file, stages)) {
+            Log::error("Could not load chain {}.", value);
+            return false;
+        }
+        return true;
+    }
+    std::optional<ShaderKind> kind = shader_kind_from_name(value);
+    std::optional<CpuStage> stage = kind ? default_cpu_stage(kind.value()) : std::nullopt;
+    if (!stage) {
+        Log::error("Unknown stage kind {}.", value);
+        return false;
+    }
+    stages.push_back(std::move(stage.value()));
+    return true;
+}
+
+
+using StageOptions = std::vector<std::pair<std::string_view, std::string_view>>;  // (option, value)
+
+static int render_on_gpu(
+    Context& ctx, std::array<unsigned int, 2> size, const StageOptions& stages, const std::filesystem::path& output,
+    const std::filesystem::path& saved_chain
+) {
+    ctx.render_target.dim = size;
+
+    ShaderManager shader_manager(ctx);
+
+    for (auto [option, value] : stages) {
+        if (!add_stage(ctx, shader_manager, option, value)) return 1;
+    }
+
+    if (!saved_chain.empty()) {
+        std::ofstream chain_file(saved_chain);
+        shader_manager.save_chain(chain_file);
+    }
+
+    // pipelines compile in the background, a render before they are done would output placeholders
+    while (shader_manager.is_compiling()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    auto start = std::chrono::high_resolution_clock::now();
+    shader_manager.render_chain_streamed();
+    std::vector<uint8_t> pixels =
+        read_texture_blocking(ctx.gpu, shader_manager.get_result_texture(), size[0], size[1]);
+    float elapsed = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    if (pixels.empty()) return 1;
+
+    Log::info("Rendered {} stages at {}x{} in {:.2f} ms.", stages.size(), size[0], size[1], elapsed);
+
+    if (!write_pnm(output, pixels.data(), size[0], size[1])) return 1;
+
+    ctx.gpu.get_device().poll(true, nullptr);  // make sure every command terminates before quitting
+    return 0;
+}
+
+
+static int render_on_cpu(
+    std::array<unsigned int, 2> size, const StageOptions& stage_options, const std::filesystem::path& output,
+    const std::filesystem::path& saved_chain
+) {
+    std::vector<CpuStage> stages;
+    for (auto [option, value] : stage_options) {
+        if (!add_cpu_stage(stages, option, value)) return 1;
+    }
+
+    if (!saved_chain.empty()) {
+        std::ofstream chain_file(saved_chain);
+        save_cpu_chain(chain_file, stages);
+    }
+
+    CpuRenderer renderer;
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<uint8_t> pixels = renderer.render(stages, size);
+    float elapsed = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    if (pixels.empty()) return 1;
+
+    Log::info(
+        "Rendered {} stages at {}x{} in {:.2f} ms on {} CPU threads.",
+        stages.size(),
+        size[0],
+        size[1],
+        elapsed,
+        renderer.get_thread_count()
+    );
+
+    return write_pnm(output, pixels.data(), size[0], size[1]) ? 0 : 1;
+}
+
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string_view(argv[1]) == "batch") return run_batch(argc - 1, argv + 1);
+    if (argc > 1 && std::string_view(argv[1]) == "video") return run_video(argc - 1, argv + 1);
+    if (argc > 1 && std::string_view(argv[1]) == "check") return run_check(argc - 1, argv + 1);
+
+    GPUOptions gpu_options;
+    bool cpu = false;
+    std::array<unsigned int, 2> size = {1920, 1080};
+    StageOptions stages;
+    std::filesystem::path output;
+    std::filesystem::path saved_chain;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--fallback") {
+            gpu_options.force_fallback_adapter = true;
+        } else if (arg == "--cpu") {
+            cpu = true;
+        } else if (arg == "--size" && has_value) {
+            std::optional<std::array<unsigned int, 2>> parsed = parse_size(argv[++i]);
+            if (!parsed) {
+                usage(argv[0]);
+                return 1;
+            }
+            size = parsed.value();
+        } else if ((arg == "--stage" || arg == "--image" || arg == "--video" || arg == "--chain") && has_value) {
+            stages.emplace_back(arg, argv[++i]);
+        } else if (arg == "--save-chain" && has_value) {
+            saved_chain = argv[++i];
+        } else if (arg == "--output" && has_value) {
+            output = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (output.empty() || size[0] == 0 || size[1] == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!cpu) {
+        Context ctx(gpu_options);
+        if (ctx.gpu.is_initialized()) return render_on_gpu(ctx, size, stages, output, saved_chain);
+        Log::warn("No usable GPU, rendering on the CPU.");
+    }
+    return render_on_cpu(size, stages, output, saved_chain);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "context.hpp"
+#include "src/shader/cpu_renderer.hpp"
+#include "src/shader/manager.hpp"
+
+// Entry points of `moshading-headless`, see headless.cpp.
+
+// `WIDTHxHEIGHT`, nothing if malformed.
+std::optional<std::array<unsigned int, 2>> parse_size(std::string_view value);
+
+// Adds the stages described by one chain option: `--stage KIND`, `--image PATH`, `--video PATH` or
+// `--chain FILE`.
+bool add_stage(Context& ctx, ShaderManager& shader_manager, std::string_view option, std::string_view value);
+// The same for the CPU renderer, which has no `--video` stages.
+bool add_cpu_stage(std::vector<CpuStage>& stages, std::string_view option, std::string_view value);
+
+// `moshading-headless batch ...`: applies a saved chain to every image of a directory, see batch.cpp.
+int run_batch(int argc, char** argv);
+
+// `moshading-headless video ...`: renders a chain at a fixed time step into a Y4M or raw stream, see video.cpp.
+int run_video(int argc, char** argv);
+
+// `moshading-headless check ...`: compares canonical chains to golden images and times their stages, see check.cpp.
+int run_check(int argc, char** argv);
@@ -19,12 +19,17 @@
 
 #include "renderer.hpp"
 #include "context.hpp"
+#include "log.hpp"
+#include "profiler.hpp"
 
 int main() {
-
+    PROFILE_THREAD_NAME("main");
 
     Context ctx;
     if (!ctx.gpu.is_initialized()) {
+#ifndef __EMSCRIPTEN__
+        Log::error("No usable GPU, `moshading-headless --cpu` renders chains without one.");
+#endif
         return 1;
     }
 
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "src/log.hpp"
+
+
+// Writes tightly packed RGBA8 pixels as binary PAM (`.pam`, alpha kept) or PPM (anything else, alpha dropped).
+inline bool write_pnm(const std::filesystem::path& path, const uint8_t* pixels, uint32_t width, uint32_t height) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        Log::error("Could not open {} for writing.", path.string());
+        return false;
+    }
+
+    if (path.extension() == ".pam") {
+        file << "P7\nWIDTH " << width << "\nHEIGHT " << height << "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+        file.write(reinterpret_cast<const char*>(pixels), static_cast<std::streamsize>(width) * height * 4);
+    } else {
+        file << "P6\n" << width << " " << height << "\n255\n";
+        std::string row(width * 3, '\0');
+        for (size_t y = 0; y < height; y++) {
+            const uint8_t* src = pixels + y * width * 4;
+            for (size_t x = 0; x < width; x++) {
+                row[3 * x] = src[4 * x];
+                row[3 * x + 1] = src[4 * x + 1];
+                row[3 * x + 2] = src[4 * x + 2];
+            }
+            file.write(row.data(), row.size());
+        }
+    }
+
+    if (!file) {
+        Log::error("Failed writing {}.", path.string());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+// Scoped CPU zones for attributing frame spikes, exported as Chrome trace JSON (chrome://tracing or Perfetto).
+// `PROFILE_ZONE("name")` records the enclosing scope and `PROFILE_THREAD_NAME("name")` labels the calling thread when
+// built with MOSHADING_PROFILER (meson option `profiler`), both expand to nothing otherwise so no thread buffer is
+// allocated. Names must be string literals, only their address is stored.
+#ifdef MOSHADING_PROFILER
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) const Profiler::Zone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_THREAD_NAME(name) Profiler::set_thread_name(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_THREAD_NAME(name) ((void)0)
+#endif
+
+
+namespace Profiler {
+    // zones kept per thread, about 25 s of the main loop at 100 fps
+    constexpr size_t RING_SIZE = 1 << 16;
+
+    struct Event {
+        std::atomic<const char*> name;
+        std::atomic<uint64_t> begin;  // ns since the profiler epoch
+        std::atomic<uint64_t> end;
+    };
+
+    // Ring of the zones closed by one thread. Only that thread writes, without locks: a slot is claimed, written, then
+    // published. Readers copy published slots and drop those claimed again meanwhile (seqlock like).
+    struct ThreadBuffer {
+        uint32_t thread_id;
+        std::atomic<const char*> thread_name = nullptr;
+        std::atomic<bool> in_use = true;      // cleared on thread exit, the buffer is then reused by a new thread
+        std::atomic<uint64_t> claimed = 0;    // events ever started
+        std::atomic<uint64_t> published = 0;  // events ever completed
+        std::unique_ptr<Event[]> events = std::make_unique<Event[]>(RING_SIZE);
+    };
+
+    struct Registry {
+        std::mutex mutex;  // guards `buffers`, taken once per thread and by readers
+        std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+        const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    };
+
+    inline Registry& registry() {
+        static Registry registry;
+        return registry;
+    }
+
+    inline uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - registry().epoch)
+            .count();
+    }
+
+    // Buffer of the calling thread, taken on its first zone.
+    inline ThreadBuffer& thread_buffer() {
+        struct Owner {
+            ThreadBuffer* buffer;
+            ~Owner() {
+                buffer->in_use.store(false, std::memory_order_release);
+            }
+        };
+        thread_local Owner owner{[] {
+            Registry& r = registry();
+            std::lock_guard lock(r.mutex);
+            for (std::unique_ptr<ThreadBuffer>& buffer : r.buffers) {
+                bool free = false;
+                if (buffer->in_use.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+                    buffer->thread_name.store(nullptr, std::memory_order_relaxed);
+                    return buffer.get();
+                }
+            }
+            r.buffers.push_back(std::make_unique<ThreadBuffer>());
+            r.buffers.back()->thread_id = static_cast<uint32_t>(r.buffers.size());
+            return r.buffers.back().get();
+        }()};
+        return *owner.buffer;
+    }
+
+    inline void set_thread_name(const char* name) {
+        thread_buffer().thread_name.store(name, std::memory_order_relaxed);
+    }
+
+    inline void record(const char* name, uint64_t begin, uint64_t end) {
+        ThreadBuffer& buffer = thread_buffer();
+        uint64_t index = buffer.published.load(std::memory_order_relaxed);
+        buffer.claimed.store(index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);  // the claim is seen before any of the writes below
+
+        Event& event = buffer.events[index % RING_SIZE];
+        event.name.store(name, std::memory_order_relaxed);
+        event.begin.store(begin, std::memory_order_relaxed);
+        event.end.store(end, std::memory_order_relaxed);
+        buffer.published.store(index + 1, std::memory_order_release);
+    }
+
+    struct Zone {
+        const char* name;
+        uint64_t begin;
+
+        explicit Zone(const char* name) : name(name), begin(now_ns()) {}
+        ~Zone() {
+            record(name, begin, now_ns());
+        }
+
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+    };
+
+    // Writes the zones closed during the last `seconds` by every thread, returns how many were written. Safe to call
+    // while other threads record.
+    inline size_t write_chrome_trace(std::ostream& out, double seconds) {
+        uint64_t now = now_ns();
+        uint64_t since = now - std::min<uint64_t>(now, static_cast<uint64_t>(seconds * 1e9));
+
+        struct Copy {
+            const char* name;
+            uint64_t begin;
+            uint64_t end;
+        };
+        std::vector<Copy> copies;
+        size_t count = 0;
+
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        Registry& r = registry();
+        std::lock_guard lock(r.mutex);
+        for (const std::unique_ptr<ThreadBuffer>& buffer : r.buffers) {
+            uint64_t published = buffer->published.load(std::memory_order_acquire);
+            uint64_t first = published - std::min<uint64_t>(published, RING_SIZE);
+            copies.clear();
+            for (uint64_t i = first; i < published; i++) {
+                const Event& event = buffer->events[i % RING_SIZE];
+                copies.push_back({
+                    event.name.load(std::memory_order_relaxed),
+                    event.begin.load(std::memory_order_relaxed),
+                    event.end.load(std::memory_order_relaxed),
+                });
+            }
+            // slots of events claimed since the copy started may hold a mix of old and new fields
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t claimed = buffer->claimed.load(std::memory_order_relaxed);
+            size_t skipped = static_cast<size_t>(
+                std::min<uint64_t>(claimed > first + RING_SIZE ? claimed - first - RING_SIZE : 0, copies.size())
+            );
+
+            const char* thread_name = buffer->thread_name.load(std::memory_order_relaxed);
+            out << std::format(
+                "{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+                buffer.get() == r.buffers.front().get() ? "" : ",",
+                buffer->thread_id,
+                thread_name ? std::string(thread_name) : std::format("thread {}", buffer->thread_id)
+            );
+            for (size_t i = skipped; i < copies.size(); i++) {
+                const Copy& copy = copies[i];
+                if (copy.end < since) continue;
+                out << std::format(
+                    ",{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                    copy.name,
+                    buffer->thread_id,
+                    copy.begin * 1e-3,  // ns to us
+                    (copy.end - copy.begin) * 1e-3
+                );
+                count++;
+            }
+        }
+        out << "]}\n";
+        return count;
+    }
+}  // namespace Profiler
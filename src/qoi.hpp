@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+
+// QOI ("Quite OK Image", https://qoiformat.org) lossless RGBA8 codec: a few times smaller than raw pixels on most
+// images and encoded or decoded at memory speed, cheaper to keep around than PNG.
+struct QoiImage {
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> pixels;  // RGBA8
+};
+
+namespace qoi_detail {
+
+constexpr uint8_t OP_INDEX = 0x00;
+constexpr uint8_t OP_DIFF = 0x40;
+constexpr uint8_t OP_LUMA = 0x80;
+constexpr uint8_t OP_RUN = 0xc0;
+constexpr uint8_t OP_RGB = 0xfe;
+constexpr uint8_t OP_RGBA = 0xff;
+constexpr uint8_t MASK = 0xc0;
+constexpr size_t HEADER_SIZE = 14;
+constexpr uint8_t END_MARKER[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+constexpr uint64_t MAX_PIXELS = 400'000'000;  // limit of the reference implementation
+
+struct Pixel {
+    uint8_t r, g, b, a;
+
+    bool operator==(const Pixel&) const = default;
+
+    size_t hash() const {
+        return (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+    }
+};
+
+inline void write_u32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<uint8_t>(value >> shift));
+}
+
+inline uint32_t read_u32(const uint8_t* bytes) {
+    return uint32_t(bytes[0]) << 24 | uint32_t(bytes[1]) << 16 | uint32_t(bytes[2]) << 8 | bytes[3];
+}
+
+}  // namespace qoi_detail
+
+
+inline std::vector<uint8_t> qoi_encode(const uint8_t* rgba, uint32_t width, uint32_t height) {
+    using namespace qoi_detail;
+    size_t pixel_count = static_cast<size_t>(width) * height;
+
+    std::vector<uint8_t> out;
+    out.reserve(HEADER_SIZE + pixel_count + sizeof(END_MARKER));  // grows past it only on noisy images
+    out.insert(out.end(), {'q', 'o', 'i', 'f'});
+    write_u32(out, width);
+    write_u32(out, height);
+    out.push_back(4);  // channels
+    out.push_back(0);  // sRGB with linear alpha
+
+    Pixel index[64] = {};
+    Pixel previous = {0, 0, 0, 255};
+    uint8_t run = 0;
+    for (size_t i = 0; i < pixel_count; i++) {
+        Pixel pixel = {rgba[i * 4], rgba[i * 4 + 1], rgba[i * 4 + 2], rgba[i * 4 + 3]};
+        if (pixel == previous) {
+            run++;
+            if (run == 62 || i + 1 == pixel_count) {
+                out.push_back(OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out.push_back(OP_RUN | (run - 1));
+            run = 0;
+        }
+
+        size_t hash = pixel.hash();
+        if (index[hash] == pixel) {
+            out.push_back(OP_INDEX | static_cast<uint8_t>(hash));
+        } else {
+            index[hash] = pixel;
+            if (pixel.a == previous.a) {
+                int8_t vr = static_cast<int8_t>(pixel.r - previous.r);
+                int8_t vg = static_cast<int8_t>(pixel.g - previous.g);
+                int8_t vb = static_cast<int8_t>(pixel.b - previous.b);
+                int8_t vg_r = static_cast<int8_t>(vr - vg);
+                int8_t vg_b = static_cast<int8_t>(vb - vg);
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                    out.push_back(OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                    out.push_back(OP_LUMA | (vg + 32));
+                    out.push_back((vg_r + 8) << 4 | (vg_b + 8));
+                } else {
+                    out.insert(out.end(), {OP_RGB, pixel.r, pixel.g, pixel.b});
+                }
+            } else {
+                out.insert(out.end(), {OP_RGBA, pixel.r, pixel.g, pixel.b, pixel.a});
+            }
+        }
+        previous = pixel;
+    }
+
+    out.insert(out.end(), std::begin(END_MARKER), std::end(END_MARKER));
+    return out;
+}
+
+
+// Nothing when `bytes` is not a valid QOI stream. 3 channel images are decoded with an opaque alpha.
+inline std::optional<QoiImage> qoi_decode(const uint8_t* bytes, size_t size) {
+    using namespace qoi_detail;
+    if (size < HEADER_SIZE + sizeof(END_MARKER) || std::memcmp(bytes, "qoif", 4) != 0) return std::nullopt;
+
+    QoiImage image = {read_u32(bytes + 4), read_u32(bytes + 8), {}};
+    uint8_t channels = bytes[12];
+    uint8_t colorspace = bytes[13];
+    uint64_t pixel_count = static_cast<uint64_t>(image.width) * image.height;
+    if (pixel_count == 0 || pixel_count > MAX_PIXELS || (channels != 3 && channels != 4) || colorspace > 1) {
+        return std::nullopt;
+    }
+    image.pixels.resize(pixel_count * 4);
+
+    Pixel index[64] = {};
+    Pixel pixel = {0, 0, 0, 255};
+    uint8_t run = 0;
+    size_t p = HEADER_SIZE;
+    size_t chunks_end = size - sizeof(END_MARKER);
+    for (uint64_t i = 0; i < pixel_count; i++) {
+        if (run > 0) {
+            run--;
+        } else if (p < chunks_end) {
+            uint8_t b1 = bytes[p++];
+            if (b1 == OP_RGB) {
+                if (p + 3 > chunks_end) return std::nullopt;
+                pixel.r = bytes[p++];
+                pixel.g = bytes[p++];
+                pixel.b = bytes[p++];
+            } else if (b1 == OP_RGBA) {
+                if (p + 4 > chunks_end) return std::nullopt;
+                pixel = {bytes[p], bytes[p + 1], bytes[p + 2], bytes[p + 3]};
+                p += 4;
+            } else if ((b1 & MASK) == OP_INDEX) {
+                pixel = index[b1];
+            } else if ((b1 & MASK) == OP_DIFF) {
+                pixel.r += ((b1 >> 4) & 0x03) - 2;
+                pixel.g += ((b1 >> 2) & 0x03) - 2;
+                pixel.b += (b1 & 0x03) - 2;
+            } else if ((b1 & MASK) == OP_LUMA) {
+                if (p + 1 > chunks_end) return std::nullopt;
+                uint8_t b2 = bytes[p++];
+                int vg = (b1 & 0x3f) - 32;
+                pixel.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                pixel.g += vg;
+                pixel.b += vg - 8 + (b2 & 0x0f);
+            } else {
+                run = b1 & 0x3f;
+            }
+            index[pixel.hash()] = pixel;
+        } else {
+            return std::nullopt;  // truncated
+        }
+        std::memcpy(image.pixels.data() + i * 4, &pixel, 4);
+    }
+    return image;
+}
@@ -6,12 +6,18 @@
 #include <backends/imgui_impl_wgpu.h>
 
 #include <chrono>
+#include <format>
+#include <sstream>
 #include <thread>
 #include <webgpu/webgpu-raii.hpp>
 
 #include "icons.hpp"
+#include "src/file_loader.hpp"
+#include "src/log.hpp"
+#include "src/profiler.hpp"
 
 void Renderer::fps_limiter(int target_fps) {
+    PROFILE_ZONE("fps_limiter sleep");
     using clock = std::chrono::steady_clock;
     static auto next_frame_time = clock::now();
     auto frame_duration = std::chrono::duration<double>(1.0 / target_fps);
@@ -49,9 +55,22 @@ void Renderer::terminate() {
 }
 
 void Renderer::display_app() {
+#ifdef MOSHADING_PROFILER
+    if (ImGui::IsKeyPressed(ImGuiKey_F9, false)) dump_trace();
+#endif
+    PROFILE_ZONE("App::display");
     this->app.display();
 }
 
+
+void Renderer::dump_trace() {
+    static size_t trace_count = 0;
+    std::ostringstream trace;
+    size_t zones = Profiler::write_chrome_trace(trace, TRACE_SECONDS);
+    Log::info("Dumping {} zones of the last {} s.", zones, TRACE_SECONDS);
+    save_text(std::format("moshading_trace_{}.json", trace_count++), trace.str());
+}
+
 void Renderer::set_style() {
     ImGui::GetStyle().ScaleAllSizes(1.5);
 
@@ -33,4 +33,8 @@ struct Renderer {
 
     // utils
     void static fps_limiter(int target_fps);
+
+    // F9 saves the profiler zones of the last `TRACE_SECONDS` as a Chrome trace, see src/profiler.hpp
+    static constexpr double TRACE_SECONDS = 10.0;
+    void static dump_trace();
 };
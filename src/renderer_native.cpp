@@ -15,6 +15,7 @@
 
 #include "renderer.hpp"
 #include "src/log.hpp"
+#include "src/profiler.hpp"
 
 
 
@@ -154,7 +155,11 @@ bool Renderer::init() {
 
 
 void Renderer::main_loop() {
-    glfwPollEvents();
+    PROFILE_ZONE("frame");
+    {
+        PROFILE_ZONE("poll events");
+        glfwPollEvents();
+    }
     if (glfwGetWindowAttrib(window, GLFW_ICONIFIED) || !glfwGetWindowAttrib(window, GLFW_VISIBLE)) {
         // TODO find out why this never triggers
         ImGui_ImplGlfw_Sleep(10);
@@ -168,24 +173,33 @@ void Renderer::main_loop() {
         return;
     }
 
-    ImGui_ImplWGPU_NewFrame();
-    ImGui_ImplGlfw_NewFrame();
-    ImGui::NewFrame();
+    {
+        PROFILE_ZONE("imgui build");
+        ImGui_ImplWGPU_NewFrame();
+        ImGui_ImplGlfw_NewFrame();
+        ImGui::NewFrame();
 
-    display_app();
+        display_app();
 
-    // Rendering
-    ImGui::Render();
+        // Rendering
+        ImGui::Render();
+    }
 
+    {
+        PROFILE_ZONE("device poll");
 #ifdef IMGUI_IMPL_WEBGPU_BACKEND_DAWN
-    ctx.gpu.get_device().tick();
+        ctx.gpu.get_device().tick();
 #elifdef IMGUI_IMPL_WEBGPU_BACKEND_WGPU
-    ctx.gpu.get_device().poll(false, nullptr);
+        ctx.gpu.get_device().poll(false, nullptr);
 #endif
+    }
 
 
     wgpu::SurfaceTexture surface_texture;
-    surface->getCurrentTexture(&surface_texture);
+    {
+        PROFILE_ZONE("acquire surface texture");
+        surface->getCurrentTexture(&surface_texture);
+    }
 
     if (!surface_texture.texture) {
         Log::warn("Surface texture is null — skipping frame");
@@ -211,20 +225,29 @@ void Renderer::main_loop() {
     render_pass_desc.colorAttachments = &color_attachments;
     render_pass_desc.depthStencilAttachment = nullptr;
 
-    wgpu::CommandEncoderDescriptor enc_desc = {};
-    wgpu::raii::CommandEncoder encoder = ctx.gpu.get_device().createCommandEncoder(enc_desc);
+    wgpu::raii::CommandBuffer cmd_buffer;
+    {
+        PROFILE_ZONE("encode ui");
+        wgpu::CommandEncoderDescriptor enc_desc = {};
+        wgpu::raii::CommandEncoder encoder = ctx.gpu.get_device().createCommandEncoder(enc_desc);
 
-    wgpu::raii::RenderPassEncoder pass = encoder->beginRenderPass(render_pass_desc);
+        wgpu::raii::RenderPassEncoder pass = encoder->beginRenderPass(render_pass_desc);
 
-    ImGui_ImplWGPU_RenderDrawData(ImGui::GetDrawData(), *pass);
-    pass->end();
+        ImGui_ImplWGPU_RenderDrawData(ImGui::GetDrawData(), *pass);
+        pass->end();
 
-    wgpu::CommandBufferDescriptor cmd_buffer_desc = {};
-    wgpu::raii::CommandBuffer cmd_buffer = encoder->finish(cmd_buffer_desc);
-    wgpu::raii::Queue queue = ctx.gpu.get_device().getQueue();
-    queue->submit(1, &(*cmd_buffer));
-
-    surface->present();
+        wgpu::CommandBufferDescriptor cmd_buffer_desc = {};
+        cmd_buffer = encoder->finish(cmd_buffer_desc);
+    }
+    {
+        PROFILE_ZONE("submit ui");
+        wgpu::raii::Queue queue = ctx.gpu.get_device().getQueue();
+        queue->submit(1, &(*cmd_buffer));
+    }
+    {
+        PROFILE_ZONE("present");
+        surface->present();
+    }
 
     fps_limiter(100);
 }
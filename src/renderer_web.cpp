@@ -9,6 +9,7 @@
 #include <emscripten/html5_webgpu.h>
 
 #include "renderer.hpp"
+#include "src/profiler.hpp"
 #include "src/log.hpp"
 
 
@@ -116,24 +117,34 @@ bool Renderer::init() {
 
 
 void Renderer::main_loop() {
-    glfwPollEvents();
+    PROFILE_ZONE("frame");
+    {
+        PROFILE_ZONE("poll events");
+        glfwPollEvents();
+    }
     if (glfwGetWindowAttrib(window, GLFW_ICONIFIED) != 0) {
         ImGui_ImplGlfw_Sleep(10);
         return;
     }
 
-    // Start the Dear ImGui frame
-    ImGui_ImplWGPU_NewFrame();
-    ImGui_ImplGlfw_NewFrame();
-    ImGui::NewFrame();
+    {
+        PROFILE_ZONE("imgui build");
+        // Start the Dear ImGui frame
+        ImGui_ImplWGPU_NewFrame();
+        ImGui_ImplGlfw_NewFrame();
+        ImGui::NewFrame();
 
-    display_app();
+        display_app();
 
-    // // Rendering
-    ImGui::Render();
+        // // Rendering
+        ImGui::Render();
+    }
 
     wgpu::SurfaceTexture surface_texture;
-    surface->getCurrentTexture(&surface_texture);
+    {
+        PROFILE_ZONE("acquire surface texture");
+        surface->getCurrentTexture(&surface_texture);
+    }
 
     wgpu::raii::TextureView texture_view(wgpuTextureCreateView(surface_texture.texture, nullptr));
 
@@ -149,17 +160,24 @@ void Renderer::main_loop() {
     render_pass_desc.colorAttachments = &color_attachments;
     render_pass_desc.depthStencilAttachment = nullptr;
 
-    wgpu::CommandEncoderDescriptor enc_desc = {};
-    wgpu::raii::CommandEncoder encoder = ctx.gpu.get_device().createCommandEncoder(enc_desc);
+    wgpu::raii::CommandBuffer cmd_buffer;
+    {
+        PROFILE_ZONE("encode ui");
+        wgpu::CommandEncoderDescriptor enc_desc = {};
+        wgpu::raii::CommandEncoder encoder = ctx.gpu.get_device().createCommandEncoder(enc_desc);
 
-    wgpu::raii::RenderPassEncoder pass = encoder->beginRenderPass(render_pass_desc);
-    ImGui_ImplWGPU_RenderDrawData(ImGui::GetDrawData(), *pass);
-    wgpuRenderPassEncoderEnd(*pass);
+        wgpu::raii::RenderPassEncoder pass = encoder->beginRenderPass(render_pass_desc);
+        ImGui_ImplWGPU_RenderDrawData(ImGui::GetDrawData(), *pass);
+        wgpuRenderPassEncoderEnd(*pass);
 
-    wgpu::CommandBufferDescriptor cmd_buffer_desc = {};
-    wgpu::raii::CommandBuffer cmd_buffer = encoder->finish(cmd_buffer_desc);
-    wgpu::raii::Queue queue = ctx.gpu.get_device().getQueue();
-    queue->submit(1, &(*cmd_buffer));
+        wgpu::CommandBufferDescriptor cmd_buffer_desc = {};
+        cmd_buffer = encoder->finish(cmd_buffer_desc);
+    }
+    {
+        PROFILE_ZONE("submit ui");
+        wgpu::raii::Queue queue = ctx.gpu.get_device().getQueue();
+        queue->submit(1, &(*cmd_buffer));
+    }
 
     fps_limiter(100);
 }
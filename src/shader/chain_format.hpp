@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <format>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "shader.hpp"
+#include "shaders/chromatic_aberration.hpp"
+#include "shaders/dithering.hpp"
+#include "shaders/image.hpp"
+#include "shaders/noise.hpp"
+#include "src/log.hpp"
+
+
+// Text format of saved chains: a `moshading-chain <version>` line, then one line per stage, its kind followed by
+// `name=value` pairs of its `UNIFORM_FIELDS` (comma separated values for vectors), e.g.
+//   Noise colored_min=-0.1,-0.1,-0.1 min=-0.1 colored_max=0.1,0.1,0.1 max=0.1 control=3 seed=7
+// Parameters left out keep their default and unknown ones are skipped, so chains survive changes of the uniforms.
+// Lines starting with `#` are comments. Version 1 chains, without the version line, stored a hex dump of the uniforms
+// and are still read.
+constexpr std::string_view CHAIN_MAGIC = "moshading-chain";
+constexpr int CHAIN_VERSION = 2;
+
+
+template <ShaderKind K>
+std::span<const UniformField> uniform_fields() {
+    return {Shader<K>::UNIFORM_FIELDS, sizeof(Shader<K>::UNIFORM_FIELDS) / sizeof(UniformField)};
+}
+
+inline std::span<const UniformField> uniform_fields(ShaderKind kind) {
+#define X(name) uniform_fields<ShaderKind::name>()
+    const std::span<const UniformField> fields[] = {SHADER_KINDS};
+#undef X
+    return fields[static_cast<size_t>(kind)];
+}
+
+
+inline void write_chain_header(std::ostream& out) {
+    out << CHAIN_MAGIC << ' ' << CHAIN_VERSION << '\n';
+}
+
+// false when the version line announces a newer format
+inline bool read_chain_header(std::istream& fields) {
+    int version = 0;
+    if (!(fields >> version) || version < 1 || version > CHAIN_VERSION) {
+        Log::error("Unsupported chain version, version {} is the latest supported.", CHAIN_VERSION);
+        return false;
+    }
+    return true;
+}
+
+
+inline void write_stage(std::ostream& out, ShaderKind kind, std::span<const std::byte> uniforms) {
+    out << shader_kind_name(kind);
+    for (const UniformField& field : uniform_fields(kind)) {
+        out << ' ' << field.name << '=';
+        for (size_t i = 0; i < field.count; i++) {
+            const std::byte* value = uniforms.data() + field.offset + 4 * i;
+            if (i > 0) out << ',';
+            switch (field.type) {
+                case UniformField::Type::Float: {
+                    float f;
+                    std::memcpy(&f, value, 4);
+                    out << std::format("{}", f);  // shortest representation reading back the same float
+                    break;
+                }
+                case UniformField::Type::Uint: {
+                    uint32_t u;
+                    std::memcpy(&u, value, 4);
+                    out << u;
+                    break;
+                }
+                case UniformField::Type::Int: {
+                    int32_t i;
+                    std::memcpy(&i, value, 4);
+                    out << i;
+                    break;
+                }
+            }
+        }
+    }
+    out << '\n';
+}
+
+
+inline bool parse_uniform_value(UniformField::Type type, std::string_view text, std::byte* value) {
+    const char* end = text.data() + text.size();
+    std::from_chars_result result;
+    switch (type) {
+        case UniformField::Type::Float: {
+            float f = 0.0f;
+            result = std::from_chars(text.data(), end, f);
+            std::memcpy(value, &f, 4);
+            break;
+        }
+        case UniformField::Type::Uint: {
+            uint32_t u = 0;
+            result = std::from_chars(text.data(), end, u);
+            std::memcpy(value, &u, 4);
+            break;
+        }
+        case UniformField::Type::Int: {
+            int32_t i = 0;
+            result = std::from_chars(text.data(), end, i);
+            std::memcpy(value, &i, 4);
+            break;
+        }
+    }
+    return result.ec == std::errc() && result.ptr == end && !text.empty();
+}
+
+// version 1 stages, the uniforms as uploaded
+inline bool parse_uniform_hex(std::string_view hex, std::span<std::byte> uniforms) {
+    if (hex.size() != 2 * uniforms.size()) return false;
+    for (size_t i = 0; i < uniforms.size(); i++) {
+        uint8_t byte;
+        if (std::from_chars(hex.data() + 2 * i, hex.data() + 2 * i + 2, byte, 16).ec != std::errc()) return false;
+        uniforms[i] = std::byte(byte);
+    }
+    return true;
+}
+
+
+// Reads the parameters following the kind on a stage line into `uniforms`, which hold the defaults of the kind. False
+// on malformed values.
+inline bool read_stage(std::istream& fields, ShaderKind kind, std::span<std::byte> uniforms) {
+    std::span<const UniformField> known = uniform_fields(kind);
+    std::string pair;
+    for (bool first = true; fields >> pair; first = false) {
+        size_t equal = pair.find('=');
+        if (equal == std::string::npos) return first && parse_uniform_hex(pair, uniforms);
+
+        std::string_view name(pair.data(), equal);
+        auto field = std::find_if(known.begin(), known.end(), [&](const UniformField& f) { return f.name == name; });
+        if (field == known.end()) {
+            Log::warn("Unknown parameter \"{}\" of chain stage \"{}\" skipped.", name, shader_kind_name(kind));
+            continue;
+        }
+
+        std::string_view values = std::string_view(pair).substr(equal + 1);
+        for (size_t i = 0; i < field->count; i++) {
+            size_t comma = std::min(values.find(','), values.size());
+            std::byte* value = uniforms.data() + field->offset + 4 * i;
+            if (!parse_uniform_value(field->type, values.substr(0, comma), value)) return false;
+            values.remove_prefix(std::min(comma + 1, values.size()));
+        }
+        if (!values.empty()) return false;  // more values than the field holds
+    }
+    return true;
+}
@@ -0,0 +1,548 @@
+#include "cpu_renderer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <format>
+#include <latch>
+#include <sstream>
+#include <string>
+
+#include "chain_format.hpp"
+#include "fusion.hpp"
+#include "src/log.hpp"
+
+
+namespace {
+
+// Pixels processed together, one per vector lane: 128 bit vectors, the width of SSE2, NEON and wasm SIMD, available
+// without target specific flags.
+constexpr uint32_t LANES = 4;
+using f32xN = float __attribute__((vector_size(LANES * sizeof(float))));
+using u32xN = uint32_t __attribute__((vector_size(LANES * sizeof(uint32_t))));
+using i32xN = int32_t __attribute__((vector_size(LANES * sizeof(int32_t))));  // comparison masks, -1 or 0
+
+constexpr float PI = 3.14159265f;  // same constant as the shaders
+
+// Colours of `LANES` consecutive pixels of a row.
+struct Pixels {
+    f32xN r, g, b, a;
+};
+
+// Their `@builtin(position)`: pixel centers, and the integer coordinates `vec2<u32>(coord)` seeding random numbers.
+struct Fragments {
+    f32xN x, y;
+    u32xN ix, iy;
+};
+
+struct Frame {
+    const uint8_t* pixels;  // RGBA8
+    uint32_t width;
+    uint32_t height;
+    float time;
+};
+
+// Stage uniforms decoded once per pass.
+struct StageUniforms {
+    ShaderKind kind;
+    Shader<ShaderKind::ChromaticAbberation>::Uniforms chromatic_aberration;
+    Shader<ShaderKind::Image>::Uniforms image;
+    Shader<ShaderKind::Noise>::Uniforms noise;
+    Shader<ShaderKind::Dithering>::Uniforms dithering;
+    const ImageData* image_data = nullptr;
+};
+
+
+f32xN splat(float value) {
+    return f32xN{} + value;
+}
+
+u32xN splat(uint32_t value) {
+    return u32xN{} + value;
+}
+
+f32xN select(i32xN mask, f32xN a, f32xN b) {
+    return (f32xN)(((i32xN)a & mask) | ((i32xN)b & ~mask));
+}
+
+f32xN to_float(i32xN mask) {  // vec3<f32>(bool)
+    return select(mask, splat(1.0f), splat(0.0f));
+}
+
+f32xN to_float(u32xN v) {
+    return __builtin_convertvector(v, f32xN);
+}
+
+f32xN saturate(f32xN v) {  // clamp(v, 0.0, 1.0)
+    v = select(v < splat(0.0f), splat(0.0f), v);
+    return select(v > splat(1.0f), splat(1.0f), v);
+}
+
+template <typename F>
+f32xN map(f32xN v, F&& f) {  // math functions without vector versions
+    for (uint32_t l = 0; l < LANES; l++) v[l] = f(v[l]);
+    return v;
+}
+
+bool is_pointwise(ShaderKind kind) {
+#define X(name) Shader<ShaderKind::name>::POINTWISE
+    constexpr bool pointwise[] = {SHADER_KINDS};
+#undef X
+    return pointwise[static_cast<size_t>(kind)];
+}
+
+
+// pcg3d of the shaders, from: http://www.jcgt.org/published/0009/03/02/
+void pcg3d(u32xN& x, u32xN& y, u32xN& z) {
+    x = x * 1664525u + 1013904223u;
+    y = y * 1664525u + 1013904223u;
+    z = z * 1664525u + 1013904223u;
+    x += y * z;
+    y += z * x;
+    z += x * y;
+    x ^= x >> 16u;
+    y ^= y >> 16u;
+    z ^= z >> 16u;
+    x += y * z;
+    y += z * x;
+    z += x * y;
+}
+
+f32xN unit_float(u32xN v) {  // ldexp(vec3<f32>(v), vec3<i32>(-32))
+    return to_float(v) * 0x1p-32f;
+}
+
+
+// Texels of `count` pixels of row `y` from `x`, lanes past `count` repeat the last one.
+Pixels load(const Frame& frame, uint32_t x, uint32_t y, uint32_t count) {
+    Pixels p;
+    const uint8_t* row = frame.pixels + static_cast<size_t>(y) * frame.width * 4;
+    for (uint32_t l = 0; l < LANES; l++) {
+        const uint8_t* texel = row + static_cast<size_t>(x + std::min(l, count - 1)) * 4;
+        p.r[l] = texel[0] / 255.0f;
+        p.g[l] = texel[1] / 255.0f;
+        p.b[l] = texel[2] / 255.0f;
+        p.a[l] = texel[3] / 255.0f;
+    }
+    return p;
+}
+
+uint8_t unorm8(float v) {  // write to a RGBA8Unorm target
+    if (!(v > 0.0f)) return 0;  // NaN too
+    if (v >= 1.0f) return 255;
+    return static_cast<uint8_t>(v * 255.0f + 0.5f);
+}
+
+void store(const Pixels& p, uint8_t* pixels, uint32_t width, uint32_t x, uint32_t y, uint32_t count) {
+    uint8_t* row = pixels + static_cast<size_t>(y) * width * 4;
+    for (uint32_t l = 0; l < count; l++) {
+        uint8_t* texel = row + static_cast<size_t>(x + l) * 4;
+        texel[0] = unorm8(p.r[l]);
+        texel[1] = unorm8(p.g[l]);
+        texel[2] = unorm8(p.b[l]);
+        texel[3] = unorm8(p.a[l]);
+    }
+}
+
+// textureSample through a linear clamp-to-edge sampler, on the base level of `channels` 8 bit samples per texel. Grey
+// images are swizzled like image.wgsl does.
+Pixels sample(const uint8_t* texels, int width, int height, int channels, f32xN u, f32xN v) {
+    Pixels p;
+    for (uint32_t l = 0; l < LANES; l++) {
+        // texel space, clamped before the integer conversion so out of range coordinates stay defined
+        float tx = std::clamp(u[l] * width - 0.5f, -1.0f, static_cast<float>(width));
+        float ty = std::clamp(v[l] * height - 0.5f, -1.0f, static_cast<float>(height));
+        if (std::isnan(tx)) tx = 0.0f;
+        if (std::isnan(ty)) ty = 0.0f;
+        float fx = std::floor(tx);
+        float fy = std::floor(ty);
+        float wx = tx - fx;
+        float wy = ty - fy;
+        int x0 = std::clamp(static_cast<int>(fx), 0, width - 1);
+        int x1 = std::clamp(static_cast<int>(fx) + 1, 0, width - 1);
+        int y0 = std::clamp(static_cast<int>(fy), 0, height - 1);
+        int y1 = std::clamp(static_cast<int>(fy) + 1, 0, height - 1);
+
+        float texel[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+        for (int c = 0; c < channels; c++) {
+            auto at = [&](int x, int y) {
+                return texels[(static_cast<size_t>(y) * width + x) * channels + c] / 255.0f;
+            };
+            float top = at(x0, y0) + (at(x1, y0) - at(x0, y0)) * wx;
+            float bottom = at(x0, y1) + (at(x1, y1) - at(x0, y1)) * wx;
+            texel[c] = top + (bottom - top) * wy;
+        }
+        if (channels == 2) texel[3] = texel[1];
+        if (channels <= 2) texel[1] = texel[2] = texel[0];
+
+        p.r[l] = texel[0];
+        p.g[l] = texel[1];
+        p.b[l] = texel[2];
+        p.a[l] = texel[3];
+    }
+    return p;
+}
+
+Pixels sample(const Frame& frame, f32xN u, f32xN v) {
+    return sample(frame.pixels, static_cast<int>(frame.width), static_cast<int>(frame.height), 4, u, v);
+}
+
+
+// Pointwise kernels, see the `// fusion` sections of noise.wgsl and dithering.wgsl
+
+void noise_effect(Pixels& p, const Fragments& f, const Shader<ShaderKind::Noise>::Uniforms& u, const Frame& frame) {
+    uint32_t z = u.seed;
+    if (u.control & 2u) z += static_cast<uint32_t>(frame.time * 1000);
+    u32xN nx = f.ix, ny = f.iy, nz = splat(z);
+    pcg3d(nx, ny, nz);
+
+    if (u.control & 1u) {
+        p.r += u.colored_min[0] + unit_float(nx) * (u.colored_max[0] - u.colored_min[0]);
+        p.g += u.colored_min[1] + unit_float(ny) * (u.colored_max[1] - u.colored_min[1]);
+        p.b += u.colored_min[2] + unit_float(nz) * (u.colored_max[2] - u.colored_min[2]);
+    } else {
+        f32xN noise = u.min + unit_float(nx) * (u.max - u.min);
+        p.r += noise;
+        p.g += noise;
+        p.b += noise;
+    }
+}
+
+// colour channels compared to thresholds
+void binarize(Pixels& p, f32xN r, f32xN g, f32xN b) {
+    p.r = to_float(p.r > r);
+    p.g = to_float(p.g > g);
+    p.b = to_float(p.b > b);
+}
+
+// grey mode, the mean of the colour channels compared to a threshold
+void binarize(Pixels& p, f32xN threshold) {
+    p.r = p.g = p.b = to_float((p.r + p.g + p.b) / 3.0f > threshold);
+}
+
+void dithering_effect(
+    Pixels& p, const Fragments& f, const Shader<ShaderKind::Dithering>::Uniforms& u, const Frame& frame
+) {
+    using Mode = Shader<ShaderKind::Dithering>::Mode;
+    bool color_mode = u.control & 1u;
+    switch (u.mode) {
+        case Mode::Threshold:
+            if (color_mode) {
+                binarize(p, splat(u.threshold_rgb[0]), splat(u.threshold_rgb[1]), splat(u.threshold_rgb[2]));
+            } else {
+                binarize(p, splat(u.threshold));
+            }
+            break;
+        case Mode::Random: {
+            uint32_t z = u.control & 2u ? static_cast<uint32_t>(frame.time * 200) : 0u;
+            u32xN nx = f.ix, ny = f.iy, nz = splat(z);
+            pcg3d(nx, ny, nz);
+            if (color_mode) {
+                binarize(
+                    p,
+                    u.random_min_rgb[0] + unit_float(nx) * (u.random_max_rgb[0] - u.random_min_rgb[0]),
+                    u.random_min_rgb[1] + unit_float(ny) * (u.random_max_rgb[1] - u.random_min_rgb[1]),
+                    u.random_min_rgb[2] + unit_float(nz) * (u.random_max_rgb[2] - u.random_min_rgb[2])
+                );
+            } else {
+                binarize(p, u.random_min + unit_float(nx) * (u.random_max - u.random_min));
+            }
+            break;
+        }
+        case Mode::Halftone: {
+            float c = std::cos(u.halftone_angle);
+            float s = std::sin(u.halftone_angle);
+            f32xN dx = f.x - static_cast<float>(frame.width) / 2.0f;
+            f32xN dy = f.y - static_cast<float>(frame.height) / 2.0f;
+            f32xN gx = (c * dx - s * dy) / u.halftone_scale * PI;
+            f32xN gy = (s * dx + c * dy) / u.halftone_scale * PI;
+            f32xN sin_x = map(gx, [](float v) { return std::sin(v); });
+            f32xN cos_y = map(gy, [](float v) { return std::cos(v); });
+            f32xN mask = ((sin_x + cos_y) / 4.0f) + 0.5f;
+            if (color_mode) {
+                binarize(p, mask, mask, mask);
+            } else {
+                binarize(p, mask);
+            }
+            break;
+        }
+        case Mode::Bayer: {
+            f32xN mask = splat(0.0f);
+            u32xN gx = f.ix, gy = f.iy;
+            for (uint32_t i = 0; i < u.bayer_steps; i++) {
+                u32xN id_x = gx & 1u;
+                u32xN id_y = gy & 1u;
+                mask += to_float(id_x + 2u * (id_x ^ id_y)) / static_cast<float>(4u << ((2u * i) & 31u));
+                gx >>= 1u;
+                gy >>= 1u;
+            }
+            mask += 1.0f / static_cast<float>(1u << ((2u * u.bayer_steps + 1u) & 31u));
+            if (color_mode) {
+                binarize(p, mask, mask, mask);
+            } else {
+                binarize(p, mask);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+
+// Sampling kernels, see chromatic_aberration.wgsl and image.wgsl
+
+Pixels chromatic_aberration(
+    const Fragments& f, const Shader<ShaderKind::ChromaticAbberation>::Uniforms& u, const Frame& frame
+) {
+    float vs_x = static_cast<float>(frame.width);
+    float vs_y = static_cast<float>(frame.height);
+    f32xN uv_x = f.x / vs_x;
+    f32xN uv_y = f.y / vs_y;
+
+    Pixels red, green, blue;
+    switch (u.mode_id) {
+        case 0:
+            red = sample(frame, uv_x + u.uni_red_shift_x / vs_x, uv_y + u.uni_red_shift_y / vs_y);
+            green = sample(frame, uv_x + u.uni_green_shift_x / vs_x, uv_y + u.uni_green_shift_y / vs_y);
+            blue = sample(frame, uv_x + u.uni_blue_shift_x / vs_x, uv_y + u.uni_blue_shift_y / vs_y);
+            break;
+        case 1: {
+            float center_x = u.scale_center_x / vs_x;
+            float center_y = u.scale_center_y / vs_y;
+            auto scale_linear = [&](float intensity) {
+                return sample(
+                    frame,
+                    ((uv_x - center_x) * (1.0f + intensity)) + center_x,
+                    ((uv_y - center_y) * (1.0f + intensity)) + center_y
+                );
+            };
+            red = scale_linear(u.scale_red_intensity);
+            green = scale_linear(u.scale_green_intensity);
+            blue = scale_linear(u.scale_blue_intensity);
+            break;
+        }
+        case 2:
+            return {splat(1.0f), splat(1.0f), splat(1.0f), splat(1.0f)};
+        default:
+            return {splat(0.0f), splat(0.0f), splat(0.0f), splat(0.0f)};
+    }
+    return {red.r, green.g, blue.b, (red.a + green.a + blue.a) / 3.0f};
+}
+
+Pixels image_effect(
+    Pixels color, const Fragments& f, const Shader<ShaderKind::Image>::Uniforms& u, const ImageData* image
+) {
+    if (!image || !image->ptr) return color;
+
+    f32xN dx = f.x - (u.size_x / 2.0f) - u.pos_x;
+    f32xN dy = f.y - (u.size_y / 2.0f) - u.pos_y;
+    float c = std::cos(-u.rotation);
+    float s = std::sin(-u.rotation);
+    f32xN uv_x = (c * dx - s * dy) / u.size_x + 0.5f;
+    f32xN uv_y = (s * dx + c * dy) / u.size_y + 0.5f;
+
+    Pixels texel = sample(image->ptr, image->width, image->height, image->channels, uv_x, uv_y);
+    i32xN inside = (uv_x >= 0.0f) & (uv_y >= 0.0f) & (uv_x <= 1.0f) & (uv_y <= 1.0f);
+    f32xN alpha = texel.a * u.opacity;
+    return {
+        select(inside, texel.r * alpha + color.r * (1.0f - alpha), color.r),
+        select(inside, texel.g * alpha + color.g * (1.0f - alpha), color.g),
+        select(inside, texel.b * alpha + color.b * (1.0f - alpha), color.b),
+        select(inside, alpha * alpha + color.a * (1.0f - alpha), color.a),
+    };
+}
+
+
+// One pass over the pixels of a tile, `output` is a frame of the same size as `input`.
+void render_tile(
+    std::span<const StageUniforms> pass, const Frame& input, uint8_t* output, uint32_t x0, uint32_t y0, uint32_t x1,
+    uint32_t y1
+) {
+    f32xN lane_offsets;
+    u32xN lane_indices;
+    for (uint32_t l = 0; l < LANES; l++) {
+        lane_offsets[l] = static_cast<float>(l);
+        lane_indices[l] = l;
+    }
+
+    for (uint32_t y = y0; y < y1; y++) {
+        for (uint32_t x = x0; x < x1; x += LANES) {
+            uint32_t count = std::min(LANES, x1 - x);
+            Fragments f = {
+                .x = lane_offsets + (static_cast<float>(x) + 0.5f),
+                .y = splat(static_cast<float>(y) + 0.5f),
+                .ix = lane_indices + x,
+                .iy = splat(y),
+            };
+
+            Pixels p;
+            if (pass[0].kind == ShaderKind::ChromaticAbberation) {
+                p = chromatic_aberration(f, pass[0].chromatic_aberration, input);
+            } else {
+                p = load(input, x, y, count);  // samples at pixel centers are the texels themselves
+            }
+            for (const StageUniforms& stage : pass) {
+                switch (stage.kind) {
+                    case ShaderKind::Image:
+                        p = image_effect(p, f, stage.image, stage.image_data);
+                        break;
+                    case ShaderKind::Noise:
+                        noise_effect(p, f, stage.noise, input);
+                        break;
+                    case ShaderKind::Dithering:
+                        dithering_effect(p, f, stage.dithering, input);
+                        break;
+                    default:
+                        break;
+                }
+                // clamped between stages like the fused shader, and like the RGBA8 target of unfused passes
+                p = {saturate(p.r), saturate(p.g), saturate(p.b), saturate(p.a)};
+            }
+            store(p, output, input.width, x, y, count);
+        }
+    }
+}
+
+}  // namespace
+
+
+std::optional<CpuStage> default_cpu_stage(ShaderKind kind) {
+    switch (kind) {
+        case ShaderKind::ChromaticAbberation:
+            return CpuStage::make<ShaderKind::ChromaticAbberation>(
+                Shader<ShaderKind::ChromaticAbberation>::default_uniforms()
+            );
+        case ShaderKind::Noise:
+            return CpuStage::make<ShaderKind::Noise>({});
+        case ShaderKind::Dithering:
+            return CpuStage::make<ShaderKind::Dithering>({});
+        default:
+            return std::nullopt;
+    }
+}
+
+
+CpuStage image_cpu_stage(ImageData image) {
+    Shader<ShaderKind::Image>::Uniforms uniforms = {{{0.0, 0.0, 0.0, 0.0, 0.0, 1.0}}};
+    uniforms.size_x = static_cast<float>(image.width);
+    uniforms.size_y = static_cast<float>(image.height);
+    uniforms.channels = static_cast<uint32_t>(image.channels);
+    return CpuStage::make<ShaderKind::Image>(uniforms, std::move(image));
+}
+
+
+void save_cpu_chain(std::ostream& out, std::span<const CpuStage> stages) {
+    write_chain_header(out);
+    for (const CpuStage& stage : stages) {
+        if (stage.kind == ShaderKind::Image) {
+            Log::warn("Image stages use resources, they are not saved in the chain.");
+            continue;
+        }
+        write_stage(out, stage.kind, std::as_bytes(std::span(stage.uniforms)));
+    }
+}
+
+
+bool load_cpu_chain(std::istream& in, std::vector<CpuStage>& stages) {
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        if (!(fields >> name) || name.starts_with('#')) continue;
+        if (name == CHAIN_MAGIC) {
+            if (!read_chain_header(fields)) return false;
+            continue;
+        }
+
+        std::optional<ShaderKind> kind = shader_kind_from_name(name);
+        std::optional<CpuStage> stage = kind ? default_cpu_stage(kind.value()) : std::nullopt;
+        if (!stage) {
+            Log::error("Unknown chain stage \"{}\".", name);
+            return false;
+        }
+        if (!read_stage(fields, kind.value(), std::as_writable_bytes(std::span(stage->uniforms)))) {
+            Log::error("Malformed parameters of chain stage \"{}\".", name);
+            return false;
+        }
+        stages.push_back(std::move(stage.value()));
+    }
+    return true;
+}
+
+
+CpuRenderer::CpuRenderer(size_t thread_count) : pool(std::max<size_t>(thread_count, 1) - 1) {}
+
+
+void CpuRenderer::for_each_tile(
+    std::array<uint32_t, 2> size, const std::function<void(uint32_t, uint32_t, uint32_t, uint32_t)>& f
+) {
+    uint32_t columns = (size[0] + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t rows = (size[1] + TILE_SIZE - 1) / TILE_SIZE;
+    size_t tile_count = static_cast<size_t>(columns) * rows;
+
+    // tiles are taken in row order from a shared counter, so a slow tile never holds the others back
+    std::atomic<size_t> next_tile = 0;
+    auto work = [&]() {
+        for (size_t t = next_tile++; t < tile_count; t = next_tile++) {
+            uint32_t x0 = static_cast<uint32_t>(t % columns) * TILE_SIZE;
+            uint32_t y0 = static_cast<uint32_t>(t / columns) * TILE_SIZE;
+            f(x0, y0, std::min(x0 + TILE_SIZE, size[0]), std::min(y0 + TILE_SIZE, size[1]));
+        }
+    };
+
+    size_t helpers = std::min(pool.get_thread_count(), tile_count);
+    std::latch done(static_cast<std::ptrdiff_t>(helpers));
+    for (size_t i = 0; i < helpers; i++) {
+        pool.submit([&]() {
+            work();
+            done.count_down();
+        });
+    }
+    work();
+    done.wait();
+}
+
+
+std::vector<uint8_t> CpuRenderer::render(std::span<const CpuStage> stages, std::array<uint32_t, 2> size, float time) {
+    std::vector<StageUniforms> decoded(stages.size());
+    for (size_t i = 0; i < stages.size(); i++) {
+        const CpuStage& stage = stages[i];
+        StageUniforms& uniforms = decoded[i];
+        uniforms.kind = stage.kind;
+        uniforms.image_data = &stage.image;
+        bool valid = stage.get_uniforms<ShaderKind::ChromaticAbberation>(uniforms.chromatic_aberration) ||
+                     stage.get_uniforms<ShaderKind::Image>(uniforms.image) ||
+                     stage.get_uniforms<ShaderKind::Noise>(uniforms.noise) ||
+                     stage.get_uniforms<ShaderKind::Dithering>(uniforms.dithering);
+        if (!valid) {
+            Log::error("Parameters of stage {} do not match its kind {}.", i, shader_kind_name(stage.kind));
+            return {};
+        }
+    }
+
+    size_t byte_size = static_cast<size_t>(size[0]) * size[1] * 4;
+    std::vector<uint8_t> input(byte_size);
+    std::vector<uint8_t> output(byte_size);
+    for (size_t i = 3; i < byte_size; i += 4) input[i] = 255;  // the blank target is cleared to opaque black
+
+    // passes like ShaderManager::plan_passes: sampling stages alone, runs of pointwise stages fused
+    for (size_t first = 0; first < decoded.size();) {
+        size_t count = 1;
+        if (is_pointwise(decoded[first].kind)) {
+            while (first + count < decoded.size() && is_pointwise(decoded[first + count].kind) &&
+                   count < FusedPipelineCache::MAX_RUN_LENGTH) {
+                count++;
+            }
+        }
+
+        std::span<const StageUniforms> pass(decoded.data() + first, count);
+        Frame frame = {input.data(), size[0], size[1], time};
+        for_each_tile(size, [&](uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+            render_tile(pass, frame, output.data(), x0, y0, x1, y1);
+        });
+        std::swap(input, output);
+        first += count;
+    }
+    return input;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "shader.hpp"
+#include "shaders/chromatic_aberration.hpp"
+#include "shaders/dithering.hpp"
+#include "shaders/image.hpp"
+#include "shaders/noise.hpp"
+#include "src/context/image_decoder.hpp"
+#include "src/thread_pool.hpp"
+
+
+// One stage of a chain rendered on the CPU: the uniforms of `Shader<kind>`, as uploaded to the GPU, and the image
+// drawn by Image stages.
+struct CpuStage {
+    ShaderKind kind;
+    std::vector<uint8_t> uniforms;
+    ImageData image;  // Image stages only, any channel count
+
+    template <ShaderKind K>
+    static CpuStage make(const typename Shader<K>::Uniforms& uniforms, ImageData image = {}) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&uniforms);
+        return {K, std::vector<uint8_t>(bytes, bytes + sizeof(uniforms)), std::move(image)};
+    }
+
+    // false when the stored bytes are not the uniforms of `K`
+    template <ShaderKind K>
+    bool get_uniforms(typename Shader<K>::Uniforms& uniforms) const {
+        if (kind != K || this->uniforms.size() != sizeof(uniforms)) return false;
+        std::memcpy(&uniforms, this->uniforms.data(), sizeof(uniforms));
+        return true;
+    }
+};
+
+// Default parameters of a stage kind, nothing for kinds that need resources.
+std::optional<CpuStage> default_cpu_stage(ShaderKind kind);
+// Image stage drawing `image` at its size in the top left corner, like a new stage of the app.
+CpuStage image_cpu_stage(ImageData image);
+
+// Same format as `ShaderManager::save_chain` and `ShaderManager::load_chain`.
+void save_cpu_chain(std::ostream& out, std::span<const CpuStage> stages);
+bool load_cpu_chain(std::istream& in, std::vector<CpuStage>& stages);
+
+
+// Software implementation of the effect chain, for machines without a usable GPU and as a reference for the WGSL
+// passes. The frame is cut in tiles shared between every core, rows of a tile are processed `LANES` pixels at a time
+// with the compiler vector extensions (see cpu_renderer.cpp). Passes are split like the manager splits them (runs of
+// pointwise stages are fused, see fusion.hpp) and their outputs are rounded to RGBA8 like the pass textures, so
+// pointwise stages and unshifted sampling match the GPU up to float precision. Filtered samples between texels and the
+// halftone trigonometry may differ by a step, and images are sampled from their base level without mipmaps.
+struct CpuRenderer {
+    static constexpr uint32_t TILE_SIZE = 64;
+
+    CpuRenderer(size_t thread_count = std::thread::hardware_concurrency());
+
+    CpuRenderer(const CpuRenderer&) = delete;
+    CpuRenderer(CpuRenderer&&) = delete;
+
+    // Renders `stages` over an opaque black frame, `time` is the one seen by the shaders in seconds. Returns tightly
+    // packed RGBA8 pixels.
+    std::vector<uint8_t> render(std::span<const CpuStage> stages, std::array<uint32_t, 2> size, float time = 0.0f);
+
+    size_t get_thread_count() const {
+        return pool.get_thread_count() + 1;  // the calling thread takes tiles too
+    }
+
+  private:
+    ThreadPool pool;
+
+    // Runs `f(x0, y0, x1, y1)` over every tile of the frame, returns once all are done.
+    void for_each_tile(
+        std::array<uint32_t, 2> size, const std::function<void(uint32_t, uint32_t, uint32_t, uint32_t)>& f
+    );
+};
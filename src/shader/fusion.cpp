@@ -0,0 +1,120 @@
+#include "fusion.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <format>
+#include <string_view>
+
+#include "shaders_code.hpp"
+#include "src/log.hpp"
+
+
+static constexpr std::string_view section_begin = "// fusion: begin";
+static constexpr std::string_view section_end = "// fusion: end";
+
+
+static std::string_view effect_section(std::string_view source) {
+    size_t begin = source.find(section_begin);
+    size_t end = source.find(section_end);
+    if (begin == std::string_view::npos || end == std::string_view::npos || end < begin) {
+        Log::error("Pointwise shader source has no fusion section.");
+        return {};
+    }
+    begin += section_begin.size();
+    return source.substr(begin, end - begin);
+}
+
+
+std::string compose_fused_shader(std::span<const FusedStage> stages) {
+    std::string code = pointwise_prelude;
+
+    // sections are emitted once per kind, instances of a kind only differ by their uniforms binding
+    std::vector<ShaderKind> emitted;
+    for (const FusedStage& stage : stages) {
+        if (std::ranges::find(emitted, stage.kind) != emitted.end()) continue;
+        emitted.push_back(stage.kind);
+        code += effect_section(stage.source);
+    }
+
+    code += "\n";
+    for (size_t i = 0; i < stages.size(); i++) {
+        code += std::format("@group(1) @binding({}) var<uniform> stage_{}: {};\n", i, i, stages[i].effect_uniforms);
+    }
+
+    code += "\n@fragment fn fs_main(@builtin(position) coord: vec4<f32>) -> @location(0) vec4<f32> {\n";
+    code += "    var color = textureSample(input_tex, input_sampler, fullscreen_uv(coord.xy));\n";
+    for (size_t i = 0; i < stages.size(); i++) {
+        // clamp like the RGBA8Unorm target of an unfused pass would
+        code += std::format(
+            "    color = clamp({}(color, coord.xy, stage_{}), vec4<f32>(0.0), vec4<f32>(1.0));\n",
+            stages[i].effect_function,
+            i
+        );
+    }
+    code += "    return color;\n}\n";
+
+    return code;
+}
+
+
+const FusedPipeline& FusedPipelineCache::get(
+    std::span<const FusedStage> stages, const wgpu::BindGroupLayout& default_bind_group_layout
+) {
+    assert(stages.size() > 0 && stages.size() <= MAX_RUN_LENGTH);
+
+    std::vector<ShaderKind> key;
+    for (const FusedStage& stage : stages) key.push_back(stage.kind);
+
+    if (auto it = pipelines.find(key); it != pipelines.end()) return *it->second;
+
+    auto pipeline = std::make_unique<FusedPipeline>();
+    pipeline->code = compose_fused_shader(stages);
+    pipeline->source = std::make_unique<ShaderSource>(ctx.gpu, pipeline->code.c_str());
+
+    std::vector<wgpu::BindGroupLayoutEntry> bgl_entries(stages.size());
+    for (size_t i = 0; i < stages.size(); i++) {
+        bgl_entries[i].binding = i;
+        bgl_entries[i].visibility = wgpu::ShaderStage::Fragment;
+        bgl_entries[i].buffer.type = wgpu::BufferBindingType::Uniform;
+        bgl_entries[i].buffer.hasDynamicOffset = false;
+        bgl_entries[i].buffer.minBindingSize = stages[i].uniforms_size;
+    }
+
+    pipeline->bind_group_layout = ctx.pipeline_cache.get_bind_group_layout(bgl_entries);
+
+    wgpu::BindGroupLayout bgls[2] = {default_bind_group_layout, *pipeline->bind_group_layout};
+    const wgpu::raii::PipelineLayout& pipeline_layout = ctx.pipeline_cache.get_pipeline_layout(bgls);
+
+    // the fused source dies with this cache entry, it can't key the shared pipeline map
+    pipeline->render_pipeline = std::make_unique<AsyncPipeline>(
+        ctx.gpu,
+        ctx.shader_source_cache.get(fullscreen_vertex),
+        *pipeline->source,
+        pipeline_layout,
+        wgpu::TextureFormat::RGBA8Unorm
+    );
+
+    Log::info("Compiling fused pass of {} pointwise stages.", stages.size());
+
+    return *(pipelines[key] = std::move(pipeline));
+}
+
+
+wgpu::raii::BindGroup FusedPipelineCache::make_bind_group(
+    const FusedPipeline& pipeline, std::span<const FusedStage> stages
+) const {
+    std::vector<wgpu::BindGroupEntry> bg_entries(stages.size());
+    for (size_t i = 0; i < stages.size(); i++) {
+        bg_entries[i].binding = i;
+        bg_entries[i].buffer = stages[i].uniforms_buffer;
+        bg_entries[i].offset = stages[i].uniforms_offset;
+        bg_entries[i].size = stages[i].uniforms_size;
+    }
+
+    wgpu::BindGroupDescriptor bg_desc;
+    bg_desc.layout = *pipeline.bind_group_layout;
+    bg_desc.entryCount = bg_entries.size();
+    bg_desc.entries = bg_entries.data();
+
+    return ctx.gpu.get_device().createBindGroup(bg_desc);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+#include <webgpu/webgpu-raii.hpp>
+
+#include "src/context.hpp"
+#include "src/shader/shader.hpp"
+
+
+// A pointwise stage as seen by the fusion compiler.
+// Its fragment `source` must hold a `// fusion: begin` ... `// fusion: end` section defining `effect_uniforms` and
+// `fn effect_function(color: vec4<f32>, coord: vec2<f32>, parameters: effect_uniforms) -> vec4<f32>`.
+struct FusedStage {
+    ShaderKind kind;
+    const char* source;
+    const char* effect_function;
+    const char* effect_uniforms;
+    wgpu::Buffer uniforms_buffer;
+    uint32_t uniforms_offset;  // static offset of the stage slot in the uniform arena
+    uint64_t uniforms_size;
+};
+
+
+std::string compose_fused_shader(std::span<const FusedStage> stages);
+
+
+struct FusedPipeline {
+    std::string code;
+    std::unique_ptr<ShaderSource> source;
+    wgpu::raii::BindGroupLayout bind_group_layout;
+    std::unique_ptr<AsyncPipeline> render_pipeline;
+};
+
+
+// Fused pipelines are keyed by stage kind sequence only, so reordering the chain reuses already compiled runs.
+struct FusedPipelineCache {
+    // group(0) already binds one uniform buffer, stay under the default `maxUniformBuffersPerShaderStage` (12)
+    static constexpr size_t MAX_RUN_LENGTH = 8;
+
+    const Context& ctx;
+
+    FusedPipelineCache(const Context& ctx) : ctx(ctx) {}
+
+    const FusedPipeline& get(
+        std::span<const FusedStage> stages, const wgpu::BindGroupLayout& default_bind_group_layout
+    );
+    wgpu::raii::BindGroup make_bind_group(const FusedPipeline& pipeline, std::span<const FusedStage> stages) const;
+
+    void clear() {
+        pipelines.clear();
+    }
+
+  private:
+    std::map<std::vector<ShaderKind>, std::unique_ptr<FusedPipeline>> pipelines;
+};
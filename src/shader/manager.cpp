@@ -5,45 +5,36 @@
 #include <imgui/misc/cpp/imgui_stdlib.h>
 
 #include <chrono>
+#include <cstring>
 #include <functional>
 #include <memory>
+#include <sstream>
 #include <webgpu/webgpu.hpp>
 
 #include "backends/imgui_impl_wgpu.h"
 #include "imgui_internal.h"
+#include "src/profiler.hpp"
+#include "src/shader/chain_format.hpp"
 #include "src/shader/shader.hpp"
 #include "webgpu/webgpu-raii.hpp"
 
-ShaderManager::ShaderManager(Context& ctx) : ctx(ctx), shaders() {
+ShaderManager::ShaderManager(Context& ctx)
+    : ctx(ctx), uniform_arena(ctx.gpu, ctx.pipeline_cache), shaders(), fused_pipelines(ctx),
+      pass_timer(ctx.gpu, 1), readback(ctx.gpu, READBACK_SLOTS) {
+    default_uniforms_offset = uniform_arena.allocate();
+    arena_generation = uniform_arena.get_generation();
     init();
 }
 
-
-void ShaderManager::init() {
-    assert(!*texture_A && !*texture_view_A && !*texture_B && !*texture_view_B);
-    start_time = std::chrono::high_resolution_clock::now();
-
-    // Textures
-    wgpu::TextureDescriptor texture_desc;
-#ifdef __EMSCRIPTEN__
-    texture_desc.label = "shader_render";
-#else
-    texture_desc.label.data = "shader_render";
-    texture_desc.label.length = WGPU_STRLEN;
+ShaderManager::~ShaderManager() {
+#ifndef __EMSCRIPTEN__
+    if (exporter) exporter->wait();  // exported frames are written in full before quitting
 #endif
-    texture_desc.size.width = ctx.render_target.dim[0];
-    texture_desc.size.height = ctx.render_target.dim[1];
-    texture_desc.size.depthOrArrayLayers = 1;
-    texture_desc.format = wgpu::TextureFormat::RGBA8Unorm;
-    texture_desc.sampleCount = 1;
-    texture_desc.mipLevelCount = 1;
-    texture_desc.usage = wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::TextureBinding;
+}
 
-    texture_A = ctx.gpu.get_device().createTexture(texture_desc);
-    texture_view_A = texture_A->createView();
 
-    texture_B = ctx.gpu.get_device().createTexture(texture_desc);
-    texture_view_B = texture_B->createView();
+void ShaderManager::init() {
+    start_time = std::chrono::high_resolution_clock::now();
 
     // Sampler
     wgpu::SamplerDescriptor sampler_desc;
@@ -54,15 +45,6 @@ void ShaderManager::init() {
 
     sampler = ctx.gpu.get_device().createSampler(sampler_desc);
 
-    // Default uniforms
-    wgpu::BufferDescriptor du_buffer_desc;
-    du_buffer_desc.usage = wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst;
-    du_buffer_desc.size = sizeof(DefaultUniforms);
-    du_buffer_desc.mappedAtCreation = false;
-
-    default_uniforms = ctx.gpu.get_device().createBuffer(du_buffer_desc);
-
-
     // Bind group layout
     wgpu::BindGroupLayoutEntry bgl_entries[3];
     // texture entry
@@ -82,136 +64,450 @@ void ShaderManager::init() {
     bgl_entries[2].buffer.hasDynamicOffset = false;
     bgl_entries[2].buffer.minBindingSize = sizeof(DefaultUniforms);
 
-    wgpu::BindGroupLayoutDescriptor bgl_desc;
-    bgl_desc.entryCount = 3;
-    bgl_desc.entries = bgl_entries;
+    default_bind_group_layout = ctx.pipeline_cache.get_bind_group_layout(bgl_entries);
 
-    default_bind_group_layout = ctx.gpu.get_device().createBindGroupLayout(bgl_desc);
+    // Render targets, pass outputs are recreated lazily by `plan_passes`
+    blank_target = make_target();
+    blank_cleared = false;
+    targets.clear();
 
-    // Bind groups
-    // entries
-    wgpu::BindGroupEntry bg_texture_A_entry;
-    bg_texture_A_entry.binding = 0;
-    bg_texture_A_entry.textureView = *texture_view_A;
+    passes_dirty = true;
 
-    wgpu::BindGroupEntry bg_texture_B_entry;
-    bg_texture_B_entry.binding = 0;
-    bg_texture_B_entry.textureView = *texture_view_B;
+    for (std::unique_ptr<ShaderUnion>& s : shaders) {
+        s->apply([&](auto& s) { s.init_pipeline(*default_bind_group_layout); });
+        if (s->is_current<Shader<ShaderKind::Image>>()) {
+            s->get<Shader<ShaderKind::Image>>().set_render_dim(ctx.render_target.dim);
+        }
+    }
+}
 
-    wgpu::BindGroupEntry bg_sampler_entry;
-    bg_sampler_entry.binding = 1;
-    bg_sampler_entry.sampler = *sampler;
 
-    wgpu::BindGroupEntry bg_uniforms_entry;
-    bg_uniforms_entry.binding = 2;
-    bg_uniforms_entry.buffer = *default_uniforms;
-    bg_uniforms_entry.offset = 0;
-    bg_uniforms_entry.size = sizeof(DefaultUniforms);
+ShaderManager::PassTarget ShaderManager::make_target() const {
+    wgpu::TextureDescriptor texture_desc;
+#ifdef __EMSCRIPTEN__
+    texture_desc.label = "shader_render";
+#else
+    texture_desc.label.data = "shader_render";
+    texture_desc.label.length = WGPU_STRLEN;
+#endif
+    texture_desc.size.width = ctx.render_target.dim[0];
+    texture_desc.size.height = ctx.render_target.dim[1];
+    texture_desc.size.depthOrArrayLayers = 1;
+    texture_desc.format = wgpu::TextureFormat::RGBA8Unorm;
+    texture_desc.sampleCount = 1;
+    texture_desc.mipLevelCount = 1;
+    // copies stand in for passes whose pipeline is still compiling
+    texture_desc.usage = wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::TextureBinding |
+                         wgpu::TextureUsage::CopySrc | wgpu::TextureUsage::CopyDst;
+
+    PassTarget target;
+    target.texture = ctx.gpu.get_device().createTexture(texture_desc);
+    target.texture_view = target.texture->createView();
+    target.bind_group = make_default_bind_group(*target.texture_view);
+    return target;
+}
 
-    wgpu::BindGroupEntry bg_A_entries[3] = {bg_texture_A_entry, bg_sampler_entry, bg_uniforms_entry};
-    wgpu::BindGroupEntry bg_B_entries[3] = {bg_texture_B_entry, bg_sampler_entry, bg_uniforms_entry};
 
-    // descriptors
-    wgpu::BindGroupDescriptor bg_A_desc;
-    bg_A_desc.layout = *default_bind_group_layout;
-    bg_A_desc.entryCount = 3;
-    bg_A_desc.entries = bg_A_entries;
+wgpu::raii::BindGroup ShaderManager::make_default_bind_group(const wgpu::TextureView& input) const {
+    wgpu::BindGroupEntry bg_entries[3];
+    // texture entry
+    bg_entries[0].binding = 0;
+    bg_entries[0].textureView = input;
+    // sampler entry
+    bg_entries[1].binding = 1;
+    bg_entries[1].sampler = *sampler;
+    // default uniforms entry
+    bg_entries[2].binding = 2;
+    bg_entries[2].buffer = uniform_arena.get_buffer();
+    bg_entries[2].offset = default_uniforms_offset;
+    bg_entries[2].size = sizeof(DefaultUniforms);
 
-    wgpu::BindGroupDescriptor bg_B_desc;
-    bg_B_desc.layout = *default_bind_group_layout;
-    bg_B_desc.entryCount = 3;
-    bg_B_desc.entries = bg_B_entries;
+    wgpu::BindGroupDescriptor bg_desc;
+    bg_desc.layout = *default_bind_group_layout;
+    bg_desc.entryCount = 3;
+    bg_desc.entries = bg_entries;
 
-    // bind groups
-    bind_group_A = ctx.gpu.get_device().createBindGroup(bg_A_desc);
-    bind_group_B = ctx.gpu.get_device().createBindGroup(bg_B_desc);
+    return ctx.gpu.get_device().createBindGroup(bg_desc);
+}
 
-    for (std::unique_ptr<ShaderUnion>& s : shaders) {
-        s->apply([&](auto& s) { s.init_pipeline(*default_bind_group_layout); });
-        if (s->is_current<Shader<ShaderKind::Image>>()) {
-            s->get<Shader<ShaderKind::Image>>().set_render_dim(ctx.render_target.dim);
+
+const ShaderManager::PassTarget& ShaderManager::result_target() const {
+    return passes.empty() ? blank_target : targets[passes.size() - 1];
+}
+
+
+wgpu::Texture ShaderManager::get_result_texture() const {
+    if (passes_dirty) plan_passes();
+    return *result_target().texture;
+}
+
+
+void ShaderManager::set_fixed_time(std::optional<float> seconds) {
+    fixed_time = seconds;
+}
+
+
+void ShaderManager::redraw_from(size_t index) {
+    if (passes_dirty) plan_passes();
+    for (size_t p = 0; p < passes.size(); p++) {
+        if (index < passes[p].first + passes[p].count) {
+            targets[p].stamp = 0;
+            return;
         }
     }
 }
 
 
+void ShaderManager::request_readback(ReadbackRing::Callback callback) {
+    readback_requests.push_back(std::move(callback));
+}
+
+
+bool ShaderManager::is_compiling() const {
+    if (ctx.resource_manager.is_compiling()) return true;
+    if (passes_dirty) plan_passes();
+    for (const Pass& pass : passes) {
+        bool compiling = pass.fused_pipeline ? pass.fused_pipeline->render_pipeline->is_compiling()
+                                             : shaders[pass.first]->apply([](auto& s) { return s.is_compiling(); });
+        if (compiling) return true;
+    }
+    return false;
+}
+
+
 void ShaderManager::resize(unsigned int new_width, unsigned int new_height) {
     ctx.render_target.dim = std::array<unsigned int, 2>({new_width, new_height});
     init();
 }
 
 
+void ShaderManager::add_shader(std::unique_ptr<ShaderUnion>&& shader_ptr) {
+    assert(shader_ptr.get()->tag != ShaderUnion::Tag::None);
+
+    uint32_t offset = uniform_arena.allocate();
+    if (uniform_arena.get_generation() != arena_generation) rebind_uniforms();
+
+    shaders.push_back(std::forward<std::unique_ptr<ShaderUnion>>(shader_ptr));
+    auto& shader = shaders[shaders.size() - 1];
+    shader->apply([&](auto& s) { s.uniforms_offset = offset; });
+    shader->apply([&](auto& s) { s.init(); });
+    shader->apply([&](auto& s) { s.bind_uniforms(uniform_arena); });
+    shader->apply([&](auto& s) { s.init_pipeline(*default_bind_group_layout); });
+    passes_dirty = true;
+}
+
+
+bool ShaderManager::add_default_shader(ShaderKind kind) {
+    bool added = false;
+#define X(name) added = try_add_default_shader<ShaderKind::name>(kind) || added
+    (SHADER_KINDS);
+#undef X
+    return added;
+}
+
+
+void ShaderManager::save_chain(std::ostream& out) const {
+    write_chain_header(out);
+    for (const std::unique_ptr<ShaderUnion>& shader : shaders) {
+        ShaderKind kind = static_cast<ShaderKind>(shader->tag);
+        shader->apply([&](const auto& s) {
+            using S = std::remove_cvref_t<decltype(s)>;
+            if constexpr (sizeof(S::RESOURCES) != 0) {
+                Log::warn("Stage \"{}\" uses resources, it is not saved in the chain.", s.name);
+            } else {
+                write_stage(out, kind, std::as_bytes(std::span(&s.uniforms, 1)));
+            }
+        });
+    }
+}
+
+
+bool ShaderManager::load_chain(std::istream& in) {
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        if (!(fields >> name) || name.starts_with('#')) continue;
+        if (name == CHAIN_MAGIC) {
+            if (!read_chain_header(fields)) return false;
+            continue;
+        }
+
+        std::optional<ShaderKind> kind = shader_kind_from_name(name);
+        if (!kind || !add_default_shader(kind.value())) {
+            Log::error("Unknown chain stage \"{}\".", name);
+            return false;
+        }
+
+        bool loaded = shaders.back()->apply([&](auto& s) {
+            return read_stage(fields, kind.value(), std::as_writable_bytes(std::span(&s.uniforms, 1)));
+        });
+        if (!loaded) {
+            Log::error("Malformed parameters of chain stage \"{}\".", name);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// The arena buffer was recreated to grow, every bind group pointing to the previous one is rebuilt
+void ShaderManager::rebind_uniforms() {
+    blank_target.bind_group = make_default_bind_group(*blank_target.texture_view);
+    for (PassTarget& target : targets) {
+        if (target.texture_view) target.bind_group = make_default_bind_group(*target.texture_view);
+    }
+    for (std::unique_ptr<ShaderUnion>& s : shaders) {
+        s->apply([&](auto& s) { s.bind_uniforms(uniform_arena); });
+    }
+    passes_dirty = true;  // fused bind groups
+    arena_generation = uniform_arena.get_generation();
+}
+
+
 void ShaderManager::reorder_element(size_t index, size_t new_index) {
     if (index < new_index) {
         std::rotate(shaders.begin() + index, shaders.begin() + index + 1, shaders.begin() + new_index + 1);
     } else {
         std::rotate(shaders.begin() + new_index, shaders.begin() + index, shaders.begin() + index + 1);
     }
+    passes_dirty = true;
+}
+
+
+void ShaderManager::plan_passes() const {
+    PROFILE_ZONE("ShaderManager::plan_passes");
+    passes.clear();
+
+    std::vector<FusedStage> run;
+    auto flush_run = [&](size_t end) {
+        if (run.size() == 1) {
+            passes.push_back(Pass{.first = end - 1, .count = 1});
+        } else if (run.size() > 1) {
+            const FusedPipeline& pipeline = fused_pipelines.get(run, *default_bind_group_layout);
+            passes.push_back(Pass{
+                .first = end - run.size(),
+                .count = run.size(),
+                .fused_pipeline = &pipeline,
+                .fused_bind_group = fused_pipelines.make_bind_group(pipeline, run),
+            });
+        }
+        run.clear();
+    };
+
+    for (size_t i = 0; i < shaders.size(); i++) {
+        ShaderKind kind = static_cast<ShaderKind>(shaders[i]->tag);
+        std::optional<FusedStage> stage = shaders[i]->apply([&](auto& s) -> std::optional<FusedStage> {
+            using S = std::remove_cvref_t<decltype(s)>;
+            if constexpr (S::POINTWISE) {
+                return FusedStage{
+                    .kind = kind,
+                    .source = s.frag_source.code,
+                    .effect_function = S::effect_function,
+                    .effect_uniforms = S::effect_uniforms,
+                    .uniforms_buffer = s.uniforms_buffer,
+                    .uniforms_offset = s.uniforms_offset,
+                    .uniforms_size = sizeof(typename S::Uniforms),
+                };
+            } else {
+                return std::nullopt;
+            }
+        });
+
+        if (!fuse_pointwise || !stage) {
+            flush_run(i);
+            passes.push_back(Pass{.first = i, .count = 1});
+            continue;
+        }
+
+        run.push_back(stage.value());
+        if (run.size() == FusedPipelineCache::MAX_RUN_LENGTH) flush_run(i + 1);
+    }
+    flush_run(shaders.size());
+
+    // targets are matched by index, stamps tell whether their content still fits the new plan
+    targets.resize(passes.size());
+    for (PassTarget& target : targets) {
+        if (!target.texture) target = make_target();
+    }
+    pass_timer.clear();  // durations now refer to other passes
+
+    passes_dirty = false;
 }
 
 
 void ShaderManager::render() const {
+    render_chain();
+    display_render_result();
+}
+
+
+void ShaderManager::render_chain() const {
+    PROFILE_ZONE("ShaderManager::render_chain");
     unsigned int& width = ctx.render_target.dim[0];
     unsigned int& height = ctx.render_target.dim[1];
 
-    assert(*texture_view_A && *texture_view_B);
-    wgpu::TextureView tv = *texture_view_A;
     DefaultUniforms du = {
         width,
         height,
-        std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start_time).count()
+        fixed_time.value_or(
+            std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start_time).count()
+        )
     };
 
-    wgpu::raii::Queue queue = ctx.gpu.get_device().getQueue();
+    // removed resources no stage draws are destroyed, completed image uploads, completed mip chains, new video frames
+    // and streamed tiles rebind their stages, which marks them dirty below
+    {
+        PROFILE_ZONE("resource updates");
+        ctx.resource_manager.collect_removed();
+        ctx.resource_manager.upload_loaded_images();
+        ctx.resource_manager.upload_bands();
+        ctx.resource_manager.generate_mipmaps();
+        ctx.resource_manager.generate_thumbnails();
+        ctx.resource_manager.advance_videos(du.time, fixed_time.has_value());
+        for (const std::unique_ptr<ShaderUnion>& s : shaders) {
+            if (s->is_current<Shader<ShaderKind::Image>>()) {
+                s->get<Shader<ShaderKind::Image>>().request_tiles(ctx.resource_manager);
+            }
+        }
+        ctx.resource_manager.stream_tiles();
+    }
 
-    queue->writeBuffer(*default_uniforms, 0, &du, sizeof(du));
-    for (size_t i = 0; i < shaders.size(); i++) {
-        shaders[i]->apply([&](auto& shader) { shader.write_buffers(*queue); });
+    if (passes_dirty) plan_passes();
+
+    // Stamp passes, each stamp chains the previous one so everything after the first change is dirty too
+    std::vector<uint64_t> stamps(passes.size());
+    size_t first_dirty = passes.size();
+    uint64_t stamp = fnv1a_value(du.viewport_width, fnv1a_value(du.viewport_height));
+    for (size_t p = 0; p < passes.size(); p++) {
+        stamp = fnv1a_value(passes[p].count, stamp);
+        for (size_t i = passes[p].first; i < passes[p].first + passes[p].count; i++) {
+            stamp = shaders[i]->apply([&](auto& s) {
+                uint64_t h = fnv1a_value(s.bindings_version, fnv1a_value(s.uniforms, stamp));
+                return s.is_dynamic() ? fnv1a_value(du.time, h) : h;
+            });
+        }
+        stamps[p] = stamp;
+        if (first_dirty == passes.size() && targets[p].stamp != stamp) first_dirty = p;
+    }
+    rendered_passes = passes.size() - first_dirty;
+
+    // Passes whose pipeline is still compiling are replaced by a copy of their input, timestamps frame drawn ones
+    std::vector<wgpu::RenderPipeline> pipelines(passes.size());
+    size_t first_drawn = passes.size();
+    size_t last_drawn = passes.size();
+    for (size_t p = first_dirty; p < passes.size(); p++) {
+        pipelines[p] = passes[p].fused_pipeline
+                           ? passes[p].fused_pipeline->render_pipeline->get()
+                           : shaders[passes[p].first]->apply([](auto& s) { return s.get_render_pipeline(); });
+        if (!pipelines[p]) continue;
+        if (first_drawn == passes.size()) first_drawn = p;
+        last_drawn = p;
     }
 
-    wgpu::RenderPassColorAttachment color_attachment;
-    color_attachment.loadOp = wgpu::LoadOp::Clear;
-    color_attachment.storeOp = wgpu::StoreOp::Store;
-    color_attachment.clearValue = {0.0f, 0.0f, 0.0f, 1.0f};
-    color_attachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+    if (rendered_passes > 0 || !blank_cleared || !readback_requests.empty()) {
+        wgpu::raii::Queue queue = ctx.gpu.get_device().getQueue();
 
-    wgpu::RenderPassDescriptor render_pass_desc;
-    render_pass_desc.colorAttachmentCount = 1;
-    render_pass_desc.colorAttachments = &color_attachment;
-    render_pass_desc.depthStencilAttachment = nullptr;
+        {
+            PROFILE_ZONE("write uniforms");
+            uniform_arena.write(default_uniforms_offset, &du, sizeof(du));
+            size_t first_dirty_shader = first_dirty < passes.size() ? passes[first_dirty].first : shaders.size();
+            for (size_t i = first_dirty_shader; i < shaders.size(); i++) {
+                shaders[i]->apply([&](auto& shader) { shader.write_uniforms(uniform_arena); });
+            }
+            uniform_arena.upload(*queue);
+        }
 
-    wgpu::raii::CommandEncoder cmd_encoder = ctx.gpu.get_device().createCommandEncoder();
+        PROFILE_ZONE("encode and submit passes");
 
-    // Clear previous render
-    color_attachment.view = *texture_view_A;
-    cmd_encoder->beginRenderPass(render_pass_desc).end();
+        wgpu::RenderPassColorAttachment color_attachment;
+        color_attachment.loadOp = wgpu::LoadOp::Clear;
+        color_attachment.storeOp = wgpu::StoreOp::Store;
+        color_attachment.clearValue = {0.0f, 0.0f, 0.0f, 1.0f};
+        color_attachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
 
-    for (size_t i = 0; i < shaders.size(); i++) {
-        tv = i % 2 ? *texture_view_A : *texture_view_B;
-        wgpu::BindGroup default_bg = i % 2 ? *bind_group_B : *bind_group_A;
+        wgpu::RenderPassDescriptor render_pass_desc;
+        render_pass_desc.colorAttachmentCount = 1;
+        render_pass_desc.colorAttachments = &color_attachment;
+        render_pass_desc.depthStencilAttachment = nullptr;
 
-        color_attachment.view = tv;
+        wgpu::raii::CommandEncoder cmd_encoder = ctx.gpu.get_device().createCommandEncoder();
 
-        wgpu::raii::RenderPassEncoder pass_encoder = cmd_encoder->beginRenderPass(render_pass_desc);
+        if (!blank_cleared) {
+            color_attachment.view = *blank_target.texture_view;
+            cmd_encoder->beginRenderPass(render_pass_desc).end();
+            blank_cleared = true;
+        }
 
-        pass_encoder->setViewport(0.0f, 0.0f, width, height, 0.0f, 1.0f);
-        pass_encoder->setScissorRect(0, 0, width, height);
-        pass_encoder->setBindGroup(0, default_bg, 0, nullptr);
-        shaders[i]->apply([&](auto& s) { s.set_bind_groups(*pass_encoder); });
-        pass_encoder->setPipeline(shaders[i]->apply([](auto& s) { return s.get_render_pipeline(); }));
-        pass_encoder->draw(3, 1, 0, 0);
-        pass_encoder->end();
-    }
+        pass_timer.reserve(static_cast<uint32_t>(passes.size()));  // grows once no readback uses the queries
+        for (size_t p = first_dirty; p < passes.size(); p++) {
+            const Pass& pass = passes[p];
+            const PassTarget& input = p == 0 ? blank_target : targets[p - 1];
 
-    wgpu::raii::CommandBuffer cmd_buffer = cmd_encoder->finish();
-    queue->submit(1, &(*cmd_buffer));
+            if (!pipelines[p]) {
+#ifdef __EMSCRIPTEN__
+                wgpu::ImageCopyTexture source, destination;
+#else
+                wgpu::TexelCopyTextureInfo source, destination;
+#endif
+                source.texture = *input.texture;
+                destination.texture = *targets[p].texture;
+                cmd_encoder->copyTextureToTexture(source, destination, {width, height, 1});
+                targets[p].stamp = 0;  // drawn for real once compiled
+                continue;
+            }
 
-    display_render_result();
+            color_attachment.view = *targets[p].texture_view;
+
+            wgpu::RenderPassTimestampWrites timestamp_writes = pass_timer.timestamp_writes(p, true, true);
+            render_pass_desc.timestampWrites = pass_timer.has_scope(p) ? &timestamp_writes : nullptr;
+
+            wgpu::raii::RenderPassEncoder pass_encoder = cmd_encoder->beginRenderPass(render_pass_desc);
+
+            pass_encoder->setViewport(0.0f, 0.0f, width, height, 0.0f, 1.0f);
+            pass_encoder->setScissorRect(0, 0, width, height);
+            pass_encoder->setBindGroup(0, *input.bind_group, 0, nullptr);
+            if (pass.fused_pipeline) {
+                pass_encoder->setBindGroup(1, *pass.fused_bind_group, 0, nullptr);
+            } else {
+                shaders[pass.first]->apply([&](auto& s) { s.set_bind_groups(*pass_encoder); });
+            }
+            pass_encoder->setPipeline(pipelines[p]);
+            pass_encoder->draw(3, 1, 0, 0);
+            pass_encoder->end();
+
+            targets[p].stamp = stamps[p];
+        }
+
+        if (first_drawn < passes.size()) {
+            pass_timer.resolve(*cmd_encoder, first_drawn, last_drawn - first_drawn + 1);
+        }
+
+        // requests that find no free slot wait for the next frame
+        std::erase_if(readback_requests, [&](ReadbackRing::Callback& callback) {
+            return readback.enqueue(*cmd_encoder, *result_target().texture, width, height, std::move(callback));
+        });
+
+        wgpu::raii::CommandBuffer cmd_buffer = cmd_encoder->finish();
+        PROFILE_ZONE("submit passes");
+        queue->submit(1, &(*cmd_buffer));
+        readback.flush();
+
+        pass_timer.read_back();
+    }
 }
 
 
 
+void ShaderManager::render_chain_streamed() const {
+    do {
+        render_chain();
+    } while (!ctx.resource_manager.tiles_streamed());
+}
+
+
 void ShaderManager::display_render_result() const {
+    PROFILE_ZONE("ShaderManager::display_render_result");
     unsigned int& width = ctx.render_target.dim[0];
     unsigned int& height = ctx.render_target.dim[1];
 
@@ -277,13 +573,24 @@ void ShaderManager::display_render_result() const {
 
     ImGui::Image(
         reinterpret_cast<ImTextureID>(
-            static_cast<WGPUTextureView>((shaders.size() % 2) ? *texture_view_B : *texture_view_A)
+            static_cast<WGPUTextureView>(*result_target().texture_view)
         ),
         display_dim
     );
 
     ImGui::SetCursorPos(ImVec2(20, 20));
     ImGui::Text("fps: %.1f", ImGui::GetIO().Framerate);
+    ImGui::SetCursorPosX(20);
+    ImGui::Text(
+        "pipeline cache: %zu hits / %zu misses", ctx.pipeline_cache.stats.hits, ctx.pipeline_cache.stats.misses
+    );
+    if (pass_timer.is_supported()) {
+        // each pass counts with its last measured draw, the total is the cost of redrawing the whole chain
+        double total_ms = 0.0;
+        for (size_t p = 0; p < passes.size(); p++) total_ms += pass_timer.get_ms(p);
+        ImGui::SetCursorPosX(20);
+        ImGui::Text("chain gpu: %.0f us (%zu/%zu passes rendered)", total_ms * 1e3, rendered_passes, passes.size());
+    }
 }
 
 
@@ -331,8 +638,56 @@ static void rename_popup(std::string& name) {
     }
 }
 
+void ShaderManager::export_frame(std::string name, std::vector<uint8_t> pixels, uint32_t width, uint32_t height) {
+#ifdef __EMSCRIPTEN__
+    save_image(name, pixels.data(), width, height);
+#else
+    // encoding and disk writes stay off the render thread, the destructor waits for them
+    if (!exporter) exporter = std::make_unique<ThreadPool>(1);
+    exporter->submit([name = std::move(name), pixels = std::move(pixels), width, height]() {
+        save_image(name, pixels.data(), width, height);
+    });
+#endif
+}
+
 void ShaderManager::display() {
+    PROFILE_ZONE("ShaderManager::display");
+    if (ImGui::Checkbox("fuse pointwise stages", &fuse_pointwise)) passes_dirty = true;
+    ImGui::SameLine();
+    if (ImGui::Button("export frame")) {
+        static size_t export_count = 0;
+        request_readback([this, name = std::format("moshading_{}", export_count++)](const ReadbackRing::Frame& frame) {
+            std::vector<uint8_t> pixels(static_cast<size_t>(frame.width) * frame.height * 4);
+            for (size_t y = 0; y < frame.height; y++) {
+                std::memcpy(
+                    pixels.data() + y * frame.width * 4, frame.pixels + y * frame.bytes_per_row, frame.width * 4
+                );
+            }
+            export_frame(name, std::move(pixels), frame.width, frame.height);
+        });
+    }
+
     int to_remove_idx = -1;  // store shader idx user decided to remove or -1 if no remove action
+
+    // stages waiting for their own pipeline or for the fused one of their pass
+    std::vector<bool> compiling(shaders.size(), false);
+    for (size_t i = 0; i < shaders.size(); i++) {
+        compiling[i] = shaders[i]->apply([](auto& s) { return s.is_compiling(); });
+    }
+    if (!passes_dirty) {
+        for (const Pass& pass : passes) {
+            if (!pass.fused_pipeline || !pass.fused_pipeline->render_pipeline->is_compiling()) continue;
+            std::fill_n(compiling.begin() + pass.first, pass.count, true);
+        }
+    }
+    // pass drawing each stage, its gpu time is shown on every stage it fuses
+    std::vector<size_t> stage_pass(shaders.size(), passes.size());
+    bool show_timings = !passes_dirty && pass_timer.is_supported();
+    if (show_timings) {
+        for (size_t p = 0; p < passes.size(); p++) {
+            std::fill_n(stage_pass.begin() + passes[p].first, passes[p].count, p);
+        }
+    }
     for (size_t i = 0; i < shaders.size(); i++) {
         std::unique_ptr<ShaderUnion>& shader = shaders[i];
 
@@ -359,6 +714,22 @@ void ShaderManager::display() {
             }
             rename_popup(shader_name);
 
+            if (compiling[i]) {
+                ImGui::SameLine();
+                ImGui::TextDisabled("compiling...");
+            } else if (show_timings && stage_pass[i] < passes.size()) {
+                double ms = pass_timer.get_ms(stage_pass[i]);
+                size_t fused = passes[stage_pass[i]].count;
+                ImGui::SameLine();
+                if (ms == 0.0) {
+                    ImGui::TextDisabled("gpu: -");  // not drawn since the last plan
+                } else if (fused > 1) {
+                    ImGui::TextDisabled("gpu: %.0f us (%zu fused)", ms * 1e3, fused);
+                } else {
+                    ImGui::TextDisabled("gpu: %.0f us", ms * 1e3);
+                }
+            }
+
             // Push all the way to the right
             ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
 
@@ -412,7 +783,9 @@ void ShaderManager::display() {
         ImGui::PopID();
     }
     if (to_remove_idx >= 0) {
+        uniform_arena.release(shaders[to_remove_idx]->apply([](auto& s) { return s.uniforms_offset; }));
         shaders.erase(shaders.begin() + to_remove_idx);
+        passes_dirty = true;
     }
 
 
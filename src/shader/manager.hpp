@@ -2,8 +2,11 @@
 
 #include <chrono>
 #include <coroutine>
+#include <istream>
 #include <memory>
 #include <optional>
+#include <ostream>
+#include <string>
 #include <thread>
 #include <tuple>
 #include <utility>
@@ -12,45 +15,68 @@
 
 #include "imgui.h"
 #include "imgui_internal.h"
+#include "fusion.hpp"
 #include "shader.hpp"
 #include "shaders/chromatic_aberration.hpp"
 #include "shaders/dithering.hpp"
 #include "shaders/image.hpp"
 #include "shaders/noise.hpp"
 #include "src/context.hpp"
+#include "src/context/gpu_timer.hpp"
+#include "src/context/readback.hpp"
 #include "src/context/resource.hpp"
 #include "src/file_loader.hpp"
+#include "src/hash.hpp"
 #include "src/log.hpp"
 #include "src/shader/parameter.hpp"
+#include "src/shader/uniform_arena.hpp"
+#include "src/thread_pool.hpp"
 
 struct ShaderManager {
     Context& ctx;
 
     ShaderManager(Context& ctx);
+    ~ShaderManager();
 
     ShaderManager(const ShaderManager&) = delete;
     ShaderManager(ShaderManager&&) = delete;
 
     void display();
     void render() const;
+    void render_chain() const;  // GPU work of `render`, without any UI
+    // For offline outputs: renders the chain again until the tiles of images larger than the device limit are all
+    // resident, a frame only streams a few and draws the missing ones from coarser levels.
+    void render_chain_streamed() const;
+
+    void resize(unsigned int new_width, unsigned int new_height);
+    wgpu::Texture get_result_texture() const;
+
+    // Copies the result of the next rendered frame into the readback ring, the callback runs once the copy is mapped,
+    // a few frames later. The render thread never waits on it.
+    void request_readback(ReadbackRing::Callback callback);
+    bool is_compiling() const;  // whether some pass, or mip generation, still waits for its pipeline
+
+    // Time seen by the shaders, in seconds. Set, it replaces the wall clock so frames can be rendered reproducibly and
+    // faster than real time, e.g. from a frame counter. Cleared, time runs from the construction of the manager.
+    void set_fixed_time(std::optional<float> seconds);
+    // Drops the cached output of the pass drawing stage `index`, the next render draws it and every later pass again.
+    // For measurements, a normal frame only redraws what changed.
+    void redraw_from(size_t index);
 
 
     template <ShaderUnionConcept S, typename... Args>
     void add_shader(Args&&... args) {  // TODO move to private when ui is here
-        shaders.push_back(std::make_unique<ShaderUnion>());
-        auto& shader = shaders[shaders.size() - 1];
+        auto shader = std::make_unique<ShaderUnion>();
         shader->set<S>(args...);
-        shader->apply([&](auto& s) { s.init(); });
-        shader->apply([&](auto& s) { s.init_pipeline(*default_bind_group_layout); });
+        add_shader(std::move(shader));
     }
 
-    void add_shader(std::unique_ptr<ShaderUnion>&& shader_ptr) {  // TODO move to private when ui is here
-        assert(shader_ptr.get()->tag != ShaderUnion::Tag::None);
-        shaders.push_back(std::forward<std::unique_ptr<ShaderUnion>>(shader_ptr));
-        auto& shader = shaders[shaders.size() - 1];
-        shader->apply([&](auto& s) { s.init(); });
-        shader->apply([&](auto& s) { s.init_pipeline(*default_bind_group_layout); });
-    }
+    void add_shader(std::unique_ptr<ShaderUnion>&& shader_ptr);  // TODO move to private when ui is here
+    bool add_default_shader(ShaderKind kind);  // false for kinds that need resources
+
+    // Chain description, one `<kind> <uniforms bytes in hex>` line per stage, stages using resources are not saved.
+    void save_chain(std::ostream& out) const;
+    bool load_chain(std::istream& in);  // appends the described stages, false on malformed lines
 
     void reorder_element(size_t index, size_t new_index);  // TODO move to private when ui is here
 
@@ -70,28 +96,67 @@ struct ShaderManager {
 
     mutable DisplayState display_state{1.0, 0.0, 0.0};
 
+
+    // One render pass of the chain, drawing either a single shader or a fused run of pointwise ones.
+    struct Pass {
+        size_t first;
+        size_t count;
+        const FusedPipeline* fused_pipeline = nullptr;
+        wgpu::raii::BindGroup fused_bind_group;
+    };
+
     size_t selected_shader = 0;
     bool adding_shader = false;
 
     wgpu::raii::BindGroupLayout default_bind_group_layout;
     wgpu::raii::Sampler sampler;
-    wgpu::raii::Buffer default_uniforms;
 
-    wgpu::raii::Texture texture_A;
-    wgpu::raii::TextureView texture_view_A;
-    wgpu::raii::BindGroup bind_group_A;
+    // uniforms of every shader plus the default ones, uploaded with a single write per frame
+    mutable UniformArena uniform_arena;
+    uint64_t arena_generation = 0;  // generation the bind groups were built against
+    uint32_t default_uniforms_offset;
+
+    // Cached output of a pass. It is only rendered again when its stamp, derived from the stamp of the previous pass,
+    // the uniforms of its shaders and their time dependence, changes.
+    struct PassTarget {
+        wgpu::raii::Texture texture;
+        wgpu::raii::TextureView texture_view;
+        wgpu::raii::BindGroup bind_group;  // default bind group sampling this output, used by the next pass
+        uint64_t stamp = 0;                // 0 when never rendered
+    };
 
-    wgpu::raii::Texture texture_B;
-    wgpu::raii::TextureView texture_view_B;
-    wgpu::raii::BindGroup bind_group_B;
+    PassTarget blank_target;  // input of the first pass
+    mutable bool blank_cleared = false;
 
     std::vector<std::unique_ptr<ShaderUnion>> shaders;
 
+    bool fuse_pointwise = true;
+    mutable FusedPipelineCache fused_pipelines;
+    mutable std::vector<Pass> passes;
+    mutable std::vector<PassTarget> targets;  // one per pass, kept across planning so unchanged prefixes survive
+    mutable bool passes_dirty = true;         // set whenever the chain composition or order changes
+    mutable size_t rendered_passes = 0;       // passes actually drawn on the last frame
+
+    mutable GpuTimer pass_timer;  // one scope per pass, cleared by every plan
+
+    static constexpr size_t READBACK_SLOTS = 3;
+    mutable ReadbackRing readback;
+    mutable std::vector<ReadbackRing::Callback> readback_requests;  // waiting for a free slot or the next frame
+#ifndef __EMSCRIPTEN__
+    std::unique_ptr<ThreadPool> exporter;  // encodes and writes exported frames, created on the first export
+#endif
+
     std::chrono::time_point<std::chrono::high_resolution_clock> start_time;
+    std::optional<float> fixed_time;
 
     void init();
+    void rebind_uniforms();
+    void plan_passes() const;
+    PassTarget make_target() const;
+    wgpu::raii::BindGroup make_default_bind_group(const wgpu::TextureView& input) const;
+    const PassTarget& result_target() const;
     void display_render_result() const;
-    void resize(unsigned int new_width, unsigned int new_height);
+    void export_frame(std::string name, std::vector<uint8_t> pixels, uint32_t width, uint32_t height);
 
     void creation_dialog(ShaderKind k) {
 #define X(name)                                               \
@@ -102,39 +167,56 @@ struct ShaderManager {
 #undef X
     }
 
+    template <ShaderKind K>
+        requires(sizeof(Shader<K>::RESOURCES) == 0)
+    bool try_add_default_shader(ShaderKind k) {
+        if (k != K) return false;
+        add_shader<Shader<K>>(Shader<K>::default_name, ctx);
+        return true;
+    }
+
+    template <ShaderKind K>
+        requires(sizeof(Shader<K>::RESOURCES) != 0)
+    bool try_add_default_shader(ShaderKind) {
+        return false;
+    }
+
     template <ShaderKind K>
     requires(sizeof(Shader<K>::RESOURCES) != 0)
     bool try_creation_dialog(ShaderKind k) {
-        static const char* selected_name= "";
-        static size_t selected = 0;
-        static size_t selected_id = ~0u;
+        static std::string selected_name;
+        static std::optional<size_t> selected_id;
 
         if (k == K) {
-            bool change = ImGui::BeginCombo("selected image", selected_name);
-            if (change) {
-                size_t current = 0;
-                for (auto& [id, index]: ctx.resource_manager.images_index_map) {
-                    const bool is_selected = (selected == current++);
-
-                    if (ImGui::Selectable(ctx.resource_manager.images[index].name.c_str(), is_selected)) {
-                        selected_name = ctx.resource_manager.images[index].name.c_str();
-                        selected = current;
+            // the selected image may have been removed and collected since the last frame
+            bool listed = false;
+            ctx.resource_manager.for_each_texture([&](size_t id, const std::string&) { listed |= id == selected_id; });
+            if (!listed) {
+                selected_name.clear();
+                selected_id.reset();
+            }
+
+            if (ImGui::BeginCombo("selected image", selected_name.c_str())) {
+                ctx.resource_manager.for_each_texture([&](size_t id, const std::string& name) {
+                    const bool is_selected = id == selected_id;
+
+                    if (ImGui::Selectable(name.c_str(), is_selected)) {
+                        selected_name = name;
                         selected_id = id;
-                    };
+                    }
 
                     if (is_selected) {
                         ImGui::SetItemDefaultFocus();
                     }
-                }
+                });
                 ImGui::EndCombo();
             }
 
-            ImGui::BeginDisabled(selected_id == ~0u);
+            ImGui::BeginDisabled(!selected_id);
             if (ImGui::Button("Add")) {
-                add_shader<Shader<K>>(ctx.resource_manager.get_image(selected_id).name, selected_id, ctx);
-                selected_name = "";
-                selected = 0;
-                selected_id = ~0u;
+                add_shader<Shader<K>>(ctx.resource_manager.get_name(*selected_id), *selected_id, ctx);
+                selected_name.clear();
+                selected_id.reset();
             }
             ImGui::EndDisabled();
 
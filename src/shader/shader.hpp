@@ -2,11 +2,17 @@
 
 #include <imgui.h>
 
+#include <cstddef>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 #include <webgpu/webgpu-raii.hpp>
 
 #include "src/context.hpp"
+#include "src/shader/uniform_arena.hpp"
 #include "src/tagged_union.hpp"
 
 #define SHADER_KINDS X(ChromaticAbberation), X(Image), X(Noise), X(Dithering)
@@ -15,88 +21,88 @@
 enum class ShaderKind { SHADER_KINDS };
 #undef X
 
+inline const char* shader_kind_name(ShaderKind kind) {
+#define X(kind) #kind
+    constexpr const char* names[] = {SHADER_KINDS};
+#undef X
+    return names[static_cast<size_t>(kind)];
+}
+
+inline std::optional<ShaderKind> shader_kind_from_name(std::string_view name) {
+#define X(kind) std::pair<std::string_view, ShaderKind>(#kind, ShaderKind::kind)
+    for (auto [kind_name, kind] : {SHADER_KINDS}) {
+        if (kind_name == name) return kind;
+    }
+#undef X
+    return std::nullopt;
+}
+
+
+// A parameter of saved chains: `count` 4 byte values at `offset` in the uniforms (see chain_format.hpp).
+struct UniformField {
+    enum class Type { Float, Uint, Int };
+
+    const char* name;
+    Type type;
+    size_t offset;
+    size_t count = 1;
+};
+
 
 template <typename Derived>
 struct ShaderBase {
     constexpr static const ResourceKind RESOURCES[0] = {};
+    constexpr static const UniformField UNIFORM_FIELDS[0] = {};  // saved in chains
     constexpr static const char* const default_name = "unamed shader";
+    // pointwise shaders only read the input texel under the fragment, they can be fused (see fusion.hpp)
+    constexpr static const bool POINTWISE = false;
     const std::shared_ptr<void> lifetime_token; // lifetime tracker used for auto unsubscription to resources updates
 
     const Context& ctx;
     std::string name;
     const ShaderSource& vertex_source;
     const ShaderSource& frag_source;
+    uint64_t bindings_version = 0;  // bumped when bind groups are rebuilt, invalidates cached outputs
+    // slot of the uniforms in the manager's arena, set by the manager before `bind_uniforms`
+    wgpu::Buffer uniforms_buffer;
+    uint32_t uniforms_offset = 0;
 
     ShaderBase(const ShaderBase<Derived>& sb) = delete;
     ShaderBase(ShaderBase<Derived>&& sb) = delete;
 
+    void init() {}
+
     void init_pipeline(const wgpu::BindGroupLayout& default_bind_group_layout) {
-        wgpu::VertexState vertex_state;
-        vertex_state.module = *vertex_source.compiled_module;
-#ifdef __EMSCRIPTEN__
-        vertex_state.entryPoint = "vs_main";
-#else
-        vertex_state.entryPoint.data = "vs_main";
-        vertex_state.entryPoint.length = WGPU_STRLEN;
-#endif
-        vertex_state.bufferCount = 0;
-        vertex_state.buffers = nullptr;
-        vertex_state.constantCount = 0;
-        vertex_state.constants = nullptr;
-
-        wgpu::ColorTargetState color_target;
-        color_target.format = wgpu::TextureFormat::RGBA8Unorm;
-        color_target.writeMask = wgpu::ColorWriteMask::All;
-        color_target.blend = nullptr;
-
-        wgpu::FragmentState frag_state;
-        frag_state.module = *frag_source.compiled_module;
-#ifdef __EMSCRIPTEN__
-        frag_state.entryPoint = "fs_main";
-#else
-        frag_state.entryPoint.data = "fs_main";
-        frag_state.entryPoint.length = WGPU_STRLEN;
-#endif
-        frag_state.constantCount = 0;
-        frag_state.constants = nullptr;
-        frag_state.targetCount = 1;
-        frag_state.targets = &color_target;
-
-        // // render pipeline setup
-        wgpu::raii::PipelineLayout pipeline_layout = make_pipeline_layout(ctx, default_bind_group_layout);
-
-        wgpu::RenderPipelineDescriptor pipeline_desc;
-        pipeline_desc.layout = *pipeline_layout;
-        pipeline_desc.vertex = vertex_state;
-        pipeline_desc.fragment = &frag_state;
-        pipeline_desc.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
-        pipeline_desc.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
-        pipeline_desc.primitive.frontFace = wgpu::FrontFace::CCW;
-        pipeline_desc.primitive.cullMode = wgpu::CullMode::None;
-        pipeline_desc.depthStencil = nullptr;
-        pipeline_desc.multisample.count = 1;
-        pipeline_desc.multisample.mask = ~0u;
-        pipeline_desc.multisample.alphaToCoverageEnabled = false;
-
-        render_pipeline = ctx.gpu.get_device().createRenderPipeline(pipeline_desc);
+        std::vector<wgpu::BindGroupLayout> layouts = get_bind_group_layouts(default_bind_group_layout);
+        render_pipeline = &ctx.pipeline_cache.get_render_pipeline(vertex_source, frag_source, layouts);
     }
 
+    // null while the pipeline compiles
     const wgpu::RenderPipeline get_render_pipeline() const {
-        return *render_pipeline;
+        return render_pipeline ? render_pipeline->get() : wgpu::RenderPipeline();
+    }
+
+    bool is_compiling() const {
+        return render_pipeline && render_pipeline->is_compiling();
+    }
+
+    // whether the output changes with time alone, such shaders are rendered every frame
+    bool is_dynamic() const {
+        return false;
     }
 
   protected:
-    wgpu::raii::RenderPipeline render_pipeline;
+    const AsyncPipeline* render_pipeline = nullptr;  // owned by the pipeline cache
 
     ShaderBase(
         const std::string& name, const ShaderSource& vertex_source, const ShaderSource& frag_source, const Context& ctx
     )
-        :  lifetime_token(), ctx(ctx), name(name), vertex_source(vertex_source), frag_source(frag_source) {}
+        :  lifetime_token(std::make_shared<char>()), ctx(ctx), name(name), vertex_source(vertex_source), frag_source(frag_source) {}
 
-    wgpu::raii::PipelineLayout make_pipeline_layout(
-        const Context& ctx, const wgpu::BindGroupLayout& default_bind_group_layout
-    ) {
-        return static_cast<Derived*>(this)->make_pipeline_layout(ctx, default_bind_group_layout);
+    std::vector<wgpu::BindGroupLayout> get_bind_group_layouts(
+        const wgpu::BindGroupLayout& default_bind_group_layout
+    ) const {
+        return static_cast<const Derived*>(this)->get_bind_group_layouts(default_bind_group_layout);
     }
 };
 
@@ -111,10 +117,11 @@ struct Shader : public ShaderBase<Shader<K>> {
     // functions to template specialize
     void init();
     void display();
-    void write_buffers(wgpu::Queue& queue) const;
-    wgpu::raii::PipelineLayout make_pipeline_layout(
-        const Context& ctx, const wgpu::BindGroupLayout& default_bind_group_layout
-    );
+    void bind_uniforms(UniformArena& arena);
+    void write_uniforms(UniformArena& arena) const;
+    std::vector<wgpu::BindGroupLayout> get_bind_group_layouts(
+        const wgpu::BindGroupLayout& default_bind_group_layout
+    ) const;
     void set_bind_groups(wgpu::RenderPassEncoder& pass_encoder) const;
 
     void reset();
@@ -130,23 +137,16 @@ template <ShaderKind K>
 void Shader<K>::display() {}
 
 template <ShaderKind K>
-void Shader<K>::write_buffers(wgpu::Queue& _) const {}
+void Shader<K>::bind_uniforms(UniformArena& _) {}
 
 template <ShaderKind K>
-wgpu::raii::PipelineLayout Shader<K>::make_pipeline_layout(
-    const Context& ctx, const wgpu::BindGroupLayout& default_bind_group_layout
-) {
-    wgpu::raii::PipelineLayout pipeline_layout;
-
-    WGPUBindGroupLayout bgls[1] = {default_bind_group_layout};
-
-    wgpu::PipelineLayoutDescriptor pipeline_layout_desc;
-    pipeline_layout_desc.bindGroupLayoutCount = 1;
-    pipeline_layout_desc.bindGroupLayouts = bgls;
+void Shader<K>::write_uniforms(UniformArena& _) const {}
 
-    pipeline_layout = ctx.gpu.get_device().createPipelineLayout(pipeline_layout_desc);
-
-    return pipeline_layout;
+template <ShaderKind K>
+std::vector<wgpu::BindGroupLayout> Shader<K>::get_bind_group_layouts(
+    const wgpu::BindGroupLayout& default_bind_group_layout
+) const {
+    return {default_bind_group_layout};
 }
 
 
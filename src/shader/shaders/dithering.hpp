@@ -13,6 +13,9 @@
 template <>
 struct Shader<ShaderKind::Dithering> : public ShaderBase<Shader<ShaderKind::Dithering>> {
     constexpr static const char* const default_name = "dithering";
+    constexpr static const bool POINTWISE = true;
+    constexpr static const char* const effect_function = "dithering_effect";
+    constexpr static const char* const effect_uniforms = "DitherUniforms";
     Shader(const std::string& name, const Context& ctx)
         : ShaderBase<Shader<ShaderKind::Dithering>>(
               name, ctx.shader_source_cache.get(fullscreen_vertex), ctx.shader_source_cache.get(dithering), ctx
@@ -38,60 +41,36 @@ struct Shader<ShaderKind::Dithering> : public ShaderBase<Shader<ShaderKind::Dith
         unsigned int bayer_steps = 3;
     };
 
+    constexpr static const UniformField UNIFORM_FIELDS[] = {
+        {"mode", UniformField::Type::Int, offsetof(Uniforms, mode)},
+        {"control", UniformField::Type::Uint, offsetof(Uniforms, control)},
+        {"threshold", UniformField::Type::Float, offsetof(Uniforms, threshold)},
+        {"threshold_rgb", UniformField::Type::Float, offsetof(Uniforms, threshold_rgb), 3},
+        {"random_min_rgb", UniformField::Type::Float, offsetof(Uniforms, random_min_rgb), 3},
+        {"random_max_rgb", UniformField::Type::Float, offsetof(Uniforms, random_max_rgb), 3},
+        {"random_min", UniformField::Type::Float, offsetof(Uniforms, random_min)},
+        {"random_max", UniformField::Type::Float, offsetof(Uniforms, random_max)},
+        {"halftone_scale", UniformField::Type::Float, offsetof(Uniforms, halftone_scale)},
+        {"halftone_angle", UniformField::Type::Float, offsetof(Uniforms, halftone_angle)},
+        {"bayer_steps", UniformField::Type::Uint, offsetof(Uniforms, bayer_steps)},
+    };
+
 
     Uniforms uniforms{};
 
     wgpu::raii::BindGroupLayout bind_group_layout;
-    wgpu::raii::Buffer buffer;
     wgpu::raii::BindGroup bind_group;
 
-    void init() {
-        wgpu::BindGroupLayoutEntry bgl_entry;
-        bgl_entry.binding = 0;
-        bgl_entry.visibility = wgpu::ShaderStage::Fragment;
-        bgl_entry.buffer.type = wgpu::BufferBindingType::Uniform;
-        bgl_entry.buffer.hasDynamicOffset = false;
-        bgl_entry.buffer.minBindingSize = sizeof(Uniforms);
-
-        wgpu::BindGroupLayoutDescriptor bgl_desc;
-        bgl_desc.entryCount = 1;
-        bgl_desc.entries = &bgl_entry;
-        bind_group_layout = ctx.gpu.get_device().createBindGroupLayout(bgl_desc);
-
-        wgpu::BufferDescriptor buffer_desc;
-        buffer_desc.usage = wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst;
-        buffer_desc.size = sizeof(Uniforms);
-        buffer_desc.mappedAtCreation = false;
-
-        buffer = ctx.gpu.get_device().createBuffer(buffer_desc);
-
-        wgpu::BindGroupEntry bg_uniforms_entry;
-        bg_uniforms_entry.binding = 0;
-        bg_uniforms_entry.buffer = *buffer;
-        bg_uniforms_entry.offset = 0;
-        bg_uniforms_entry.size = sizeof(Uniforms);
-
-        wgpu::BindGroupDescriptor bg_desc;
-        bg_desc.layout = *bind_group_layout;
-        bg_desc.entryCount = 1;
-        bg_desc.entries = &bg_uniforms_entry;
-
-        bind_group = ctx.gpu.get_device().createBindGroup(bg_desc);
+    void bind_uniforms(UniformArena& arena) {
+        uniforms_buffer = arena.get_buffer();
+        bind_group_layout = arena.layout(sizeof(Uniforms));
+        bind_group = arena.bind_group(sizeof(Uniforms));
     }
 
-    wgpu::raii::PipelineLayout make_pipeline_layout(
-        const Context& ctx, const wgpu::BindGroupLayout& default_bind_group_layout
-    ) {
-        wgpu::raii::PipelineLayout pipeline_layout;
-
-        WGPUBindGroupLayout bgls[2] = {default_bind_group_layout, *bind_group_layout};
-
-        wgpu::PipelineLayoutDescriptor pipeline_layout_desc;
-        pipeline_layout_desc.bindGroupLayoutCount = 2;
-        pipeline_layout_desc.bindGroupLayouts = bgls;
-        pipeline_layout = ctx.gpu.get_device().createPipelineLayout(pipeline_layout_desc);
-
-        return pipeline_layout;
+    std::vector<wgpu::BindGroupLayout> get_bind_group_layouts(
+        const wgpu::BindGroupLayout& default_bind_group_layout
+    ) const {
+        return {default_bind_group_layout, *bind_group_layout};
     }
 
 
@@ -141,11 +120,15 @@ struct Shader<ShaderKind::Dithering> : public ShaderBase<Shader<ShaderKind::Dith
         uniforms = {};
     }
 
-    void write_buffers(wgpu::Queue& queue) const {
-        queue.writeBuffer(*buffer, 0, &uniforms, sizeof(uniforms));
+    bool is_dynamic() const {
+        return uniforms.mode == Mode::Random && (uniforms.control & 2u);
+    }
+
+    void write_uniforms(UniformArena& arena) const {
+        arena.write(uniforms_offset, &uniforms, sizeof(uniforms));
     }
 
     void set_bind_groups(wgpu::RenderPassEncoder& pass_encoder) const {
-        pass_encoder.setBindGroup(1, *bind_group, 0, nullptr);
+        pass_encoder.setBindGroup(1, *bind_group, 1, &uniforms_offset);
     }
 };
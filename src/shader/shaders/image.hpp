@@ -3,8 +3,11 @@
 #include <imgui.h>
 #include <stb/stb_image.h>
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <optional>
 #include <webgpu/webgpu-raii.hpp>
 
@@ -28,6 +31,7 @@ struct Shader<ShaderKind::Image> : public ShaderBase<Shader<ShaderKind::Image>>
                 float pos_y;
                 float rotation;
                 float opacity;
+                uint32_t channels;  // of the resource texture, grey ones are swizzled to RGBA (see image.wgsl)
             };
             struct {
                 float size[2];
@@ -39,12 +43,14 @@ struct Shader<ShaderKind::Image> : public ShaderBase<Shader<ShaderKind::Image>>
         };
     };
 
-    const size_t image_index;
+    const size_t image_index;  // id of an image or video resource
+    const ResourceReference resource_reference;  // keeps the resource alive until the stage is deleted
+    // drawn through the virtual texture of an image larger than the device limit, see image_virtual.wgsl
+    const bool virtual_texture;
 
     Uniforms uniforms = {{{0.0, 0.0, 0.0, 0.0, 0.0, 1.0}}};
 
     wgpu::raii::BindGroupLayout bind_group_layout;
-    wgpu::raii::Buffer buffer;
     wgpu::raii::BindGroup bind_group;
 
     int base_height = -1;
@@ -67,12 +73,19 @@ struct Shader<ShaderKind::Image> : public ShaderBase<Shader<ShaderKind::Image>>
 
     Shader(const std::string& name, const size_t& image_index, const Context& ctx)
         : ShaderBase<Shader<ShaderKind::Image>>(
-              name, ctx.shader_source_cache.get(fullscreen_vertex), ctx.shader_source_cache.get(image), ctx
+              name,
+              ctx.shader_source_cache.get(fullscreen_vertex),
+              ctx.shader_source_cache.get(ctx.resource_manager.is_virtual(image_index) ? image_virtual : image),
+              ctx
           ),
           image_index(image_index),
+          resource_reference(ctx.resource_manager, image_index),
+          virtual_texture(ctx.resource_manager.is_virtual(image_index)),
           parameters(init_parameters(uniforms, render_dim)) {
-        ctx.resource_manager.get_image(image_index).subscribe([&]() {
+        // images notify on reload, videos on every new frame
+        ctx.resource_manager.subscribe(image_index, [&]() {
             update_image_base_dim();
+            uniforms.channels = ctx.resource_manager.get_channels(image_index);
             update_bind_group();
         }, *this);
     }
@@ -102,8 +115,9 @@ struct Shader<ShaderKind::Image> : public ShaderBase<Shader<ShaderKind::Image>>
         set_render_dim(ctx.render_target.dim);
 
         update_image_base_dim();
+        uniforms.channels = ctx.resource_manager.get_channels(image_index);
 
-        wgpu::BindGroupLayoutEntry bgl_entries[3];
+        wgpu::BindGroupLayoutEntry bgl_entries[6];
         // texture entry
         bgl_entries[0].binding = 0;
         bgl_entries[0].visibility = wgpu::ShaderStage::Fragment;
@@ -118,31 +132,44 @@ struct Shader<ShaderKind::Image> : public ShaderBase<Shader<ShaderKind::Image>>
         bgl_entries[2].binding = 2;
         bgl_entries[2].visibility = wgpu::ShaderStage::Fragment;
         bgl_entries[2].buffer.type = wgpu::BufferBindingType::Uniform;
-        bgl_entries[2].buffer.hasDynamicOffset = false;
+        bgl_entries[2].buffer.hasDynamicOffset = true;
         bgl_entries[2].buffer.minBindingSize = sizeof(Uniforms);
+        // tile atlas entry
+        bgl_entries[3].binding = 3;
+        bgl_entries[3].visibility = wgpu::ShaderStage::Fragment;
+        bgl_entries[3].texture.sampleType = wgpu::TextureSampleType::Float;
+        bgl_entries[3].texture.viewDimension = wgpu::TextureViewDimension::_2D;
+        bgl_entries[3].texture.multisampled = false;
+        // page table entry
+        bgl_entries[4].binding = 4;
+        bgl_entries[4].visibility = wgpu::ShaderStage::Fragment;
+        bgl_entries[4].texture.sampleType = wgpu::TextureSampleType::Uint;
+        bgl_entries[4].texture.viewDimension = wgpu::TextureViewDimension::_2D;
+        bgl_entries[4].texture.multisampled = false;
+        // virtual texture uniforms entry
+        bgl_entries[5].binding = 5;
+        bgl_entries[5].visibility = wgpu::ShaderStage::Fragment;
+        bgl_entries[5].buffer.type = wgpu::BufferBindingType::Uniform;
+        bgl_entries[5].buffer.minBindingSize = sizeof(VirtualTexture::Uniforms);
+
+        bind_group_layout = ctx.pipeline_cache.get_bind_group_layout(
+            std::span<const wgpu::BindGroupLayoutEntry>(bgl_entries, virtual_texture ? 6 : 3)
+        );
+    }
 
-        wgpu::BindGroupLayoutDescriptor bgl_desc;
-        bgl_desc.entryCount = 3;
-        bgl_desc.entries = bgl_entries;
-
-        bind_group_layout = ctx.gpu.get_device().createBindGroupLayout(bgl_desc);
-
-        wgpu::BufferDescriptor buffer_desc;
-        buffer_desc.usage = wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst;
-        buffer_desc.size = sizeof(Uniforms);
-        buffer_desc.mappedAtCreation = false;
-
-        buffer = ctx.gpu.get_device().createBuffer(buffer_desc);
 
+    void bind_uniforms(UniformArena& arena) {
+        uniforms_buffer = arena.get_buffer();
         update_bind_group();
     }
 
 
     void update_image_base_dim() {
-        auto& image_resource = ctx.resource_manager.get_image(image_index);
+        auto [width, height] = ctx.resource_manager.get_dimensions(image_index);
+        if (width == base_width && height == base_height) return;  // keep the size set by the user
 
-        base_height = image_resource.data.height;
-        base_width = image_resource.data.width;
+        base_height = height;
+        base_width = width;
 
         uniforms.size_x = base_width;
         uniforms.size_y = base_height;
@@ -150,42 +177,71 @@ struct Shader<ShaderKind::Image> : public ShaderBase<Shader<ShaderKind::Image>>
 
 
     void update_bind_group() {
-        auto& image_resource = ctx.resource_manager.get_image(image_index);
+        if (!uniforms_buffer) return;  // not bound to the arena yet
 
-        wgpu::BindGroupEntry bg_entries[3];
+        wgpu::BindGroupEntry bg_entries[6];
         // texture entry
         bg_entries[0].binding = 0;
-        bg_entries[0].textureView = *image_resource.texture_view;
+        bg_entries[0].textureView = ctx.resource_manager.get_texture_view(image_index);
         // sampler entry
         bg_entries[1].binding = 1;
         bg_entries[1].sampler = *ctx.resource_manager.default_texture_sampler;
         // uniforms entry
         bg_entries[2].binding = 2;
-        bg_entries[2].buffer = *buffer;
+        bg_entries[2].buffer = uniforms_buffer;
         bg_entries[2].offset = 0;
         bg_entries[2].size = sizeof(Uniforms);
+        if (virtual_texture) {
+            const VirtualTexture& vt = ctx.resource_manager.get_virtual_texture(image_index);
+            // tile atlas entry
+            bg_entries[3].binding = 3;
+            bg_entries[3].textureView = ctx.resource_manager.get_tile_atlas_view();
+            // page table entry
+            bg_entries[4].binding = 4;
+            bg_entries[4].textureView = vt.get_page_table_view();
+            // virtual texture uniforms entry
+            bg_entries[5].binding = 5;
+            bg_entries[5].buffer = vt.get_uniforms_buffer();
+            bg_entries[5].offset = 0;
+            bg_entries[5].size = sizeof(VirtualTexture::Uniforms);
+        }
 
         wgpu::BindGroupDescriptor bg_desc;
         bg_desc.layout = *bind_group_layout;
-        bg_desc.entryCount = 3;
+        bg_desc.entryCount = virtual_texture ? 6 : 3;
         bg_desc.entries = bg_entries;
 
         bind_group = ctx.gpu.get_device().createBindGroup(bg_desc);
+        bindings_version++;
     }
 
-    wgpu::raii::PipelineLayout make_pipeline_layout(
-        const Context& ctx, const wgpu::BindGroupLayout& default_bind_group_layout
-    ) {
-        wgpu::raii::PipelineLayout pipeline_layout;
-
-        WGPUBindGroupLayout bgls[2] = {default_bind_group_layout, *bind_group_layout};
+    // Requests the tiles of the virtual texture covering the part of the image inside the render target, the corners
+    // of the target are mapped to image uv like image_virtual.wgsl does. Called every frame before drawing.
+    void request_tiles(ResourceManager& resource_manager) const {
+        if (!virtual_texture || uniforms.size_x == 0.0f || uniforms.size_y == 0.0f) return;
 
-        wgpu::PipelineLayoutDescriptor pipeline_layout_desc;
-        pipeline_layout_desc.bindGroupLayoutCount = 2;
-        pipeline_layout_desc.bindGroupLayouts = bgls;
-        pipeline_layout = ctx.gpu.get_device().createPipelineLayout(pipeline_layout_desc);
+        float cos_r = std::cos(-uniforms.rotation);
+        float sin_r = std::sin(-uniforms.rotation);
+        std::array<float, 4> region = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+        std::array<std::array<unsigned int, 2>, 4> corners = {
+            {{0, 0}, {render_dim[0], 0}, {0, render_dim[1]}, render_dim}
+        };
+        for (auto [x, y] : corners) {
+            float dx = x - uniforms.size_x / 2.0f - uniforms.pos_x;
+            float dy = y - uniforms.size_y / 2.0f - uniforms.pos_y;
+            float u = (cos_r * dx - sin_r * dy) / uniforms.size_x + 0.5f;
+            float v = (sin_r * dx + cos_r * dy) / uniforms.size_y + 0.5f;
+            region = {std::min(region[0], u), std::min(region[1], v), std::max(region[2], u), std::max(region[3], v)};
+        }
+        if (region[2] < 0.0f || region[3] < 0.0f || region[0] > 1.0f || region[1] > 1.0f) return;  // out of view
+        for (float& bound : region) bound = std::clamp(bound, 0.0f, 1.0f);
+        resource_manager.request_tiles(image_index, region, {uniforms.size_x, uniforms.size_y});
+    }
 
-        return pipeline_layout;
+    std::vector<wgpu::BindGroupLayout> get_bind_group_layouts(
+        const wgpu::BindGroupLayout& default_bind_group_layout
+    ) const {
+        return {default_bind_group_layout, *bind_group_layout};
     }
 
 
@@ -193,17 +249,18 @@ struct Shader<ShaderKind::Image> : public ShaderBase<Shader<ShaderKind::Image>>
         parameters.display();
     }
 
-    void write_buffers(wgpu::Queue& queue) const {
-        queue.writeBuffer(*buffer, 0, &uniforms, sizeof(uniforms));
+    void write_uniforms(UniformArena& arena) const {
+        arena.write(uniforms_offset, &uniforms, sizeof(uniforms));
     }
 
     void reset() {
         uniforms = {{{0.0, 0.0, 0.0, 0.0, 0.0, 1.0}}};
         uniforms.size_x = static_cast<float>(base_width);
         uniforms.size_y = static_cast<float>(base_height);
+        uniforms.channels = ctx.resource_manager.get_channels(image_index);
     }
 
     void set_bind_groups(wgpu::RenderPassEncoder& pass_encoder) const {
-        pass_encoder.setBindGroup(1, *bind_group, 0, nullptr);
+        pass_encoder.setBindGroup(1, *bind_group, 1, &uniforms_offset);
     }
 };
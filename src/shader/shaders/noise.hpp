@@ -13,6 +13,9 @@
 template <>
 struct Shader<ShaderKind::Noise> : public ShaderBase<Shader<ShaderKind::Noise>> {
     constexpr static const char* const default_name = "noise";
+    constexpr static const bool POINTWISE = true;
+    constexpr static const char* const effect_function = "noise_effect";
+    constexpr static const char* const effect_uniforms = "NoiseUniforms";
     Shader(const std::string& name, const Context& ctx)
         : ShaderBase<Shader<ShaderKind::Noise>>(name, ctx.shader_source_cache.get(fullscreen_vertex), ctx.shader_source_cache.get(noise), ctx) {}
 
@@ -26,59 +29,30 @@ struct Shader<ShaderKind::Noise> : public ShaderBase<Shader<ShaderKind::Noise>>
         unsigned int seed = 0;
     };
 
+    constexpr static const UniformField UNIFORM_FIELDS[] = {
+        {"colored_min", UniformField::Type::Float, offsetof(Uniforms, colored_min), 3},
+        {"min", UniformField::Type::Float, offsetof(Uniforms, min)},
+        {"colored_max", UniformField::Type::Float, offsetof(Uniforms, colored_max), 3},
+        {"max", UniformField::Type::Float, offsetof(Uniforms, max)},
+        {"control", UniformField::Type::Uint, offsetof(Uniforms, control)},
+        {"seed", UniformField::Type::Uint, offsetof(Uniforms, seed)},
+    };
+
     Uniforms uniforms{};
 
     wgpu::raii::BindGroupLayout bind_group_layout;
-    wgpu::raii::Buffer buffer;
     wgpu::raii::BindGroup bind_group;
 
-    void init() {
-        wgpu::BindGroupLayoutEntry bgl_entry;
-        bgl_entry.binding = 0;
-        bgl_entry.visibility = wgpu::ShaderStage::Fragment;
-        bgl_entry.buffer.type = wgpu::BufferBindingType::Uniform;
-        bgl_entry.buffer.hasDynamicOffset = false;
-        bgl_entry.buffer.minBindingSize = sizeof(Uniforms);
-
-        wgpu::BindGroupLayoutDescriptor bgl_desc;
-        bgl_desc.entryCount = 1;
-        bgl_desc.entries = &bgl_entry;
-        bind_group_layout = ctx.gpu.get_device().createBindGroupLayout(bgl_desc);
-
-        wgpu::BufferDescriptor buffer_desc;
-        buffer_desc.usage = wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst;
-        buffer_desc.size = sizeof(Uniforms);
-        buffer_desc.mappedAtCreation = false;
-
-        buffer = ctx.gpu.get_device().createBuffer(buffer_desc);
-
-        wgpu::BindGroupEntry bg_uniforms_entry;
-        bg_uniforms_entry.binding = 0;
-        bg_uniforms_entry.buffer = *buffer;
-        bg_uniforms_entry.offset = 0;
-        bg_uniforms_entry.size = sizeof(Uniforms);
-
-        wgpu::BindGroupDescriptor bg_desc;
-        bg_desc.layout = *bind_group_layout;
-        bg_desc.entryCount = 1;
-        bg_desc.entries = &bg_uniforms_entry;
-
-        bind_group = ctx.gpu.get_device().createBindGroup(bg_desc);
+    void bind_uniforms(UniformArena& arena) {
+        uniforms_buffer = arena.get_buffer();
+        bind_group_layout = arena.layout(sizeof(Uniforms));
+        bind_group = arena.bind_group(sizeof(Uniforms));
     }
 
-    wgpu::raii::PipelineLayout make_pipeline_layout(
-        const Context& ctx, const wgpu::BindGroupLayout& default_bind_group_layout
-    ) {
-        wgpu::raii::PipelineLayout pipeline_layout;
-
-        WGPUBindGroupLayout bgls[2] = {default_bind_group_layout, *bind_group_layout};
-
-        wgpu::PipelineLayoutDescriptor pipeline_layout_desc;
-        pipeline_layout_desc.bindGroupLayoutCount = 2;
-        pipeline_layout_desc.bindGroupLayouts = bgls;
-        pipeline_layout = ctx.gpu.get_device().createPipelineLayout(pipeline_layout_desc);
-
-        return pipeline_layout;
+    std::vector<wgpu::BindGroupLayout> get_bind_group_layouts(
+        const wgpu::BindGroupLayout& default_bind_group_layout
+    ) const {
+        return {default_bind_group_layout, *bind_group_layout};
     }
 
 
@@ -118,9 +92,15 @@ struct Shader<ShaderKind::Noise> : public ShaderBase<Shader<ShaderKind::Noise>>
         uniforms = {};
     }
 
-    void write_buffers(wgpu::Queue& queue) const { queue.writeBuffer(*buffer, 0, &uniforms, sizeof(uniforms)); }
+    bool is_dynamic() const {
+        return uniforms.control & 2u;
+    }
+
+    void write_uniforms(UniformArena& arena) const {
+        arena.write(uniforms_offset, &uniforms, sizeof(uniforms));
+    }
 
     void set_bind_groups(wgpu::RenderPassEncoder& pass_encoder) const {
-        pass_encoder.setBindGroup(1, *bind_group, 0, nullptr);
+        pass_encoder.setBindGroup(1, *bind_group, 1, &uniforms_offset);
     }
 };
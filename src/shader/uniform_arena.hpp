@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include <webgpu/webgpu-raii.hpp>
+
+#include "src/context/gpu.hpp"
+#include "src/context/pipeline_cache.hpp"
+
+
+// Single uniform buffer holding the uniforms of every stage in 256 bytes slots (the default
+// `minUniformBufferOffsetAlignment`), bound with dynamic offsets.
+// Writes land in a CPU shadow copy, `upload` then sends the changed range with one `writeBuffer`.
+struct UniformArena {
+    static constexpr uint32_t SLOT_SIZE = 256;
+
+    const GPU& gpu;
+    const PipelineCache& pipeline_cache;
+
+    UniformArena(const GPU& gpu, const PipelineCache& pipeline_cache, uint32_t slot_count = 64)
+        : gpu(gpu), pipeline_cache(pipeline_cache) {
+        grow(slot_count);
+    }
+
+    UniformArena(const UniformArena&) = delete;
+    UniformArena(UniformArena&&) = delete;
+
+    // Returns the offset of a free slot. The buffer may be recreated to make room, in that case `get_generation`
+    // changes and every binding to the previous buffer must be rebuilt.
+    uint32_t allocate() {
+        if (free_slots.empty()) grow(2 * shadow.size() / SLOT_SIZE);
+        uint32_t offset = free_slots.back();
+        free_slots.pop_back();
+        return offset;
+    }
+
+    void release(uint32_t offset) {
+        free_slots.push_back(offset);
+    }
+
+    void write(uint32_t offset, const void* data, size_t size) {
+        assert(offset % SLOT_SIZE == 0 && size <= SLOT_SIZE);
+        if (std::memcmp(shadow.data() + offset, data, size) == 0) return;
+
+        std::memcpy(shadow.data() + offset, data, size);
+        dirty_begin = std::min<uint64_t>(dirty_begin, offset);
+        dirty_end = std::max<uint64_t>(dirty_end, offset + size);
+    }
+
+    void upload(const wgpu::Queue& queue) {
+        if (dirty_begin >= dirty_end) return;
+        queue.writeBuffer(*buffer, dirty_begin, shadow.data() + dirty_begin, dirty_end - dirty_begin);
+        dirty_begin = shadow.size();
+        dirty_end = 0;
+    }
+
+    const wgpu::Buffer& get_buffer() const {
+        return *buffer;
+    }
+
+    uint64_t get_generation() const {
+        return generation;
+    }
+
+    // Layout of a lone dynamic offset uniform binding of `size` bytes, shared by every stage binding that size.
+    const wgpu::raii::BindGroupLayout& layout(uint64_t size) const {
+        wgpu::BindGroupLayoutEntry bgl_entry;
+        bgl_entry.binding = 0;
+        bgl_entry.visibility = wgpu::ShaderStage::Fragment;
+        bgl_entry.buffer.type = wgpu::BufferBindingType::Uniform;
+        bgl_entry.buffer.hasDynamicOffset = true;
+        bgl_entry.buffer.minBindingSize = size;
+        return pipeline_cache.get_bind_group_layout({&bgl_entry, 1});
+    }
+
+    // Bind group matching `layout(size)`, the stage picks its slot with the dynamic offset.
+    const wgpu::raii::BindGroup& bind_group(uint64_t size) {
+        if (!bind_groups.contains(size)) {
+            wgpu::BindGroupEntry bg_entry;
+            bg_entry.binding = 0;
+            bg_entry.buffer = *buffer;
+            bg_entry.offset = 0;
+            bg_entry.size = size;
+
+            wgpu::BindGroupDescriptor bg_desc;
+            bg_desc.layout = *layout(size);
+            bg_desc.entryCount = 1;
+            bg_desc.entries = &bg_entry;
+            bind_groups[size] = gpu.get_device().createBindGroup(bg_desc);
+        }
+        return bind_groups[size];
+    }
+
+  private:
+    wgpu::raii::Buffer buffer;
+    std::vector<std::byte> shadow;
+    std::vector<uint32_t> free_slots;  // stack, lowest offsets on top
+    uint64_t dirty_begin = 0;
+    uint64_t dirty_end = 0;
+    uint64_t generation = 0;
+
+    std::unordered_map<uint64_t, wgpu::raii::BindGroup> bind_groups;
+
+    void grow(uint32_t slot_count) {
+        uint32_t previous_count = shadow.size() / SLOT_SIZE;
+        assert(slot_count > previous_count);
+        shadow.resize(slot_count * SLOT_SIZE);
+
+        for (uint32_t slot = slot_count; slot-- > previous_count;) free_slots.push_back(slot * SLOT_SIZE);
+
+        wgpu::BufferDescriptor buffer_desc;
+        buffer_desc.usage = wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst;
+        buffer_desc.size = shadow.size();
+        buffer_desc.mappedAtCreation = false;
+        buffer = gpu.get_device().createBuffer(buffer_desc);
+
+        // new buffer: everything has to be sent again and bind groups point to the old one
+        dirty_begin = 0;
+        dirty_end = shadow.size();
+        bind_groups.clear();
+        generation++;
+    }
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+
+// Values stored densely behind stable generational handles. Insertion and removal are O(1): a removed value is
+// replaced by the last one, and its slot's generation moves on so the stale handle never finds a later value reusing
+// the slot. Handles pack the generation in the high 32 bits and the slot in the low ones.
+template <typename T>
+struct SlotMap {
+    using Handle = uint64_t;
+
+    Handle insert(T&& value) {
+        uint32_t slot;
+        if (!free_slots.empty()) {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        } else {
+            slot = static_cast<uint32_t>(slots.size());
+            slots.push_back({0, 0});
+        }
+        slots[slot].dense_index = static_cast<uint32_t>(values.size());
+        values.push_back(std::move(value));
+        dense_slots.push_back(slot);
+        return make_handle(slot);
+    }
+
+    bool contains(Handle handle) const {
+        uint32_t slot = static_cast<uint32_t>(handle);
+        return slot < slots.size() && slots[slot].generation == static_cast<uint32_t>(handle >> 32) &&
+               slots[slot].dense_index != NONE;
+    }
+
+    T* find(Handle handle) {
+        return contains(handle) ? &values[slots[static_cast<uint32_t>(handle)].dense_index] : nullptr;
+    }
+
+    const T* find(Handle handle) const {
+        return contains(handle) ? &values[slots[static_cast<uint32_t>(handle)].dense_index] : nullptr;
+    }
+
+    T& at(Handle handle) {
+        if (!contains(handle)) throw std::out_of_range("stale or invalid slot map handle");
+        return values[slots[static_cast<uint32_t>(handle)].dense_index];
+    }
+
+    const T& at(Handle handle) const {
+        if (!contains(handle)) throw std::out_of_range("stale or invalid slot map handle");
+        return values[slots[static_cast<uint32_t>(handle)].dense_index];
+    }
+
+    bool erase(Handle handle) {
+        if (!contains(handle)) return false;
+        uint32_t slot = static_cast<uint32_t>(handle);
+        uint32_t index = slots[slot].dense_index;
+        if (index + 1 != values.size()) {
+            values[index] = std::move(values.back());
+            dense_slots[index] = dense_slots.back();
+            slots[dense_slots[index]].dense_index = index;
+        }
+        values.pop_back();
+        dense_slots.pop_back();
+        slots[slot].dense_index = NONE;
+        slots[slot].generation++;
+        free_slots.push_back(slot);
+        return true;
+    }
+
+    size_t size() const {
+        return values.size();
+    }
+
+    // `f(handle, value)` for every value, in storage order. `f` must not insert nor erase.
+    template <typename F>
+    void for_each(F&& f) {
+        for (size_t i = 0; i < values.size(); i++) f(make_handle(dense_slots[i]), values[i]);
+    }
+
+    template <typename F>
+    void for_each(F&& f) const {
+        for (size_t i = 0; i < values.size(); i++) f(make_handle(dense_slots[i]), values[i]);
+    }
+
+  private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Slot {
+        uint32_t generation;
+        uint32_t dense_index;  // NONE while free
+    };
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+    std::vector<T> values;
+    std::vector<uint32_t> dense_slots;  // slot of each value
+
+    Handle make_handle(uint32_t slot) const {
+        return static_cast<Handle>(slots[slot].generation) << 32 | slot;
+    }
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of worker threads running submitted jobs in submission order. Jobs still queued on destruction are
+// dropped, running ones are waited for, call `wait` first to run them all.
+struct ThreadPool {
+    ThreadPool(size_t thread_count) {
+        for (size_t i = 0; i < thread_count; i++) {
+            workers.emplace_back([this](std::stop_token stop) { work(stop); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) = delete;
+
+    ~ThreadPool() {
+        for (std::jthread& worker : workers) worker.request_stop();
+        workers.clear();  // joins
+    }
+
+    void submit(std::function<void()> job) {
+        {
+            std::lock_guard lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        job_available.notify_one();
+    }
+
+    // Blocks until every submitted job has run.
+    void wait() {
+        std::unique_lock lock(mutex);
+        idle.wait(lock, [&] { return jobs.empty() && running == 0; });
+    }
+
+    size_t pending() const {  // queued jobs, not counting running ones
+        std::lock_guard lock(mutex);
+        return jobs.size();
+    }
+
+    size_t get_thread_count() const {
+        return workers.size();
+    }
+
+  private:
+    mutable std::mutex mutex;
+    std::condition_variable_any job_available;
+    std::condition_variable idle;
+    std::deque<std::function<void()>> jobs;
+    size_t running = 0;
+    std::vector<std::jthread> workers;  // last, stopped before the queue they wait on is destroyed
+
+    void work(std::stop_token stop) {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock lock(mutex);
+                if (!job_available.wait(lock, stop, [&] { return !jobs.empty(); })) return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                running++;
+            }
+            job();
+            {
+                std::lock_guard lock(mutex);
+                running--;
+                if (!jobs.empty() || running > 0) continue;
+            }
+            idle.notify_all();
+        }
+    }
+};
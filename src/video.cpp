@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "context.hpp"
+#include "headless.hpp"
+#include "src/bounded_queue.hpp"
+#include "src/context/readback.hpp"
+#include "src/log.hpp"
+#include "src/shader/manager.hpp"
+
+
+// Time is driven by the frame counter, frame `i` sees `i / fps` seconds, so the output only depends on the chain and
+// runs as fast as the GPU and the encoders go:
+//   render + copy (render thread) -> readback (2 staging buffers) -> convert (thread pool) -> write (in order)
+// Y4M frames are 4:2:0 full range BT.601 (`C420jpeg XCOLORRANGE=FULL`), raw frames are packed RGBA8 with no header.
+
+
+namespace {
+
+enum class VideoFormat {
+    Y4M,
+    RGBA,
+};
+
+struct RenderedFrame {
+    size_t index;
+    std::vector<uint8_t> pixels;  // tightly packed RGBA8
+};
+
+
+void usage(const char* program) {
+    Log::log(
+        "usage: {} video [--stage KIND | --image PATH | --video PATH | --chain FILE]...\n"
+        "         (--frames N | --duration SECONDS) --output PATH|- [--size WIDTHxHEIGHT] [--fps N]\n"
+        "         [--format y4m|rgba] [--fallback] [--encoders N]\n"
+        "  --output    `-` streams to stdout, logs then go to stderr\n"
+        "  --fps       frames per second of the output and time step of the shaders (default: 30)\n"
+        "  --format    y4m (default) or headerless rgba frames\n"
+        "  --encoders  conversion threads (default: hardware concurrency / 2)",
+        program
+    );
+}
+
+
+std::string y4m_header(uint32_t width, uint32_t height, double fps) {
+    uint64_t numerator = static_cast<uint64_t>(std::llround(fps * 1000.0));
+    uint64_t denominator = 1000;
+    uint64_t divisor = std::gcd(numerator, denominator);
+    return std::format(
+        "YUV4MPEG2 W{} H{} F{}:{} Ip A1:1 C420jpeg XCOLORRANGE=FULL\n",
+        width,
+        height,
+        numerator / divisor,
+        denominator / divisor
+    );
+}
+
+
+// Appends a `FRAME` with full resolution luma then quarter resolution Cb and Cr, chroma averages 2x2 blocks.
+void append_y4m_frame(std::vector<uint8_t>& out, const uint8_t* rgba, uint32_t width, uint32_t height) {
+    static constexpr std::string_view FRAME = "FRAME\n";
+    uint32_t chroma_width = (width + 1) / 2;
+    uint32_t chroma_height = (height + 1) / 2;
+    size_t luma_size = static_cast<size_t>(width) * height;
+    size_t chroma_size = static_cast<size_t>(chroma_width) * chroma_height;
+
+    size_t start = out.size();
+    out.resize(start + FRAME.size() + luma_size + 2 * chroma_size);
+    std::memcpy(out.data() + start, FRAME.data(), FRAME.size());
+    uint8_t* y_plane = out.data() + start + FRAME.size();
+    uint8_t* cb_plane = y_plane + luma_size;
+    uint8_t* cr_plane = cb_plane + chroma_size;
+
+    for (size_t i = 0; i < luma_size; i++) {
+        const uint8_t* p = rgba + i * 4;
+        y_plane[i] = static_cast<uint8_t>((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+    }
+
+    for (uint32_t cy = 0; cy < chroma_height; cy++) {
+        for (uint32_t cx = 0; cx < chroma_width; cx++) {
+            int r = 0, g = 0, b = 0, count = 0;
+            for (uint32_t y = cy * 2; y < std::min(cy * 2 + 2, height); y++) {
+                for (uint32_t x = cx * 2; x < std::min(cx * 2 + 2, width); x++) {
+                    const uint8_t* p = rgba + (static_cast<size_t>(y) * width + x) * 4;
+                    r += p[0];
+                    g += p[1];
+                    b += p[2];
+                    count++;
+                }
+            }
+            r /= count;
+            g /= count;
+            b /= count;
+            size_t i = static_cast<size_t>(cy) * chroma_width + cx;
+            cb_plane[i] = static_cast<uint8_t>(std::clamp(((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128, 0, 255));
+            cr_plane[i] = static_cast<uint8_t>(std::clamp(((128 * r - 107 * g - 21 * b + 128) >> 8) + 128, 0, 255));
+        }
+    }
+}
+
+
+// Converted frames come out of the thread pool in any order, they wait here until every previous frame is written.
+struct OrderedWriter {
+    std::FILE* file;
+    std::mutex mutex;
+    std::map<size_t, std::vector<uint8_t>> pending;
+    size_t next_index = 0;
+    std::atomic<bool> failed = false;
+
+    void submit(size_t index, std::vector<uint8_t>&& bytes) {
+        std::lock_guard lock(mutex);
+        pending.emplace(index, std::move(bytes));
+        for (auto it = pending.begin(); it != pending.end() && it->first == next_index; it = pending.erase(it)) {
+            write(it->second);
+            next_index++;
+        }
+    }
+
+    // Writes what is left once every frame is rendered, frames whose readback failed are skipped.
+    // Returns how many of the `count` expected writes never came.
+    size_t finish(size_t count) {
+        std::lock_guard lock(mutex);
+        size_t written = next_index + pending.size();
+        for (auto& [index, bytes] : pending) write(bytes);
+        pending.clear();
+        std::fflush(file);
+        return count - written;
+    }
+
+  private:
+    void write(const std::vector<uint8_t>& bytes) {
+        if (failed) return;
+        if (std::fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+            Log::error("Could not write the video stream.");
+            failed = true;
+        }
+    }
+};
+
+}  // namespace
+
+
+int run_video(int argc, char** argv) {
+    GPUOptions gpu_options;
+    std::array<unsigned int, 2> size = {1920, 1080};
+    std::vector<std::pair<std::string_view, std::string_view>> stages;  // (option, value)
+    std::string output;
+    VideoFormat format = VideoFormat::Y4M;
+    double fps = 30.0;
+    double duration = 0.0;
+    size_t frame_count = 0;
+    size_t encoder_count = std::max(1u, std::thread::hardware_concurrency() / 2);
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--fallback") {
+            gpu_options.force_fallback_adapter = true;
+        } else if (arg == "--size" && has_value) {
+            std::optional<std::array<unsigned int, 2>> parsed = parse_size(argv[++i]);
+            if (!parsed) {
+                usage(argv[0]);
+                return 1;
+            }
+            size = parsed.value();
+        } else if ((arg == "--stage" || arg == "--image" || arg == "--video" || arg == "--chain") && has_value) {
+            stages.emplace_back(arg, argv[++i]);
+        } else if (arg == "--fps" && has_value) {
+            fps = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--frames" && has_value) {
+            frame_count = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--duration" && has_value) {
+            duration = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--format" && has_value) {
+            std::string_view value = argv[++i];
+            if (value != "y4m" && value != "rgba") {
+                usage(argv[0]);
+                return 1;
+            }
+            format = value == "y4m" ? VideoFormat::Y4M : VideoFormat::RGBA;
+        } else if (arg == "--output" && has_value) {
+            output = argv[++i];
+        } else if (arg == "--encoders" && has_value) {
+            encoder_count = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (frame_count == 0 && duration > 0.0) frame_count = static_cast<size_t>(std::ceil(duration * fps));
+    if (output.empty() || frame_count == 0 || !(fps > 0.0) || size[0] == 0 || size[1] == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // stdout carries the stream, logging must not end up in the middle of it
+    bool to_stdout = output == "-";
+    std::streambuf* cout_buffer = to_stdout ? std::cout.rdbuf(std::cerr.rdbuf()) : nullptr;
+    struct RestoreCout {
+        std::streambuf* buffer;
+        ~RestoreCout() {
+            if (buffer) std::cout.rdbuf(buffer);
+        }
+    } restore_cout{cout_buffer};
+
+    std::FILE* file = to_stdout ? stdout : std::fopen(output.c_str(), "wb");
+    if (!file) {
+        Log::error("Could not open {}.", output);
+        return 1;
+    }
+    struct CloseFile {
+        std::FILE* file;
+        ~CloseFile() {
+            if (file != stdout) std::fclose(file);
+        }
+    } close_file{file};
+
+    Context ctx(gpu_options);
+    if (!ctx.gpu.is_initialized()) return 1;
+    const wgpu::Device& device = ctx.gpu.get_device();
+    ctx.render_target.dim = size;
+
+    ShaderManager shader_manager(ctx);
+    for (auto [option, value] : stages) {
+        if (!add_stage(ctx, shader_manager, option, value)) return 1;
+    }
+
+    OrderedWriter writer{file};
+    if (format == VideoFormat::Y4M) {
+        std::string header = y4m_header(size[0], size[1], fps);
+        writer.submit(0, std::vector<uint8_t>(header.begin(), header.end()));
+    }
+    size_t index_offset = format == VideoFormat::Y4M ? 1 : 0;  // the header takes the first write
+
+    // Two staging buffers: the GPU copies frame N while frame N - 1 is mapped and handed to the converters
+    ReadbackRing readback(ctx.gpu, 2);
+    BoundedQueue<RenderedFrame> rendered(encoder_count * 2);
+
+    std::vector<std::jthread> encoders;
+    for (size_t i = 0; i < encoder_count; i++) {
+        encoders.emplace_back([&]() {
+            while (std::optional<RenderedFrame> frame = rendered.pop()) {
+                if (format == VideoFormat::RGBA) {
+                    writer.submit(frame->index, std::move(frame->pixels));
+                    continue;
+                }
+                std::vector<uint8_t> bytes;
+                append_y4m_frame(bytes, frame->pixels.data(), size[0], size[1]);
+                writer.submit(frame->index, std::move(bytes));
+            }
+        });
+    }
+
+    while (shader_manager.is_compiling()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t frame = 0; frame < frame_count && !writer.failed; frame++) {
+        shader_manager.set_fixed_time(static_cast<float>(frame / fps));
+        shader_manager.render_chain_streamed();
+
+        wgpu::raii::CommandEncoder cmd_encoder = device.createCommandEncoder();
+        auto on_read = [&, index = frame + index_offset](const ReadbackRing::Frame& mapped) {
+            RenderedFrame rendered_frame{index, std::vector<uint8_t>(mapped.width * mapped.height * 4)};
+            for (size_t y = 0; y < mapped.height; y++) {
+                std::memcpy(
+                    rendered_frame.pixels.data() + y * mapped.width * 4,
+                    mapped.pixels + y * mapped.bytes_per_row,
+                    mapped.width * 4
+                );
+            }
+            rendered.push(std::move(rendered_frame));
+        };
+        while (!readback.enqueue(*cmd_encoder, shader_manager.get_result_texture(), size[0], size[1], on_read)) {
+            device.poll(false, nullptr);  // both buffers busy, let the older mapping complete
+            std::this_thread::yield();
+        }
+        wgpu::raii::CommandBuffer cmd_buffer = cmd_encoder->finish();
+        wgpu::raii::Queue queue = device.getQueue();
+        queue->submit(1, &(*cmd_buffer));
+        readback.flush();
+        device.poll(false, nullptr);
+    }
+    while (readback.in_flight() > 0) device.poll(true, nullptr);
+    rendered.close();
+    encoders.clear();  // joins
+    size_t missing = writer.finish(frame_count + index_offset);
+
+    float seconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+    Log::info(
+        "Rendered {} frames at {}x{} in {:.2f} s ({:.1f} fps, {:.1f}x real time).",
+        frame_count,
+        size[0],
+        size[1],
+        seconds,
+        frame_count / seconds,
+        frame_count / fps / seconds
+    );
+    if (missing > 0) Log::warn("{} frames could not be read back and are missing from the stream.", missing);
+
+    return writer.failed || missing > 0 ? 1 : 0;
+}